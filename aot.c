@@ -0,0 +1,323 @@
+/*
+ * aot.c - Ahead-of-time translation of a loaded image to C, and the runtime that runs the result. All
+ * control flow of the ISA is direct (beq and j), so the code reachable from PCINIT is found statically
+ * and every basic block becomes a label of one function; branches become gotos, and a switch on $pc is
+ * the dispatch table for entering it. Whatever the translation cannot run exactly, an instruction that
+ * halts, a block that does not fit in the instruction budget or code that was overwritten, is left to
+ * the fast engine, which makes the results those of Step().
+ * authors: Josiah Nethery
+ */
+
+#include <dlfcn.h>
+#include "aot.h"
+#include "fast.h"
+#include "sysio.h"
+#include "device.h"
+#include "statehash.h"
+#include "fnv.h"
+
+static unsigned char Code[MEMSIZE];	// the word is a reachable instruction
+static unsigned char Leader[MEMSIZE];	// the word starts a block
+
+static aot_fn Native = NULL;
+static int Stale = 0;			// translated code was overwritten: run on the fast engine only
+
+/* 1 if Step() executes the instruction instead of halting at decode or in the ALU */
+static int valid(unsigned instruction)
+{
+	switch (instruction >> 26)
+	{
+		case 0:
+			switch (instruction & 0x3F)
+			{
+				case 12: case 32: case 34: case 36: case 37: case 42: case 43:
+					return 1;
+			}
+			return 0;
+		case 2: case 4: case 8: case 10: case 11: case 15: case 35: case 43:
+			return 1;
+	}
+	return 0;
+}
+
+static unsigned branch_target(unsigned pc, unsigned instruction)
+{
+	unsigned imm = (instruction & 0x8000) ? (instruction | 0xFFFF0000) : (instruction & 0xFFFF);
+
+	return pc + 4 + (imm << 2);
+}
+
+static unsigned jump_target(unsigned pc, unsigned instruction)
+{
+	return (pc & 0xF8000000) + ((instruction & 0x3FFFFFF) << 2);
+}
+
+/*** discover
+*		Marks the instructions reachable from PCINIT and the first instruction of every block: PCINIT,
+*		the targets of branches and jumps, and the instructions after branches.
+***/
+static void discover(const unsigned *Mem)
+{
+	static unsigned work[2 * MEMSIZE + 1];
+	unsigned n = 0, i;
+
+	memset(Code, 0, sizeof(Code));
+	memset(Leader, 0, sizeof(Leader));
+	work[n++] = PCINIT;
+	while (n > 0)
+	{
+		i = work[--n];
+		if ((i & 3) || i >= MEMBYTES)
+			continue;
+		Leader[i >> 2] = 1;
+		for (i >>= 2; i < MEMSIZE && !Code[i] && valid(Mem[i]); i++)
+		{
+			Code[i] = 1;
+			if (Mem[i] >> 26 == 2)
+			{
+				work[n++] = jump_target(i << 2, Mem[i]);
+				break;
+			}
+			if (Mem[i] >> 26 == 4)
+			{
+				work[n++] = branch_target(i << 2, Mem[i]);
+				work[n++] = (i + 1) << 2;
+				break;
+			}
+		}
+	}
+}
+
+/* control goes to target: the block there, or back to the caller with AOT_MISS */
+static void emit_goto(FILE *out, unsigned target)
+{
+	if (!(target & 3) && target < MEMBYTES && Leader[target >> 2] && Code[target >> 2])
+		fprintf(out, "goto b_%04x;\n", target);
+	else
+		fprintf(out, "{ pc = 0x%xu; code = AOT_MISS; goto out; }\n", target);
+}
+
+/*** emit_block
+*		Writes the block starting at word i; left is the number of its instructions that are not done
+*		when one of them halts. Returns the word after it.
+***/
+static unsigned emit_block(FILE *out, const unsigned *Mem, unsigned i, unsigned lo, unsigned span)
+{
+	unsigned end, length, left, pc, w, rs, rt, rd, imm;
+
+	for (end = i + 1; end < MEMSIZE && Code[end] && !Leader[end]; end++)
+	{
+		if (Mem[end - 1] >> 26 == 2 || Mem[end - 1] >> 26 == 4)
+			break;
+	}
+	length = end - i;
+	fprintf(out, "b_%04x:\n", i << 2);
+	fprintf(out, "\tif (max - n < %u) { pc = 0x%xu; code = AOT_DONE; goto out; }\n", length, i << 2);
+	fprintf(out, "\tn += %u;\n", length);
+	for (left = length; i < end; i++, left--)
+	{
+		pc = i << 2;
+		w = Mem[i];
+		rs = w >> 21 & 0x1F;
+		rt = w >> 16 & 0x1F;
+		rd = w >> 11 & 0x1F;
+		imm = (w & 0x8000) ? (w | 0xFFFF0000) : (w & 0xFFFF);
+		switch (w >> 26)
+		{
+			case 0:
+				switch (w & 0x3F)
+				{
+					case 12:
+						fprintf(out, "\tAOT_SPILL(Reg);\n\tReg[REGSIZE] = 0x%xu;\n", pc);
+						fprintf(out, "\tvalue = env->syscall(Reg, Mem, env->icount + n - %u);\n", left);
+						fprintf(out, "\tAOT_RELOAD(Reg);\n");
+						fprintf(out, "\tif (value) { n -= %u; pc = 0x%xu; code = AOT_HALT; goto out; }\n", left, pc);
+						break;
+					case 32:
+						fprintf(out, "\tr%u = r%u + r%u;\n", rd, rs, rt);
+						break;
+					case 34:
+						fprintf(out, "\tr%u = r%u - r%u;\n", rd, rs, rt);
+						break;
+					case 36:
+						fprintf(out, "\tr%u = r%u & r%u;\n", rd, rs, rt);
+						break;
+					case 37:
+						fprintf(out, "\tr%u = r%u | r%u;\n", rd, rs, rt);
+						break;
+					case 42: //slt, unsigned in the ALU
+						fprintf(out, "\tr%u = r%u < r%u;\n", rd, rs, rt);
+						break;
+					case 43: //sltu, signed in the ALU
+						fprintf(out, "\tr%u = (int) r%u < (int) r%u;\n", rd, rs, rt);
+						break;
+				}
+				break;
+			case 2:
+				fprintf(out, "\t");
+				emit_goto(out, jump_target(pc, w));
+				break;
+			case 4:
+				fprintf(out, "\tif (r%u == r%u) ", rs, rt);
+				emit_goto(out, branch_target(pc, w));
+				break;
+			case 8:
+				fprintf(out, "\tr%u = r%u + 0x%xu;\n", rt, rs, imm);
+				break;
+			case 10: //slti, unsigned in the ALU
+				fprintf(out, "\tr%u = r%u < 0x%xu;\n", rt, rs, imm);
+				break;
+			case 11: //sltiu, signed in the ALU
+				fprintf(out, "\tr%u = (int) r%u < (int) 0x%xu;\n", rt, rs, imm);
+				break;
+			case 15:
+				fprintf(out, "\tr%u = 0x%xu;\n", rt, imm << 16);
+				break;
+			case 35:
+				fprintf(out, "\taddr = r%u + 0x%xu;\n", rs, imm);
+				fprintf(out, "\tif (__builtin_expect((addr & 3) || addr >= MEMBYTES, 0))\n\t{\n");
+				fprintf(out, "\t\tif ((addr & 3) || env->bus(addr, 0, &value, env->icount + n - %u)) "
+					"{ n -= %u; pc = 0x%xu; code = AOT_HALT; goto out; }\n", left, left, pc);
+				fprintf(out, "\t\tr%u = value;\n\t}\n\telse\n\t\tr%u = Mem[addr >> 2];\n", rt, rt);
+				break;
+			case 43:
+				fprintf(out, "\taddr = r%u + 0x%xu;\n", rs, imm);
+				fprintf(out, "\tif (__builtin_expect((addr & 3) || addr >= MEMBYTES, 0))\n\t{\n");
+				fprintf(out, "\t\tvalue = r%u;\n", rt);
+				fprintf(out, "\t\tif ((addr & 3) || env->bus(addr, 1, &value, env->icount + n - %u)) "
+					"{ n -= %u; pc = 0x%xu; code = AOT_HALT; goto out; }\n\t}\n\telse\n\t{\n", left, left, pc);
+				fprintf(out, "\t\tif (touch != NULL)\n\t\t\ttouch(addr >> 2);\n");
+				fprintf(out, "\t\tMem[addr >> 2] = r%u;\n", rt);
+				fprintf(out, "\t\tif (addr - 0x%xu < 0x%xu) { n -= %u; pc = 0x%xu; code = AOT_STALE; goto out; }\n\t}\n",
+					lo, span, left - 1, pc + 4);
+				break;
+		}
+	}
+	if (Mem[end - 1] >> 26 != 2)
+	{
+		fprintf(out, "\t");
+		emit_goto(out, end << 2);
+	}
+	return end;
+}
+
+int aot_translate(const unsigned *Mem, FILE *out)
+{
+	unsigned i, lo = MEMSIZE, hi = 0;
+	int r, blocks = 0;
+
+	discover(Mem);
+	for (i = 0; i < MEMSIZE; i++)
+	{
+		if (Code[i])
+		{
+			lo = lo < i ? lo : i;
+			hi = i;
+		}
+	}
+	fprintf(out, "/* translated by spimcore -translate; build with gcc -O2 -shared -fPIC */\n");
+	fprintf(out, "#include \"aot.h\"\n\n");
+	fprintf(out, "const int aot_abi = AOT_ABI;\n");
+	fprintf(out, "const unsigned long long aot_key = 0x%016llxULL;\n\n", hash_bytes(Mem, MEMBYTES, 0));
+	fprintf(out, "int aot_run(struct_aot_env *env, unsigned long long max)\n{\n");
+	fprintf(out, "\tunsigned *Mem = env->Mem, *Reg = env->Reg;\n");
+	fprintf(out, "\tvoid (*touch)(unsigned) = env->touch;\n");
+	fprintf(out, "\tunsigned r0");
+	for (r = 1; r < REGSIZE; r++)
+		fprintf(out, ", r%d", r);
+	fprintf(out, ";\n\tunsigned pc = Reg[REGSIZE], addr, value;\n");
+	fprintf(out, "\tunsigned long long n = 0;\n\tint code;\n\n");
+	fprintf(out, "\tAOT_RELOAD(Reg);\n\tswitch (pc)\n\t{\n");
+	for (i = 0; i < MEMSIZE; i++)
+	{
+		if (Code[i] && Leader[i])
+			fprintf(out, "\t\tcase 0x%x: goto b_%04x;\n", i << 2, i << 2);
+	}
+	fprintf(out, "\t\tdefault: code = AOT_MISS; goto out;\n\t}\n");
+	for (i = 0; i < MEMSIZE; )
+	{
+		if (Code[i] && Leader[i])
+		{
+			i = emit_block(out, Mem, i, lo << 2, (hi - lo + 1) << 2);
+			blocks++;
+		}
+		else
+			i++;
+	}
+	fprintf(out, "out:\n\tAOT_SPILL(Reg);\n\tReg[REGSIZE] = pc;\n\tenv->n = n;\n\treturn code;\n}\n");
+	return blocks;
+}
+
+int aot_load(const char *path, const unsigned *Mem, FILE *err)
+{
+	void *handle;
+	const int *abi;
+	const unsigned long long *key;
+
+	if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+	{
+		fprintf(err, "cannot load translation %s: %s\n", path, dlerror());
+		return 1;
+	}
+	abi = (const int *) dlsym(handle, "aot_abi");
+	key = (const unsigned long long *) dlsym(handle, "aot_key");
+	*(void **) (&Native) = dlsym(handle, "aot_run");
+	if (abi == NULL || key == NULL || Native == NULL || *abi != AOT_ABI)
+	{
+		fprintf(err, "%s is not a translation for this simulator\n", path);
+		dlclose(handle);
+		Native = NULL;
+		return 1;
+	}
+	if (*key != hash_bytes(Mem, MEMBYTES, 0))
+	{
+		fprintf(err, "%s was translated from another image\n", path);
+		dlclose(handle);
+		Native = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+int aot_active(void)
+{
+	return Native != NULL;
+}
+
+static void touch(unsigned index)
+{
+	hash_touch(StateHash, index);
+}
+
+unsigned long long aot_execute(unsigned *Mem, unsigned *Reg, int *Halt, unsigned long long *InstCount,
+	unsigned long long max)
+{
+	struct_aot_env env;
+	unsigned long long done = 0;
+	int result;
+
+	env.Mem = Mem;
+	env.Reg = Reg;
+	env.syscall = syscall_exec;
+	env.bus = bus_access;
+	env.touch = StateHash != NULL ? touch : NULL;
+	*Halt = 0;
+	while (done < max && !*Halt)
+	{
+		if (Stale)
+			return done + fast_run(Mem, Reg, Halt, InstCount, max - done, NULL, NULL);
+		env.icount = *InstCount;
+		result = Native(&env, max - done);
+		*InstCount += env.n;
+		done += env.n;
+		if (result == AOT_HALT)
+			*Halt = 1;
+		else if (result == AOT_STALE)
+			Stale = 1;
+		else if (result == AOT_MISS)
+			done += fast_run(Mem, Reg, Halt, InstCount, 1, NULL, NULL);
+		else
+			done += fast_run(Mem, Reg, Halt, InstCount, max - done, NULL, NULL);
+	}
+	return done;
+}
@@ -0,0 +1,62 @@
+#include "spimcore.h"
+
+#ifndef AOT
+
+/***
+*		Ahead-of-time translation. spimcore prog.asc -translate prog.c writes the code reachable from
+*		PCINIT as one C function, aot_run(), with a label per basic block and the registers in locals.
+*		Built with gcc -O2 -shared -fPIC -I<this directory> -o prog.so prog.c, it is loaded with
+*		-native prog.so and replaces the fast engine in batch mode for the image it was translated from.
+***/
+#define AOT_ABI 1
+
+/* results of aot_run() */
+#define AOT_DONE 0	// the next block does not fit in max; $pc is its first instruction
+#define AOT_HALT 1	// the instruction at $pc halts the machine
+#define AOT_MISS 2	// $pc is not the first instruction of a translated block
+#define AOT_STALE 3	// a store wrote translated code; $pc is the instruction after it
+
+/* what translated code is given to run */
+typedef struct
+{
+	unsigned *Mem;
+	unsigned *Reg;
+	unsigned long long icount;	// instructions completed before the call
+	unsigned long long n;		// set to the instructions completed by the call
+	int (*syscall)(unsigned *Reg, unsigned *Mem, unsigned long long icount);
+	int (*bus)(unsigned addr, int write, unsigned *value, unsigned long long icount);
+	void (*touch)(unsigned index);	// a memory word is about to be written, or NULL
+}struct_aot_env;
+
+/* the function a translation defines: runs whole blocks from $pc while they fit in max instructions */
+typedef int (*aot_fn)(struct_aot_env *env, unsigned long long max);
+
+/* copy the locals r0-r31 of translated code to Reg and back */
+#define AOT_SPILL(Reg) \
+	(Reg[0] = r0, Reg[1] = r1, Reg[2] = r2, Reg[3] = r3, Reg[4] = r4, Reg[5] = r5, Reg[6] = r6, Reg[7] = r7, \
+	Reg[8] = r8, Reg[9] = r9, Reg[10] = r10, Reg[11] = r11, Reg[12] = r12, Reg[13] = r13, Reg[14] = r14, Reg[15] = r15, \
+	Reg[16] = r16, Reg[17] = r17, Reg[18] = r18, Reg[19] = r19, Reg[20] = r20, Reg[21] = r21, Reg[22] = r22, Reg[23] = r23, \
+	Reg[24] = r24, Reg[25] = r25, Reg[26] = r26, Reg[27] = r27, Reg[28] = r28, Reg[29] = r29, Reg[30] = r30, Reg[31] = r31)
+#define AOT_RELOAD(Reg) \
+	(r0 = Reg[0], r1 = Reg[1], r2 = Reg[2], r3 = Reg[3], r4 = Reg[4], r5 = Reg[5], r6 = Reg[6], r7 = Reg[7], \
+	r8 = Reg[8], r9 = Reg[9], r10 = Reg[10], r11 = Reg[11], r12 = Reg[12], r13 = Reg[13], r14 = Reg[14], r15 = Reg[15], \
+	r16 = Reg[16], r17 = Reg[17], r18 = Reg[18], r19 = Reg[19], r20 = Reg[20], r21 = Reg[21], r22 = Reg[22], r23 = Reg[23], \
+	r24 = Reg[24], r25 = Reg[25], r26 = Reg[26], r27 = Reg[27], r28 = Reg[28], r29 = Reg[29], r30 = Reg[30], r31 = Reg[31])
+
+/* write the translation of the image in Mem to out; returns the number of blocks */
+int aot_translate(const unsigned *Mem, FILE *out);
+
+/* load a translation; returns 1 with a message on err if it cannot be loaded or was translated from
+   another image than Mem */
+int aot_load(const char *path, const unsigned *Mem, FILE *err);
+
+/* 1 once a translation is loaded */
+int aot_active(void);
+
+/* fast_run() on the loaded translation: instructions outside it, a block that does not fit in max and
+   everything after a store into translated code run on the fast engine */
+unsigned long long aot_execute(unsigned *Mem, unsigned *Reg, int *Halt, unsigned long long *InstCount,
+	unsigned long long max);
+
+#define AOT
+#endif
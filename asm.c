@@ -0,0 +1,937 @@
+/*
+ * asm.c - The core of the MIPS assembler: a single-pass lexer and parser that encodes one source
+ * file into a relocatable object. Labels are local to their file unless declared with .globl.
+ * authors: Josiah Nethery
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "asm.h"
+
+/***
+*		The mnemonics the assembler knows with their op-code and funct. The coprocessor 0 instructions
+*		(op-code 16) also carry their rs field in the funct, above bit 6.
+***/
+struct opcode
+{
+	const char *name;
+	int op;
+	int funct;
+};
+
+static const struct opcode Opcodes[] = {
+	{"add", 0, 32}, {"sub", 0, 34}, {"and", 0, 36}, {"or", 0, 37},
+	{"slt", 0, 42}, {"sltu", 0, 43}, {"syscall", 0, 12}, {"j", 2, 0},
+	{"beq", 4, 0}, {"addi", 8, 0}, {"slti", 10, 0}, {"sltiu", 11, 0},
+	{"lui", 15, 0}, {"lw", 35, 0}, {"sw", 43, 0},
+	{"mfc0", 16, 0 << 6}, {"mtc0", 16, 4 << 6}, {"tlbr", 16, 16 << 6 | 1}, {"tlbwi", 16, 16 << 6 | 2},
+	{"tlbwr", 16, 16 << 6 | 6}, {"tlbp", 16, 16 << 6 | 8}, {"eret", 16, 16 << 6 | 24} };
+
+/***
+*		These register names are basically copied and pasted from spimcore and are used 
+*		when turning register names such as $v0 or $2 into ints.
+***/
+static const char RegName[36][6] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", 
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", 
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+	"pc", "stat", "lo", "hi" };
+
+/*** assemble_file
+*		This function maps a source file into memory, assembles it in a single pass and turns the
+*		result into a relocatable object. Returns 1 on any error.
+***/
+int assemble_file(const char *path, struct object *obj)
+{
+	size_t size;
+	char *text = map_file(path, &size);
+	int error;
+	if (text == NULL)
+		return 1;
+	error = assemble_buffer(text, size, path, NULL, obj);
+	unmap_file(text, size);
+	return error;
+}
+
+/*** assemble_buffer
+*		This function assembles source text held in memory into a relocatable object, running the optimizer
+*		over it unless stats is NULL. The text does not need to be terminated. Returns 1 on any error.
+***/
+int assemble_buffer(const char *text, size_t size, const char *name, struct opt_stats *stats, struct object *obj)
+{
+	struct program prog;
+	struct lexer lex;
+	int error;
+	memset(&prog, 0, sizeof(prog));
+	lex.cur = text;
+	lex.end = text + size;
+	lex.line_start = text;
+	lex.line = 1;
+	lex.name = name;
+	error = assemble(&prog, &lex); //tokenize and encode the whole file, then backpatch what can be resolved locally
+	if (!error && stats != NULL && optimize_program(&prog, stats))
+	{
+		printf("%s: error: branch out of range after optimization\n", name);
+		error = 1;
+	}
+	if (!error)
+		make_object(&prog, name, obj); //copies every name out of the source text
+	free_program(&prog);
+	return error;
+}
+
+/*** map_file
+*		This function maps a whole file read-only into memory and sets *size. An empty file gives
+*		an empty string. Returns NULL (with an error message) if the file cannot be read.
+***/
+char* map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	char *text;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		printf("Error: cannot open input file %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return (char*)"";
+	}
+	text = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+	{
+		printf("Error: cannot read input file %s\n", path);
+		return NULL;
+	}
+	return text;
+}
+
+/*** unmap_file
+*		This function releases a mapping made by map_file.
+***/
+void unmap_file(char *text, size_t size)
+{
+	if (size > 0)
+		munmap(text, size);
+}
+
+/*** make_object
+*		This function encodes the instructions, copies the data and collects the symbols and the remaining
+*		fixups (every j, la and .word, and every beq to a label of another file) into an object.
+***/
+void make_object(struct program *prog, const char *name, struct object *obj)
+{
+	struct symbol *sym;
+	struct fixup *fix;
+	int i;
+	memset(obj, 0, sizeof(struct object));
+	obj->name = arena_strdup(&obj->strings, name, strlen(name));
+	obj->text = (unsigned*)malloc((prog->count ? prog->count : 1) * sizeof(unsigned));
+	for (i = 0; i < prog->count; i++)
+		obj->text[i] = encode_instruction(&prog->inst[i]);
+	obj->text_count = prog->count;
+	obj->data_count = (prog->data_size + 3) / 4;
+	obj->data = (unsigned*)malloc((obj->data_count ? obj->data_count : 1) * sizeof(unsigned));
+	memcpy(obj->data, prog->data, obj->data_count * sizeof(unsigned));
+	obj->symbols = (struct objsymbol*)malloc((prog->symbols.count + prog->fixup_count + 1) * sizeof(struct objsymbol));
+	for (i = 0; i < prog->symbols.capacity; i++)
+	{
+		sym = &prog->symbols.slots[i];
+		if (sym->name == NULL)
+			continue;
+		obj->symbols[obj->symbol_count].name = arena_strdup(&obj->strings, sym->name, strlen(sym->name));
+		obj->symbols[obj->symbol_count].offset = sym->address < 0 ? 0 : sym->address;
+		obj->symbols[obj->symbol_count].kind = sym->address < 0 ? SYM_EXTERN : sym->global ? SYM_GLOBAL : SYM_LOCAL;
+		obj->symbols[obj->symbol_count].section = sym->section;
+		obj->symbol_count++;
+	}
+	obj->relocs = (struct reloc*)malloc((prog->fixup_count + 1) * sizeof(struct reloc));
+	for (i = 0; i < prog->fixup_count; i++)
+	{
+		fix = &prog->fixups[i];
+		obj->relocs[i].index = fix->index;
+		obj->relocs[i].type = fix->type;
+		obj->relocs[i].section = fix->section;
+		obj->relocs[i].line = fix->label.line;
+		obj->relocs[i].name = arena_strdup(&obj->strings, fix->label.start, fix->label.length);
+	}
+	obj->reloc_count = prog->fixup_count;
+}
+
+/*** encode_instruction
+*		This function packs the fields of an instruction into its 32-bit machine code.
+***/
+unsigned encode_instruction(struct instruction *inst)
+{
+	unsigned code = 0x0;
+	code += inst->op << 26;
+	code += inst->r1 << 21;
+	code += inst->r2 << 16;
+	code += inst->r3 << 11;
+	code += inst->funct & 0x3F;
+	code += inst->offset & 0xFFFF;
+	code += (inst->jsec >> 2) & 0x3FFFFFF;
+	return code;
+}
+
+/*** assemble
+*		This function is the main processing loop. Every line holds any number of labels followed by at most one
+*		instruction or directive. Labels get the offset of the next instruction or data byte within their section
+*		of the file. Directives and pseudo-instructions are handled first; otherwise the op-code and corresponding
+*		funct are determined from the mnemonic and then the operands are parsed and encoded straight into the
+*		instruction's slot in the array. beq to labels that are not defined yet and every j are put on the
+*		backpatch list.
+***/
+int assemble(struct program *prog, struct lexer *lex)
+{
+	struct token tok;
+	struct instruction *inst;
+	int op, funct, index, offset, pseudo;
+	for (;;)
+	{
+		next_token(lex, &tok);
+		while (tok.type == TOK_LABEL)
+		{
+			offset = prog->section == SECT_TEXT ? 4 * prog->count : prog->data_size;
+			if (define_label(prog, tok.start, tok.length, offset, prog->section))
+				return token_error(lex, &tok, "label defined twice");
+			next_token(lex, &tok);
+		}
+		if (tok.type == TOK_EOF)
+			break;
+		if (tok.type == TOK_NEWLINE)
+			continue;
+		if (tok.type != TOK_IDENT)
+			return token_error(lex, &tok, "expected an instruction");
+		if (tok.start[0] == '.')
+		{
+			if (expect_directive(prog, lex, &tok))
+				return 1;
+			continue;
+		}
+		if (prog->section != SECT_TEXT)
+			return token_error(lex, &tok, "instruction outside .text");
+		if ((pseudo = expand_pseudo(prog, lex, &tok)) > 0)
+			return 1;
+		if (pseudo < 0)
+		{
+			set_op_funct(&op, &funct, &tok);
+			if (op < 0)
+				return token_error(lex, &tok, "unknown instruction");
+			if ((index = add_instruction(prog)) < 0)
+				return token_error(lex, &tok, "out of memory");
+			inst = &prog->inst[index];
+			inst->op = op;
+			inst->funct = funct;
+			if (op == 0 && funct == 12) //syscall, the service number is in $v0
+			{
+			}
+			else if (op == 0) //add, sub, and, or, slt, sltu
+			{
+				if (expect_reg(lex, &inst->r3, 1) || expect_reg(lex, &inst->r1, 1) || expect_reg(lex, &inst->r2, 0))
+					return 1;
+			}
+			else if (op == 2) //j
+			{
+				if (reference_label(prog, lex, index))
+					return 1;
+			}
+			else if (op == 4) //beq
+			{
+				if (expect_reg(lex, &inst->r1, 1) || expect_reg(lex, &inst->r2, 1) || reference_label(prog, lex, index))
+					return 1;
+			}
+			else if (op == 8 || op == 10 || op == 11) //addi, slti, sltiu: rt, rs, immediate
+			{
+				if (expect_reg(lex, &inst->r2, 1) || expect_reg(lex, &inst->r1, 1) || expect_number(lex, &inst->offset, 0))
+					return 1;
+			}
+			else if (op == 15) //lui
+			{
+				if (expect_reg(lex, &inst->r2, 1) || expect_number(lex, &inst->offset, 0))
+					return 1;
+			}
+			else if (op == 35 || op == 43) //lw, sw
+			{
+				if (expect_reg(lex, &inst->r2, 1) || expect_mem_operand(lex, &offset, &inst->r1))
+					return 1;
+				inst->offset = offset;
+			}
+			else if (op == 16) //mfc0 and mtc0 rt, rd (rd a coprocessor 0 register such as $12), TLB operations and eret
+			{
+				inst->r1 = funct >> 6;
+				inst->funct = funct & 0x3F;
+				if (inst->r1 != 16 && (expect_reg(lex, &inst->r2, 1) || expect_reg(lex, &inst->r3, 0)))
+					return 1;
+			}
+		}
+		next_token(lex, &tok);
+		if (tok.type != TOK_NEWLINE && tok.type != TOK_EOF)
+			return token_error(lex, &tok, "unexpected operand");
+		if (tok.type == TOK_EOF)
+			break;
+	}
+	return backpatch(prog);
+}
+
+/*** next_token
+*		The lexer. Skips blanks and '#' comments and returns the next token as a view into the input.
+*		Identifiers directly followed by ':' are labels, '$' starts a register and numbers may be
+*		negative and decimal or hexadecimal (0x...).
+***/
+void next_token(struct lexer *lex, struct token *tok)
+{
+	const char *c = lex->cur;
+	const char *end = lex->end;
+	int negative = 0, base = 10, digit;
+	while (c < end && (*c == ' ' || *c == '\t' || *c == '\r'))
+		c++;
+	if (c < end && *c == '#')
+	{
+		while (c < end && *c != '\n')
+			c++;
+	}
+	tok->start = c;
+	tok->line = lex->line;
+	tok->column = (int)(c - lex->line_start) + 1;
+	tok->value = 0;
+	if (c == end)
+	{
+		tok->type = TOK_EOF;
+	}
+	else if (*c == '\n')
+	{
+		tok->type = TOK_NEWLINE;
+		c++;
+		lex->line++;
+		lex->line_start = c;
+	}
+	else if (*c == ',' || *c == '(' || *c == ')')
+	{
+		tok->type = (*c == ',') ? TOK_COMMA : (*c == '(') ? TOK_LPAREN : TOK_RPAREN;
+		c++;
+	}
+	else if (*c == '$')
+	{
+		tok->type = TOK_REG;
+		c++;
+		while (c < end && ((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9')))
+			c++;
+	}
+	else if ((*c >= '0' && *c <= '9') || (*c == '-' && c + 1 < end && c[1] >= '0' && c[1] <= '9'))
+	{
+		tok->type = TOK_NUMBER;
+		if (*c == '-')
+		{
+			negative = 1;
+			c++;
+		}
+		if (c + 1 < end && c[0] == '0' && (c[1] == 'x' || c[1] == 'X'))
+		{
+			base = 16;
+			c += 2;
+		}
+		for (; c < end; c++)
+		{
+			if (*c >= '0' && *c <= '9')
+				digit = *c - '0';
+			else if (base == 16 && *c >= 'a' && *c <= 'f')
+				digit = *c - 'a' + 10;
+			else if (base == 16 && *c >= 'A' && *c <= 'F')
+				digit = *c - 'A' + 10;
+			else
+				break;
+			tok->value = tok->value * base + digit;
+		}
+		if (negative)
+			tok->value = -tok->value;
+	}
+	else if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || *c == '_' || *c == '.')
+	{
+		tok->type = TOK_IDENT;
+		while (c < end && ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_' || *c == '.'))
+			c++;
+		if (c < end && *c == ':')
+		{
+			tok->type = TOK_LABEL;
+			tok->length = (int)(c - tok->start);
+			lex->cur = c + 1;
+			return;
+		}
+	}
+	else
+	{
+		tok->type = TOK_ERROR;
+		c++;
+	}
+	tok->length = (int)(c - tok->start);
+	lex->cur = c;
+}
+
+/*** token_error
+*		This function prints an error message with the file, line and column of the token. Always returns 1.
+***/
+int token_error(struct lexer *lex, struct token *tok, const char *message)
+{
+	if (tok->type == TOK_NEWLINE || tok->type == TOK_EOF)
+		printf("%s:%d:%d: error: %s at end of line\n", lex->name, tok->line, tok->column, message);
+	else
+		printf("%s:%d:%d: error: %s '%.*s'\n", lex->name, tok->line, tok->column, message, tok->length, tok->start);
+	return 1;
+}
+
+/*** set_op_funct
+*		This function sets the op-code and corresponding funct code for the mnemonic in the token.
+*		The op-code is set to -1 for a mnemonic that isn't implemented.
+***/
+void set_op_funct(int *op, int *funct, struct token *tok)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(Opcodes) / sizeof(Opcodes[0])); i++)
+	{
+		if (strncmp(Opcodes[i].name, tok->start, tok->length) == 0 && Opcodes[i].name[tok->length] == '\0')
+		{
+			*op = Opcodes[i].op;
+			*funct = Opcodes[i].funct;
+			return;
+		}
+	}
+	*op = -1;
+	*funct = 0;
+}
+
+/*** get_reg
+*		This function is used for turning register tokens such as $v0 or $2 into int values.
+*		Returns -1 for an invalid register.
+***/
+int get_reg(struct token *tok)
+{
+	const char *name = tok->start + 1;
+	int length = tok->length - 1;
+	int i, number = 0;
+	if (length > 0 && name[0] >= '0' && name[0] <= '9')
+	{
+		for (i = 0; i < length; i++)
+		{
+			if (name[i] < '0' || name[i] > '9')
+				return -1;
+			number = number * 10 + name[i] - '0';
+		}
+		return (number < 36 && length <= 2) ? number : -1;
+	}
+	for (i = 0; i < 36; i++)
+	{
+		if (strncmp(RegName[i], name, length) == 0 && RegName[i][length] == '\0')
+			return i; //returns the int value of the register 
+	}
+	return -1;
+}
+
+/*** expect_reg
+*		This function reads a register operand, followed by a comma if comma is set.
+***/
+int expect_reg(struct lexer *lex, int *reg, int comma)
+{
+	struct token tok;
+	next_token(lex, &tok);
+	if (tok.type != TOK_REG || (*reg = get_reg(&tok)) < 0)
+		return token_error(lex, &tok, "expected a register");
+	if (comma)
+	{
+		next_token(lex, &tok);
+		if (tok.type != TOK_COMMA)
+			return token_error(lex, &tok, "expected ','");
+	}
+	return 0;
+}
+
+/*** expect_number
+*		This function reads an immediate operand, followed by a comma if comma is set.
+***/
+int expect_number(struct lexer *lex, int *value, int comma)
+{
+	struct token tok;
+	next_token(lex, &tok);
+	if (tok.type != TOK_NUMBER)
+		return token_error(lex, &tok, "expected a number");
+	*value = (int)tok.value;
+	if (comma)
+	{
+		next_token(lex, &tok);
+		if (tok.type != TOK_COMMA)
+			return token_error(lex, &tok, "expected ','");
+	}
+	return 0;
+}
+
+/*** expect_mem_operand
+*		This function is used to turn operands such as 100($29) or ($sp) into an offset int and a register int.
+***/
+int expect_mem_operand(struct lexer *lex, int *mem_offset, int *mem_reg)
+{
+	struct token tok;
+	*mem_offset = 0;
+	next_token(lex, &tok);
+	if (tok.type == TOK_NUMBER)
+	{
+		*mem_offset = (int)tok.value;
+		next_token(lex, &tok);
+	}
+	if (tok.type != TOK_LPAREN)
+		return token_error(lex, &tok, "expected '('");
+	next_token(lex, &tok);
+	if (tok.type != TOK_REG || (*mem_reg = get_reg(&tok)) < 0)
+		return token_error(lex, &tok, "expected a register");
+	next_token(lex, &tok);
+	if (tok.type != TOK_RPAREN)
+		return token_error(lex, &tok, "expected ')'");
+	return 0;
+}
+
+/*** expect_globl
+*		This function reads the names after a .globl directive and marks them global. A global name
+*		that is never defined in this file refers to a label of another file.
+***/
+int expect_globl(struct program *prog, struct lexer *lex)
+{
+	struct token tok;
+	struct symbol *sym;
+	for (;;)
+	{
+		next_token(lex, &tok);
+		if (tok.type != TOK_IDENT)
+			return token_error(lex, &tok, "expected a label");
+		sym = symtab_enter(&prog->symbols, &prog->strings, tok.start, tok.length);
+		sym->global = 1;
+		next_token(lex, &tok);
+		if (tok.type == TOK_NEWLINE || tok.type == TOK_EOF)
+			return 0;
+		if (tok.type != TOK_COMMA)
+			return token_error(lex, &tok, "expected ','");
+	}
+}
+
+/*** expect_directive
+*		This function handles the directive in tok and the rest of its line:
+*		.text and .data select the section, .globl exports names, .word stores words (numbers or label
+*		addresses), .space reserves zeroed bytes and .align n pads the data to a multiple of 2^n bytes.
+*		.word must start on a word boundary.
+***/
+int expect_directive(struct program *prog, struct lexer *lex, struct token *tok)
+{
+	struct token arg;
+	int i, value;
+	if (tok->length == 6 && strncmp(tok->start, ".globl", 6) == 0)
+		return expect_globl(prog, lex);
+	if ((tok->length == 5 && strncmp(tok->start, ".text", 5) == 0) || (tok->length == 5 && strncmp(tok->start, ".data", 5) == 0))
+	{
+		prog->section = tok->start[1] == 't' ? SECT_TEXT : SECT_DATA;
+		next_token(lex, &arg);
+		if (arg.type != TOK_NEWLINE && arg.type != TOK_EOF)
+			return token_error(lex, &arg, "unexpected operand");
+		return 0;
+	}
+	if (prog->section != SECT_DATA)
+		return token_error(lex, tok, "directive outside .data");
+	if (tok->length == 5 && strncmp(tok->start, ".word", 5) == 0)
+	{
+		if (prog->data_size & 3)
+			return token_error(lex, tok, "unaligned .word (use .align 2)");
+		for (;;)
+		{
+			next_token(lex, &arg);
+			value = (int)arg.value;
+			if (arg.type == TOK_IDENT)
+			{
+				if (add_fixup(prog, &arg, prog->data_size / 4, RELOC_WORD, SECT_DATA))
+					return token_error(lex, &arg, "out of memory");
+				value = 0;
+			}
+			else if (arg.type != TOK_NUMBER)
+				return token_error(lex, &arg, "expected a number or a label");
+			if (add_data(prog, (unsigned)value, 4))
+				return token_error(lex, &arg, "out of memory");
+			next_token(lex, &arg);
+			if (arg.type == TOK_NEWLINE || arg.type == TOK_EOF)
+				return 0;
+			if (arg.type != TOK_COMMA)
+				return token_error(lex, &arg, "expected ','");
+		}
+	}
+	if ((tok->length == 6 && strncmp(tok->start, ".space", 6) == 0) || (tok->length == 6 && strncmp(tok->start, ".align", 6) == 0))
+	{
+		next_token(lex, &arg);
+		if (arg.type != TOK_NUMBER || arg.value < 0 || arg.value > (tok->start[1] == 's' ? MEM_LIMIT : 12))
+			return token_error(lex, &arg, "expected a size");
+		value = tok->start[1] == 's' ? (int)arg.value : (-prog->data_size) & ((1 << arg.value) - 1);
+		for (i = 0; i < value; i++)
+		{
+			if (add_data(prog, 0, 1))
+				return token_error(lex, &arg, "out of memory");
+		}
+		next_token(lex, &arg);
+		if (arg.type != TOK_NEWLINE && arg.type != TOK_EOF)
+			return token_error(lex, &arg, "unexpected operand");
+		return 0;
+	}
+	return token_error(lex, tok, "unknown directive");
+}
+
+/*** expand_pseudo
+*		This function expands the pseudo-instruction in tok into real instructions. Returns -1 if tok is not a
+*		pseudo-instruction, 1 on an error and 0 otherwise.
+*		nop is add $zero, $zero, $zero (an all-zero word halts the machine) and move is add with $zero.
+*		li uses the shortest sequence for its immediate: one addi if it fits 16 signed bits, one lui if its low
+*		half is zero, and lui + addi otherwise. There is no ori, so the upper half is rounded up when the lower
+*		half is negative. la always takes lui + addi, relocated by the linker. blt and bgt set $at with sltu,
+*		which is the signed comparison of this machine's datapath, turn it into 0 for "less" and branch on it.
+***/
+int expand_pseudo(struct program *prog, struct lexer *lex, struct token *tok)
+{
+	struct token label;
+	int rd, rs, rt, value = 0, index;
+	if (tok->length == 3 && strncmp(tok->start, "nop", 3) == 0)
+		return emit_instruction(prog, 0, 0, 0, 0, 32, 0) < 0 ? token_error(lex, tok, "out of memory") : 0;
+	if (tok->length == 4 && strncmp(tok->start, "move", 4) == 0)
+	{
+		if (expect_reg(lex, &rd, 1) || expect_reg(lex, &rs, 0))
+			return 1;
+		return emit_instruction(prog, 0, rs, 0, rd, 32, 0) < 0 ? token_error(lex, tok, "out of memory") : 0;
+	}
+	if (tok->length == 2 && strncmp(tok->start, "li", 2) == 0)
+	{
+		if (expect_reg(lex, &rt, 1) || expect_number(lex, &value, 0))
+			return 1;
+		if (value >= -32768 && value <= 32767)
+			index = emit_instruction(prog, 8, 0, rt, 0, 0, value);
+		else if ((value & 0xFFFF) == 0)
+			index = emit_instruction(prog, 15, 0, rt, 0, 0, (value >> 16) & 0xFFFF);
+		else if ((index = emit_instruction(prog, 15, 0, rt, 0, 0, ((unsigned)value + 0x8000) >> 16)) >= 0)
+			index = emit_instruction(prog, 8, rt, rt, 0, 0, (short)(value & 0xFFFF));
+		return index < 0 ? token_error(lex, tok, "out of memory") : 0;
+	}
+	if (tok->length == 2 && strncmp(tok->start, "la", 2) == 0)
+	{
+		if (expect_reg(lex, &rt, 1))
+			return 1;
+		next_token(lex, &label);
+		if (label.type != TOK_IDENT)
+			return token_error(lex, &label, "expected a label");
+		if ((index = emit_instruction(prog, 15, 0, rt, 0, 0, 0)) < 0 || emit_instruction(prog, 8, rt, rt, 0, 0, 0) < 0
+			|| add_fixup(prog, &label, index, RELOC_HI16, SECT_TEXT) || add_fixup(prog, &label, index + 1, RELOC_LO16, SECT_TEXT))
+			return token_error(lex, tok, "out of memory");
+		return 0;
+	}
+	if ((tok->length == 3 && strncmp(tok->start, "blt", 3) == 0) || (tok->length == 3 && strncmp(tok->start, "bgt", 3) == 0))
+	{
+		if (expect_reg(lex, &rs, 1) || expect_reg(lex, &rt, 1))
+			return 1;
+		if (tok->start[1] == 'g') //bgt a, b is blt b, a
+		{
+			value = rs;
+			rs = rt;
+			rt = value;
+		}
+		if (emit_instruction(prog, 0, rs, rt, REG_AT, 43, 0) < 0 || emit_instruction(prog, 8, REG_AT, REG_AT, 0, 0, -1) < 0
+			|| (index = emit_instruction(prog, 4, REG_AT, 0, 0, 0, 0)) < 0)
+			return token_error(lex, tok, "out of memory");
+		return reference_label(prog, lex, index);
+	}
+	return -1;
+}
+
+/*** emit_instruction
+*		This function appends one instruction with the given fields. Returns its index, or -1 if memory ran out.
+***/
+int emit_instruction(struct program *prog, int op, int rs, int rt, int rd, int funct, int offset)
+{
+	int index = add_instruction(prog);
+	if (index < 0)
+		return -1;
+	prog->inst[index].op = op;
+	prog->inst[index].r1 = rs;
+	prog->inst[index].r2 = rt;
+	prog->inst[index].r3 = rd;
+	prog->inst[index].funct = funct;
+	prog->inst[index].offset = offset;
+	return index;
+}
+
+/*** reference_label
+*		This function reads the label operand of the j or beq at index. A beq to a label that is already
+*		defined is patched in right away; every other reference is put on the backpatch list, since the
+*		absolute target of a j is only known once the linker has placed the file.
+***/
+int reference_label(struct program *prog, struct lexer *lex, int index)
+{
+	struct token tok;
+	struct symbol *sym = NULL;
+	next_token(lex, &tok);
+	if (tok.type != TOK_IDENT)
+		return token_error(lex, &tok, "expected a label");
+	if (prog->symbols.capacity > 0)
+		sym = symtab_lookup(&prog->symbols, tok.start, tok.length, hash_string(tok.start, tok.length));
+	if (prog->inst[index].op == 4 && sym != NULL && sym->name != NULL && sym->address >= 0 && sym->section == SECT_TEXT)
+	{
+		patch_instruction(&prog->inst[index], index, sym->address);
+		return 0;
+	}
+	if (add_fixup(prog, &tok, index, prog->inst[index].op == 2 ? RELOC_J : RELOC_BEQ, SECT_TEXT))
+		return token_error(lex, &tok, "out of memory");
+	return 0;
+}
+
+/*** add_fixup
+*		This function puts a reference to a label on the backpatch list. Returns 1 if memory ran out.
+*		The label is copied before the list grows, since it may point into the list itself.
+***/
+int add_fixup(struct program *prog, struct token *label, int index, int type, int section)
+{
+	struct token copy = *label;
+	struct fixup *grown;
+	if (prog->fixup_count == prog->fixup_capacity)
+	{
+		prog->fixup_capacity = prog->fixup_capacity ? prog->fixup_capacity * 2 : 256;
+		grown = (struct fixup*)realloc(prog->fixups, prog->fixup_capacity * sizeof(struct fixup));
+		if (grown == NULL)
+			return 1;
+		prog->fixups = grown;
+	}
+	prog->fixups[prog->fixup_count].index = index;
+	prog->fixups[prog->fixup_count].type = type;
+	prog->fixups[prog->fixup_count].section = section;
+	prog->fixups[prog->fixup_count].label = copy;
+	prog->fixup_count++;
+	return 0;
+}
+
+/*** backpatch
+*		This function resolves the forward beq references on the backpatch list once every label of the file
+*		is known. The fixups that are left (every j, la and .word and every beq to another file) stay on the
+*		list and become relocations.
+***/
+int backpatch(struct program *prog)
+{
+	struct symbol *sym = NULL;
+	struct fixup *fix;
+	int i, kept = 0;
+	for (i = 0; i < prog->fixup_count; i++)
+	{
+		fix = &prog->fixups[i];
+		if (prog->symbols.capacity > 0)
+			sym = symtab_lookup(&prog->symbols, fix->label.start, fix->label.length, hash_string(fix->label.start, fix->label.length));
+		if (fix->type == RELOC_BEQ && sym != NULL && sym->name != NULL && sym->address >= 0 && sym->section == SECT_TEXT)
+			patch_instruction(&prog->inst[fix->index], fix->index, sym->address);
+		else
+			prog->fixups[kept++] = *fix;
+	}
+	prog->fixup_count = kept;
+	return 0;
+}
+
+/*** patch_instruction
+*		This function fills in the branch offset of a beq at index from the offset of its label.
+***/
+void patch_instruction(struct instruction *inst, int index, int address)
+{
+	inst->offset = calculate_offset(4 * index, address);
+}
+
+/*** calculate_offset
+*		This function simply finds the difference in words between two memory addresses (used for branches).
+***/
+int calculate_offset(int start_address, int end_address)
+{
+	return (end_address - (start_address+0x4))/4;
+}
+
+/*** arena_strdup
+*		This function copies a string of the given length into the arena and terminates it.
+*		A new block is chained in front of the old ones when the current block is full.
+***/
+char* arena_strdup(struct arena **arena, const char *string, size_t length)
+{
+	struct arena *block = *arena;
+	char *copy;
+	if (block == NULL || block->used + length + 1 > block->size)
+	{
+		block = (struct arena*)malloc(sizeof(struct arena));
+		block->size = length + 1 > ARENA_BLOCK ? length + 1 : ARENA_BLOCK;
+		block->block = (char*)malloc(block->size);
+		block->used = 0;
+		block->prev = *arena;
+		*arena = block;
+	}
+	copy = block->block + block->used;
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+	block->used += length + 1;
+	return copy;
+}
+
+/*** arena_free
+*		This function releases every block of the arena.
+***/
+void arena_free(struct arena *arena)
+{
+	struct arena *prev;
+	while (arena != NULL)
+	{
+		prev = arena->prev;
+		free(arena->block);
+		free(arena);
+		arena = prev;
+	}
+}
+
+/*** hash_string
+*		This function computes the FNV-1a hash of a string of the given length.
+***/
+unsigned hash_string(const char *string, size_t length)
+{
+	unsigned hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)string[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*** symtab_lookup
+*		This function probes the symbol table for a name. Returns the slot holding the name,
+*		or the empty slot where it would be inserted.
+***/
+struct symbol* symtab_lookup(struct symtab *table, const char *name, size_t length, unsigned hash)
+{
+	unsigned mask = table->capacity - 1;
+	unsigned i = hash & mask;
+	struct symbol *sym;
+	for (;;)
+	{
+		sym = &table->slots[i];
+		if (sym->name == NULL)
+			return sym;
+		if (sym->hash == hash && strncmp(sym->name, name, length) == 0 && sym->name[length] == '\0')
+			return sym;
+		i = (i + 1) & mask;
+	}
+}
+
+/*** symtab_enter
+*		This function finds a name in the symbol table, or interns it and enters it as not yet defined.
+*		The table is doubled and rehashed when it becomes half full.
+***/
+struct symbol* symtab_enter(struct symtab *table, struct arena **arena, const char *name, size_t length)
+{
+	struct symbol *old, *sym;
+	unsigned hash = hash_string(name, length);
+	int i, capacity;
+	if (2 * (table->count + 1) > table->capacity)
+	{
+		old = table->slots;
+		capacity = table->capacity;
+		table->capacity = capacity ? capacity * 2 : 64;
+		table->slots = (struct symbol*)calloc(table->capacity, sizeof(struct symbol));
+		for (i = 0; i < capacity; i++)
+		{
+			if (old[i].name != NULL)
+				*symtab_lookup(table, old[i].name, strlen(old[i].name), old[i].hash) = old[i];
+		}
+		free(old);
+	}
+	sym = symtab_lookup(table, name, length, hash);
+	if (sym->name == NULL)
+	{
+		sym->name = arena_strdup(arena, name, length);
+		sym->hash = hash;
+		sym->address = -1;
+		sym->section = SECT_TEXT;
+		sym->global = 0;
+		table->count++;
+	}
+	return sym;
+}
+
+/*** define_label
+*		This function enters a label into the symbol table with its section and its offset in that section.
+*		Returns 1 if the label is already defined.
+***/
+int define_label(struct program *prog, const char *name, size_t length, int address, int section)
+{
+	struct symbol *sym = symtab_enter(&prog->symbols, &prog->strings, name, length);
+	if (sym->address >= 0)
+		return 1;
+	sym->address = address;
+	sym->section = section;
+	return 0;
+}
+
+/*** add_instruction
+*		This function reserves the next slot of the instruction array, doubling the array when it is full.
+*		Returns the index of the new slot, or -1 if memory ran out.
+***/
+int add_instruction(struct program *prog)
+{
+	struct instruction *grown;
+	if (prog->count == prog->capacity)
+	{
+		prog->capacity = prog->capacity ? prog->capacity * 2 : 1024;
+		grown = (struct instruction*)realloc(prog->inst, prog->capacity * sizeof(struct instruction));
+		if (grown == NULL)
+			return -1;
+		prog->inst = grown;
+	}
+	memset(&prog->inst[prog->count], 0, sizeof(struct instruction));
+	return prog->count++;
+}
+
+/*** add_data
+*		This function appends a value of 1 or 4 bytes to the data, doubling the data when it is full. Bytes are
+*		stored little-endian within each word, as the syscalls read them. Returns 1 if memory ran out.
+***/
+int add_data(struct program *prog, unsigned value, int bytes)
+{
+	unsigned *grown;
+	int i;
+	if (prog->data_size + bytes > 4 * prog->data_capacity)
+	{
+		prog->data_capacity = prog->data_capacity ? prog->data_capacity * 2 : 1024;
+		grown = (unsigned*)realloc(prog->data, prog->data_capacity * sizeof(unsigned));
+		if (grown == NULL)
+			return 1;
+		memset(grown + (prog->data_size + 3) / 4, 0, (prog->data_capacity - (prog->data_size + 3) / 4) * sizeof(unsigned));
+		prog->data = grown;
+	}
+	if (bytes == 4)
+		prog->data[prog->data_size / 4] = value;
+	else
+	{
+		for (i = 0; i < bytes; i++)
+			prog->data[(prog->data_size + i) / 4] |= ((value >> (8 * i)) & 0xFF) << (8 * ((prog->data_size + i) & 3));
+	}
+	prog->data_size += bytes;
+	return 0;
+}
+
+/*** free_program
+*		This function releases the instruction array, the data, the symbol table and the arena.
+***/
+void free_program(struct program *prog)
+{
+	free(prog->inst);
+	free(prog->data);
+	free(prog->fixups);
+	free(prog->symbols.slots);
+	arena_free(prog->strings);
+}
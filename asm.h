@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fnv.h"
+
+#ifndef ASM
+
+#define BUFFER_SIZE 256
+#define ARENA_BLOCK 65536
+#define TEXT_BASE 0x4000
+#define DATA_BASE 0xC000
+#define MEM_LIMIT 0x10000
+#define REG_AT 1
+
+/***
+*		Token types produced by the lexer.
+***/
+#define TOK_EOF 0
+#define TOK_NEWLINE 1
+#define TOK_IDENT 2
+#define TOK_LABEL 3
+#define TOK_REG 4
+#define TOK_NUMBER 5
+#define TOK_COMMA 6
+#define TOK_LPAREN 7
+#define TOK_RPAREN 8
+#define TOK_ERROR 9
+
+/***
+*		Relocation types: the 26-bit target of a j, the 16-bit word offset of a beq, the upper and lower
+*		halves of an address loaded by la (lui + addi, the upper half rounded for the sign of the lower)
+*		and a whole address stored by .word.
+***/
+#define RELOC_J 0
+#define RELOC_BEQ 1
+#define RELOC_HI16 2
+#define RELOC_LO16 3
+#define RELOC_WORD 4
+
+/***
+*		Sections: the text starts at TEXT_BASE and the data at DATA_BASE, the initial $gp.
+***/
+#define SECT_TEXT 0
+#define SECT_DATA 1
+
+/***
+*		Symbol kinds in an object file.
+***/
+#define SYM_LOCAL 0
+#define SYM_GLOBAL 1
+#define SYM_EXTERN 2
+
+/***
+*		The rules of the optimizer. The first two rewrite operands and branches, the others remove instructions.
+***/
+#define OPT_COPY 0
+#define OPT_THREAD 1
+#define OPT_SELF 2
+#define OPT_NEXT 3
+#define OPT_REDUNDANT 4
+#define OPT_DEAD 5
+#define OPT_UNREACHABLE 6
+#define OPT_RULES 7
+
+/***
+*		This struct is used to store all the necessary data for an instruction. Instructions are
+*		stored in one contiguous array, so an instruction's address follows from its index.
+***/
+struct instruction
+{
+	int op;
+	int r1;
+	int r2;
+	int r3;
+	int funct;
+	int offset;
+	int jsec;
+};
+
+/***
+*		A token is a view into the mapped input file: it points at its first character and is never
+*		copied or terminated. The line and column are kept for error messages.
+***/
+struct token
+{
+	int type;
+	const char *start;
+	int length;
+	int line;
+	int column;
+	long value;
+};
+
+/***
+*		The lexer walks the mapped input file once, from cur to end.
+***/
+struct lexer
+{
+	const char *cur;
+	const char *end;
+	const char *line_start;
+	int line;
+	const char *name;
+};
+
+/***
+*		A fixup remembers a reference to a label: a j, a beq whose label was not defined yet, the two
+*		halves of an la, or a .word. index is the word in the fixup's section. Fixups that cannot be
+*		backpatched within the file become relocations of the object.
+***/
+struct fixup
+{
+	int index;
+	int type;
+	int section;
+	struct token label;
+};
+
+/***
+*		The arena hands out memory for the interned label strings. It grows by chaining blocks,
+*		so strings never move and everything is released at once.
+***/
+struct arena
+{
+	char *block;
+	size_t used;
+	size_t size;
+	struct arena *prev;
+};
+
+/***
+*		A symbol maps an interned label name to its offset in its section of the file. The symbol table is an
+*		open-addressing hash table that doubles when it is half full. address is -1 while a .globl
+*		name has not been defined.
+***/
+struct symbol
+{
+	const char *name;
+	unsigned hash;
+	int address;
+	int section;
+	int global;
+};
+
+struct symtab
+{
+	struct symbol *slots;
+	int count;
+	int capacity;
+};
+
+/***
+*		The program being assembled: the instruction array, the data words, the backpatch list, the symbol
+*		table and the arena. data_size counts bytes; section is the section being assembled into.
+***/
+struct program
+{
+	struct instruction *inst;
+	int count;
+	int capacity;
+	unsigned *data;
+	int data_size;
+	int data_capacity;
+	int section;
+	struct fixup *fixups;
+	int fixup_count;
+	int fixup_capacity;
+	struct symtab symbols;
+	struct arena *strings;
+};
+
+/***
+*		A relocatable object: the encoded text and the data of one source file, its symbols and the
+*		places that need a symbol's final address.
+***/
+struct objsymbol
+{
+	const char *name;
+	int offset;
+	int kind;
+	int section;
+};
+
+struct reloc
+{
+	int index;
+	int type;
+	int section;
+	int line;
+	const char *name;
+};
+
+struct object
+{
+	const char *name;
+	unsigned *text;
+	int text_count;
+	unsigned *data;
+	int data_count;
+	struct objsymbol *symbols;
+	int symbol_count;
+	struct reloc *relocs;
+	int reloc_count;
+	struct arena *strings;
+};
+
+/***
+*		A linked program: the text placed at TEXT_BASE and the data placed at DATA_BASE.
+***/
+struct image
+{
+	unsigned *text;
+	int text_count;
+	unsigned *data;
+	int data_count;
+};
+
+/***
+*		How often every rule of the optimizer fired.
+***/
+struct opt_stats
+{
+	int count[OPT_RULES];
+};
+
+/***
+*		asm.c: lexing, parsing and encoding one source file.
+***/
+int assemble(struct program *prog, struct lexer *lex);
+int assemble_file(const char *path, struct object *obj);
+int assemble_buffer(const char *text, size_t size, const char *name, struct opt_stats *stats, struct object *obj);
+char* map_file(const char *path, size_t *size);
+void unmap_file(char *text, size_t size);
+void make_object(struct program *prog, const char *name, struct object *obj);
+unsigned encode_instruction(struct instruction *inst);
+void next_token(struct lexer *lex, struct token *tok);
+int token_error(struct lexer *lex, struct token *tok, const char *message);
+void set_op_funct(int *op, int *funct, struct token *tok);
+int get_reg(struct token *tok);
+int expect_reg(struct lexer *lex, int *reg, int comma);
+int expect_number(struct lexer *lex, int *value, int comma);
+int expect_mem_operand(struct lexer *lex, int *mem_offset, int *mem_reg);
+int expect_globl(struct program *prog, struct lexer *lex);
+int expect_directive(struct program *prog, struct lexer *lex, struct token *tok);
+int expand_pseudo(struct program *prog, struct lexer *lex, struct token *tok);
+int emit_instruction(struct program *prog, int op, int rs, int rt, int rd, int funct, int offset);
+int reference_label(struct program *prog, struct lexer *lex, int index);
+int add_fixup(struct program *prog, struct token *label, int index, int type, int section);
+int backpatch(struct program *prog);
+void patch_instruction(struct instruction *inst, int index, int address);
+int calculate_offset(int start_address, int end_address);
+char* arena_strdup(struct arena **arena, const char *string, size_t length);
+void arena_free(struct arena *arena);
+unsigned hash_string(const char *string, size_t length);
+struct symbol* symtab_lookup(struct symtab *table, const char *name, size_t length, unsigned hash);
+struct symbol* symtab_enter(struct symtab *table, struct arena **arena, const char *name, size_t length);
+int define_label(struct program *prog, const char *name, size_t length, int address, int section);
+int add_instruction(struct program *prog);
+int add_data(struct program *prog, unsigned value, int bytes);
+void free_program(struct program *prog);
+
+/***
+*		object.c: object files and the linker.
+***/
+int write_object(struct object *obj, FILE *output);
+int read_object(struct object *obj, FILE *input, const char *name);
+int link_objects(struct object *objs, int count, struct image *image);
+void free_object(struct object *obj);
+
+/***
+*		optimize.c: the peephole optimizer.
+***/
+int optimize_program(struct program *prog, struct opt_stats *stats);
+void print_opt_stats(struct opt_stats *stats, FILE *output);
+
+/***
+*		cache.c: the content-addressed cache of objects and linked images.
+***/
+unsigned long long source_key(const char *text, size_t size);
+FILE* cache_fetch(const char *dir, unsigned long long key, const char *ext);
+FILE* cache_begin(const char *dir, unsigned long long key, const char *ext, char *temp);
+int cache_commit(FILE *file, const char *temp, const char *dir, unsigned long long key, const char *ext);
+
+#define ASM
+#endif
@@ -0,0 +1,264 @@
+# thread_jumps adds a fixup for the beq to top while the list is full: -O must not read the label
+# from the list it just grew
+.data
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+	.word done
+.text
+top:	j mid
+mid:	addi $t0, $t0, 1
+	beq $t0, $0, top
+done:	addi $v0, $0, 10
+	syscall
@@ -1,462 +1,371 @@
 /*
  * assembler.c - A basic MIPS assembler with limited functionality written in C.
+ * Assembles one or more source files into relocatable objects (in parallel), and links
+ * the objects into one .asc image. Objects and images are kept in a content-addressed cache.
  * authors: Josiah Nethery
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "asm.h"
 
-#define BUFFER_SIZE 256
+#define STAGE_HASH 0
+#define STAGE_BUILD 1
 
 /***
-*		This struct is used to store all the necessary data for an instruction. The *next pointer
-*		is used because the instructions are stored in a linked-list abstract data type
+*		One input of a multi-file build: a source file or an object file. The input is mapped while it
+*		is hashed and stays mapped until it has been built.
 ***/
-struct instruction
+struct unit
 {
-	int op;
-	int r1;
-	int r2;
-	int r3;
-	int funct;
-	int offset;
-	int jsec;
-	char label[BUFFER_SIZE];
-	int address;
-	struct instruction *next;
+	const char *input;
+	char object_path[BUFFER_SIZE];
+	int is_source;
+	int error;
+	char *text;
+	size_t size;
+	unsigned long long key;
+	int assembled;
+	struct opt_stats stats;
+	struct object obj;
 };
 
 /***
-*		These register names are basically copied and pasted from spimcore and are used 
-*		when turning register names such as $v0 or $2 into ints.
+*		The shared work list of the assembling threads. cache is NULL when caching is off.
 ***/
-const char RegName[36][6] = {
-	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
-	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", 
-	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", 
-	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
-	"pc", "stat", "lo", "hi" };
+struct worklist
+{
+	struct unit *units;
+	int count;
+	int next;
+	int stage;
+	int write_objects;
+	int optimize;
+	const char *cache;
+	pthread_mutex_t lock;
+};
 
 /***
 *		Functions prototypes
 ***/
-void print_output(struct instruction *inst, FILE *output);
-struct instruction* set_label_addresses(struct instruction *inst, FILE *input);
-struct instruction* process_file(struct instruction *inst, FILE *input);
-void set_op_funct(int *op, int *funct, char *string);
-int get_reg(char *string);
-void strip_reg_string(char *string, char *stripped, int trim_radius);
-void get_mem_offset_and_word_reg(char *string, int *mem_offset, int *mem_reg);
-int check_for_label(char* string);
-int find_label_address(struct instruction *inst, char label[BUFFER_SIZE]);
-int calculate_offset(int start_address, int end_address);
-struct instruction* add_ll_node(struct instruction *inst, char label[BUFFER_SIZE]);
-struct instruction* modify_ll_node(struct instruction *inst, int address, int op, int r1, int r2, int r3, int funct, int offset, int jsec);
+void print_output(struct image *image, FILE *output);
+int usage(char *name);
+int hash_unit(struct unit *unit, int optimize);
+int build_unit(struct unit *unit, struct worklist *work);
+void run_stage(struct worklist *work, int stage, int jobs);
+void* assemble_worker(void *arg);
+int copy_output(FILE *input, const char *out);
+int write_output(struct image *image, const char *out);
 
 /*** main
-*
+*		With an input and an output file, the input is assembled and linked on its own, as before.
+*		Otherwise every input is hashed, and the linked image is taken from the cache if the same set of
+*		inputs was linked before. If not, the sources are assembled into objects on -j threads, each one
+*		taken from the cache when its text was assembled before (-c stops there and writes the objects),
+*		and every object is linked into the -o output.
 ***/
 int main(int argc, char **argv)
 {
-	FILE *input;
-	FILE *output;
-	struct instruction *inst = NULL; //initializing the instruction list
-	if(argc == 1) //if argc is 1, that means that only the executable name is specified and there's no input or output files 
+	FILE *file;
+	struct unit *units;
+	struct object *objs;
+	struct worklist work;
+	struct image image;
+	struct opt_stats stats;
+	unsigned long long link_key;
+	char *out = NULL, temp[BUFFER_SIZE];
+	int i, j, count = 0, size, error = 0, compile_only = 0, legacy = 0, optimize = 0, assembled = 0;
+	int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	const char *cache = ".asmcache";
+	if(argc == 1) //if argc is 1, that means that only the executable name is specified and there's no input or output files
 	{
 		printf("Error: No file specified\n");
+		return 1;
 	}
-	else if(argc == 2) //if argc is 2, that means that only the executable name and input file are specified 
+	else if(argc == 2 && argv[1][0] != '-') //if argc is 2, that means that only the executable name and input file are specified
 	{
 		printf("Error: no output file specified\n");
+		return 1;
 	}
-	else if (argc == 3) //if argc is 3, we're good to go
-	{
-		input = fopen(argv[1], "r"); //open the input file for reading
-		output = fopen(argv[2], "w"); //open the output file for writing 
-		inst = set_label_addresses(inst, input); //cycle through the input file and look for labels and note their memory addresses. 
-		fclose(input); //close the input file and re-open it to go through the main processing loop
-		input = fopen(argv[1], "r");
-		inst = process_file(inst, input); 
-		print_output(inst, output); //write to the ouput file
-		fclose(input);
-		fclose(output);
-	}
-	else //if argc is over 3, then there are too many arguments
+	units = (struct unit*)calloc(argc, sizeof(struct unit));
+	if (argc == 3 && argv[1][0] != '-' && argv[2][0] != '-') //assembler input.asm output.asc
 	{
-		printf("Error: Too many arguments passed to assembler\n");
+		units[count++].input = argv[1];
+		out = argv[2];
+		legacy = 1;
+		cache = NULL;
 	}
-	return 0;
-}
-
-/*** print_output
-*		print_output takes in the instruction linked list and the output file as arguments.
-*		the instruction list is cycled through and the code in hex is output to the destination file.
-***/ 
-void print_output(struct instruction *inst, FILE *output)
-{
-	while (inst != NULL)
+	for (i = 1; i < argc && !legacy; i++)
 	{
-		int code = 0x0;
-		code += inst->op << 26;
-		code += inst->r1 << 21;
-		code += inst->r2 << 16;
-		code += inst->r3 << 11;
-		code += inst->funct & 0x3F;
-		code += inst->offset & 0xFFFF;
-		code += (inst->jsec >> 2) & 0x3FFFFFF;
-		fprintf(output, "%08x\n", code);
-		inst = inst->next;
-	}
-}
-
-/*** set_label_addresses
-*		This function is used to initially cycle through the input file looking for labels. This is necessary,
-*		because if, for example, you come across a beq instruction that references a label that hasn't been 
-*		declared yet, the compilation will fail. 
-***/ 
-struct instruction* set_label_addresses(struct instruction *inst, FILE *input)
-{
-	char string[BUFFER_SIZE];
-	char label[BUFFER_SIZE];
-	char* c;
-	while(fscanf(input, "%s", string) != EOF)
-	{
-		if (check_for_label(string) == 1)
-			strcpy(label, string);
+		if (strcmp(argv[i], "-c") == 0)
+			compile_only = 1;
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			out = argv[++i];
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+			cache = argv[++i];
+		else if (strcmp(argv[i], "-nocache") == 0)
+			cache = NULL;
+		else if (strcmp(argv[i], "-O") == 0)
+			optimize = 1;
+		else if (argv[i][0] == '-')
+			return usage(argv[0]);
 		else
-			strcpy(label, "");
-		inst = add_ll_node(inst, label);
-		c = fgets(string, BUFFER_SIZE, input);
+			units[count++].input = argv[i];
 	}
-	return inst;
-}
-
-/*** process_file
-*		This function is the main input file processing loop. It takes the instruction string in ASM and turns it into 
-*		machine code. First, the op-code and corresponding funct are determined and then the register names are read in and processed.
-*		The offset and jsec values are determined using other functions. 
-***/ 
-struct instruction* process_file(struct instruction *inst, FILE *input)
-{
-	char string[BUFFER_SIZE];
-	//note that the current instruction address is tracked. this is for use with branching and jumps.
-	int op, r1, r2, r3, funct, offset, jsec, address=0x4000; 
-	while(fscanf(input, "%s", string) != EOF)
+	if (count == 0 || jobs < 1 || (!compile_only && out == NULL))
+		return usage(argv[0]);
+	for (i = 0; i < count; i++)
 	{
-		if (check_for_label(string) == 1)
-		{
-			fscanf(input, "%s", string);
-		}
-		set_op_funct(&op, &funct, string);
-		if (op == 0) //add, sub, and, or, slt, sltu
-		{
-			fscanf(input, "%s", string);
-			r3 = get_reg(string);
-			fscanf(input, "%s", string);
-			r1 = get_reg(string);
-			fscanf(input, "%s", string);
-			r2 = get_reg(string);
-			offset = 0;
-			jsec = 0;
-		}
-		else if (op == 2) //j
+		size = strlen(units[i].input);
+		units[i].is_source = !(size > 2 && strcmp(units[i].input + size - 2, ".o") == 0);
+		if (units[i].is_source && size + 3 < BUFFER_SIZE)
 		{
-			r1 = 0;
-			r2 = 0;
-			r3 = 0;
-			offset = 0;
-			fscanf(input, "%s", string);
-			jsec = find_label_address(inst, strcat(string,":"));
+			strcpy(units[i].object_path, units[i].input);
+			if (size > 4 && strcmp(units[i].object_path + size - 4, ".asm") == 0)
+				units[i].object_path[size - 4] = '\0';
+			strcat(units[i].object_path, ".o");
 		}
-		else if (op == 4) //beq
-		{
-			fscanf(input, "%s", string);
-			r1 = get_reg(string);
-			fscanf(input, "%s", string);
-			r2 = get_reg(string);
-			r3 = 0;
-			fscanf(input, "%s", string);
-			offset = calculate_offset(address, find_label_address(inst, strcat(string,":")));
-			jsec = 0;
-		}
-		else if (op == 8) //addi
-		{
-			fscanf(input, "%s", string);
-			r1 = get_reg(string);
-			fscanf(input, "%s", string);
-			r2 = get_reg(string);
-			r3 = 0;
-			fscanf(input, "%d", &offset);
-			jsec = 0;		
-		}
-		else if (op == 10 || op == 11) //slti, sltiu
-		{
-			fscanf(input, "%s", string);
-			r2 = get_reg(string);
-			fscanf(input, "%s", string);
-			r1 = get_reg(string);
-			r3 = 0;
-			fscanf(input, "%d", &offset);
-			jsec = 0;	
-		}
-		else if (op == 15) //lui
-		{
-			fscanf(input, "%s", string);
-			r1 = 0;
-			r2 = get_reg(string);
-			r3 = 0;
-			fscanf(input, "%d", &offset);
-			jsec = 0;
-		}
-		else if (op == 35 || op == 43) //lw, sw
-		{
-			fscanf(input, "%s", string);
-			r2 = get_reg(string);
-			fscanf(input, "%s", string);
-			int offset, reg;
-			get_mem_offset_and_word_reg(string, &offset, &reg);
-			r1 = reg;
-			r3 = 0;
-			offset = offset;
-			jsec = 0;
-		}
-		inst = modify_ll_node(inst, address, op, r1, r2, r3, funct, offset, jsec);
-		address += 0x4; //the current address is incremented by 4 after every instruction is processed 
 	}
-	return inst;
-}
+	work.units = units;
+	work.count = count;
+	work.write_objects = compile_only;
+	work.optimize = optimize;
+	work.cache = cache;
+	pthread_mutex_init(&work.lock, NULL);
+	jobs = jobs < count ? jobs : count;
 
-/*** set_op_funct
-*		This function sets the op-code and corresponding funct code for the instruction read in.
-***/
-void set_op_funct(int *op, int *funct, char *string)
-{
-	int error = -100;
-	if (strcmp(string, "add") == 0)
-	{
-		*op = 0;
-		*funct = 32;
-	}
-	else if (strcmp(string, "sub") == 0)
-	{
-		*op = 0;
-		*funct = 34;
-	}
-	else if (strcmp(string, "and") == 0)
-	{
-		*op = 0;
-		*funct = 36;
-	}
-	else if (strcmp(string, "or") == 0)
-	{
-		*op = 0;
-		*funct = 37;
-	}
-	else if (strcmp(string, "slt") == 0)
-	{
-		*op = 0;
-		*funct = 42;
-	}
-	else if (strcmp(string, "sltu") == 0)
-	{
-		*op = 0;
-		*funct = 43;
-	}
-	else if (strcmp(string, "j") == 0)
-	{
-		*op = 2;
-		*funct = 0;
-	}
-	else if (strcmp(string, "beq") == 0)
-	{
-		*op = 4;
-		*funct = 0;
-	}
-	else if (strcmp(string, "addi") == 0)
+	//hash every input; the linked image is keyed by the keys of all inputs, in order
+	run_stage(&work, STAGE_HASH, jobs);
+	link_key = 0;
+	for (i = 0; i < count; i++)
 	{
-		*op = 8;
-		*funct = 0;
+		error |= units[i].error;
+		link_key = hash_bytes(&units[i].key, sizeof(units[i].key), link_key);
 	}
-	else if (strcmp(string, "slti") == 0)
+	if (!error && !compile_only && cache != NULL && (file = cache_fetch(cache, link_key, ".asc")) != NULL)
 	{
-		*op = 10;
-		*funct = 0;
+		error = copy_output(file, out); //nothing changed since this image was linked
+		fclose(file);
+		compile_only = 1;
 	}
-	else if (strcmp(string, "sltiu") == 0)
+	else if (!error)
 	{
-		*op = 11;
-		*funct = 0;
+		run_stage(&work, STAGE_BUILD, jobs);
+		for (i = 0; i < count; i++)
+			error |= units[i].error;
 	}
-	else if (strcmp(string, "lui") == 0)
+	pthread_mutex_destroy(&work.lock);
+	if (!error && optimize)
 	{
-		*op = 15;
-		*funct = 0;
+		memset(&stats, 0, sizeof(stats));
+		for (i = 0; i < count; i++)
+		{
+			assembled += units[i].assembled;
+			for (j = 0; j < OPT_RULES; j++)
+				stats.count[j] += units[i].stats.count[j];
+		}
+		print_opt_stats(&stats, stdout);
+		if (assembled < count)
+			printf("(%d of %d inputs were not assembled and are not counted)\n", count - assembled, count);
 	}
-	else if (strcmp(string, "lw") == 0)
+
+	if (!error && !compile_only)
 	{
-		*op = 35;
-		*funct = 0;
+		objs = (struct object*)malloc(count * sizeof(struct object));
+		for (i = 0; i < count; i++)
+			objs[i] = units[i].obj;
+		error = link_objects(objs, count, &image);
+		if (!error)
+		{
+			error = write_output(&image, out);
+			if (!error && cache != NULL && (file = cache_begin(cache, link_key, ".asc", temp)) != NULL)
+			{
+				print_output(&image, file);
+				cache_commit(file, temp, cache, link_key, ".asc");
+			}
+			free(image.text);
+			free(image.data);
+		}
+		free(objs);
 	}
-	else if (strcmp(string, "sw") == 0)
+	for (i = 0; i < count; i++)
 	{
-		*op = 43;
-		*funct = 0;
+		if (units[i].text != NULL)
+			unmap_file(units[i].text, units[i].size);
+		free_object(&units[i].obj);
 	}
-	else
-		*op = error; //this is in the event of attempting to execute an instruction that isn't implemented. 
+	free(units);
+	return error;
 }
 
-/*** get_reg
-*		This function is used for turning plain-text register names into int values.
+/*** usage
+*		Prints the command line syntax. Always returns 1.
 ***/
-int get_reg(char *string)
+int usage(char *name)
 {
-	int error = -100;
-	int trim_radius;
-	//the trim_radius us set by seeing if the register name string ends in a comma.
-	//if it does, we know to trim off two characters (the first and last, not including the terminator).
-	//otherwise, we just trim off the first (the $ sign).
-	if (string[strlen(string)-1] == ',')
-		trim_radius = 2;
-	else
-		trim_radius = 1;
-	char stripped[strlen(string)-trim_radius];
-	strip_reg_string(string, stripped, trim_radius);
-		
-	int i;
-	char i_string[BUFFER_SIZE];
-	for (i = 0; i < 36; i++)
-	{
-		itoa(i, i_string, 10); //turn the value of i into a string so that it can be compared with the plain-text register name, such as $8
-		if (strcmp(stripped, i_string) == 0 || strcmp(stripped, RegName[i]) == 0)
-			return i; //returns the int value of the register 
-	}
-	return error; //in the event that an invalid register number is reference, an error code is returned 
+	printf("syntax: %s input.asm output.asc\n", name);
+	printf("        %s [-O] [-j threads] [-cache dir | -nocache] -o output.asc input.asm|input.o ...\n", name);
+	printf("        %s [-O] [-j threads] [-cache dir | -nocache] -c input.asm ...\n", name);
+	return 1;
 }
 
-/*** strip_reg_string
-*		This function is used to trim the plain-text register string, based on the trim_radius calcluated
-*		in get_reg.
+/*** print_output
+*		print_output takes in the linked image and the output file as arguments.
+*		the words of the image are cycled through and the code in hex is output to the destination file.
+*		The data follows an @address line that tells the loader where it goes.
 ***/
-void strip_reg_string(char *string, char *stripped, int trim_radius)
+void print_output(struct image *image, FILE *output)
 {
 	int i;
-	for (i = 0; i < strlen(string) - trim_radius; i++)
-	{
-		stripped[i] = string[i+1];
-	}
-	stripped[i] = '\0'; //the terminator is added back to the end of the string to make it a valid string
+	for (i = 0; i < image->text_count; i++)
+		fprintf(output, "%08x\n", image->text[i]);
+	if (image->data_count > 0)
+		fprintf(output, "@%08x\n", DATA_BASE);
+	for (i = 0; i < image->data_count; i++)
+		fprintf(output, "%08x\n", image->data[i]);
 }
 
-/*** get_mem_offset_and_word_reg
-*		This function is used to turn strings such as 100($29) into an offset int and a register int
+/*** write_output
+*		Writes the linked image to the output file. Returns 1 if it cannot be written.
 ***/
-void get_mem_offset_and_word_reg(char *string, int *mem_offset, int *mem_reg)
+int write_output(struct image *image, const char *out)
 {
-	char offset[BUFFER_SIZE];
-	char reg[BUFFER_SIZE];
-	int i = 0, j = 0;
-	while(string[i] != '(')
+	FILE *output = fopen(out, "w"); //open the output file for writing
+	if (output == NULL)
 	{
-		offset[i] = string[i];
-		i++;
-	}
-	i++; //i is incremented again here to skip over the '(' character
-	itoa(*mem_offset, offset, 10); //turns the string offset into an integer in base 10
-	while(string[i] != ')')
-	{
-		reg[j] = string[i];
-		i++;
-		j++;
+		printf("Error: cannot open output file %s\n", out);
+		return 1;
 	}
-	*mem_reg = get_reg(reg); //calls get_reg to turn the register value, such as $29 into an int
+	print_output(image, output); //write to the ouput file
+	fclose(output);
+	return 0;
 }
 
-/*** check_for_label
-*		This function checks the last character in the string (not the terminator) to see if it's ':'
-*		If it is, we know that this string is supposed to be a label. Returns 1 if it's a label, and 0 otherwise.
+/*** copy_output
+*		Copies a cached image to the output file. Returns 1 if it cannot be written.
 ***/
-int check_for_label(char* string)
+int copy_output(FILE *input, const char *out)
 {
-	if(string[strlen(string)-1] == ':')
+	char buffer[BUFSIZ];
+	size_t n;
+	FILE *output = fopen(out, "w");
+	if (output == NULL)
+	{
+		printf("Error: cannot open output file %s\n", out);
 		return 1;
+	}
+	while ((n = fread(buffer, 1, sizeof(buffer), input)) > 0)
+		fwrite(buffer, 1, n, output);
+	fclose(output);
 	return 0;
 }
 
-/*** find_label_address
-*		This function takes in a label and searches the instruction list for an instruction with that label.
-*		Returns the memory address of that function.
+/*** run_stage
+*		Runs one stage over every unit on a pool of threads.
 ***/
-int find_label_address(struct instruction *inst, char label[BUFFER_SIZE])
+void run_stage(struct worklist *work, int stage, int jobs)
 {
-	struct instruction *helper;
-	helper = inst;
-	while(strcmp(helper->label, label) != 0)
-	{
-		helper = helper->next;
-	}
-	return helper->address;
+	pthread_t *threads = (pthread_t*)malloc(jobs * sizeof(pthread_t));
+	int i;
+	work->stage = stage;
+	work->next = 0;
+	for (i = 0; i < jobs; i++)
+		pthread_create(&threads[i], NULL, assemble_worker, work);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
 }
 
-/*** calculate_offset
-*		This function simply finds the difference in words between two memory addresses (used for branches).
+/*** assemble_worker
+*		Thread body: takes units off the shared work list until it is empty.
 ***/
-int calculate_offset(int start_address, int end_address)
+void* assemble_worker(void *arg)
 {
-	return (end_address - (start_address+0x4))/4;
+	struct worklist *work = (struct worklist*)arg;
+	struct unit *unit;
+	int i;
+	for (;;)
+	{
+		pthread_mutex_lock(&work->lock);
+		i = work->next < work->count ? work->next++ : -1;
+		pthread_mutex_unlock(&work->lock);
+		if (i < 0)
+			return NULL;
+		unit = &work->units[i];
+		if (work->stage == STAGE_HASH)
+			unit->error = hash_unit(unit, work->optimize);
+		else
+			unit->error = build_unit(unit, work);
+	}
 }
 
-/*** modify_ll_node
-*		This function changes the values of an instruction at a specified memory address. 
-*		This function is used during the main processing cycle, after the linked list has already been created.
+/*** hash_unit
+*		Maps the input and computes its key from its content and whether it is optimized.
 ***/
-struct instruction* modify_ll_node(struct instruction *inst, int address, int op, int r1, int r2, int r3, int funct, int offset, int jsec)
+int hash_unit(struct unit *unit, int optimize)
 {
-	struct instruction *helper;
-	helper = inst;
-	while(helper->address != address)
-	{
-		helper = helper->next;
-	}
-	helper->op = op;
-	helper->r1 = r1;
-	helper->r2 = r2;
-	helper->r3 = r3;
-	helper->funct = funct;
-	helper->offset = offset;
-	helper->jsec = jsec;
-	
-	return inst;
+	unit->text = map_file(unit->input, &unit->size);
+	if (unit->text == NULL)
+		return 1;
+	unit->key = source_key(unit->text, unit->size);
+	if (optimize && unit->is_source)
+		unit->key = hash_bytes("-O", 2, unit->key);
+	return 0;
 }
 
-/*** add_ll_node
-*		This function creates and adds a new node to the instruction list with a label and 
-*		a memory address. Note that during creation of nodes, the address variable is incremented 
-*		by 4 every time we jump to the next node in the list. 
+/*** build_unit
+*		Produces the object of one unit. An object file is read as is. A source file is read from the cache
+*		if the same text was assembled before, and otherwise assembled and stored in the cache. With -c, the
+*		object is also written next to the source.
 ***/
-struct instruction* add_ll_node(struct instruction *inst, char label[BUFFER_SIZE])
+int build_unit(struct unit *unit, struct worklist *work)
 {
-	struct instruction *new_inst = (struct instruction*)malloc(sizeof(struct instruction));
-	strcpy(new_inst->label, label);
-	new_inst->next = NULL;
-	if(inst == NULL)
+	FILE *file;
+	char temp[BUFFER_SIZE];
+	int error = 1;
+	if (!unit->is_source)
+	{
+		file = fopen(unit->input, "r");
+		if (file == NULL)
+		{
+			printf("Error: cannot open object file %s\n", unit->input);
+			return 1;
+		}
+		error = read_object(&unit->obj, file, unit->input);
+		fclose(file);
+		return error;
+	}
+	if (work->cache != NULL && (file = cache_fetch(work->cache, unit->key, ".o")) != NULL)
 	{
-		new_inst->address = 0x4000;
-		inst = new_inst;
+		error = read_object(&unit->obj, file, unit->input);
+		fclose(file);
+		if (error)
+			free_object(&unit->obj); //a damaged entry is simply rebuilt and replaced
 	}
-	else
+	if (error)
 	{
-		int addr = 0x4004;
-		struct instruction *helper;
-		helper = inst;
-		while(helper->next != NULL)
+		if (assemble_buffer(unit->text, unit->size, unit->input, work->optimize ? &unit->stats : NULL, &unit->obj))
+			return 1;
+		unit->assembled = 1;
+		if (work->cache != NULL && (file = cache_begin(work->cache, unit->key, ".o", temp)) != NULL)
 		{
-			helper = helper->next;
-			addr += 0x4;
+			write_object(&unit->obj, file);
+			cache_commit(file, temp, work->cache, unit->key, ".o");
 		}
-		new_inst->address = addr;
-		helper->next = new_inst;
 	}
-	return inst;
-}
\ No newline at end of file
+	if (work->write_objects)
+	{
+		file = fopen(unit->object_path, "w");
+		if (file == NULL || write_object(&unit->obj, file))
+		{
+			printf("Error: cannot write object file %s\n", unit->object_path);
+			if (file != NULL)
+				fclose(file);
+			return 1;
+		}
+		fclose(file);
+	}
+	return 0;
+}
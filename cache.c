@@ -0,0 +1,78 @@
+/*
+ * cache.c - The content-addressed build cache of the MIPS assembler.
+ * Every entry is a file named after a 64-bit hash of the content it was built from: objects are
+ * keyed by the source text, linked images by the keys of all their objects. Entries are written
+ * to a temporary file and renamed into place, so parallel builds never see a partial entry.
+ * authors: Josiah Nethery
+ */
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include "asm.h"
+
+/* bump whenever the encoding or the object format changes, so stale entries are never hit */
+#define CACHE_VERSION "spimasm-2"
+
+static void cache_path(char *path, const char *dir, unsigned long long key, const char *ext)
+{
+	snprintf(path, BUFFER_SIZE, "%s/%016llx%s", dir, key, ext);
+}
+
+/*** source_key
+*		This function returns the cache key of a source file: the hash of its text, salted with the
+*		cache version. The assembler has no includes or macros, so the text is the whole input.
+***/
+unsigned long long source_key(const char *text, size_t size)
+{
+	return hash_bytes(text, size, hash_bytes(CACHE_VERSION, strlen(CACHE_VERSION), 0));
+}
+
+/*** cache_fetch
+*		This function opens the entry with the given key for reading. Returns NULL on a miss.
+***/
+FILE* cache_fetch(const char *dir, unsigned long long key, const char *ext)
+{
+	char path[BUFFER_SIZE];
+	cache_path(path, dir, key, ext);
+	return fopen(path, "r");
+}
+
+/*** cache_begin
+*		This function creates the cache directory if needed and opens a temporary file for a new entry.
+*		The name of the temporary file is stored in temp (BUFFER_SIZE bytes). Returns NULL on failure.
+***/
+FILE* cache_begin(const char *dir, unsigned long long key, const char *ext, char *temp)
+{
+	FILE *file;
+	int fd;
+	mkdir(dir, 0777);
+	snprintf(temp, BUFFER_SIZE, "%s/%016llx%s.XXXXXX", dir, key, ext);
+	fd = mkstemp(temp);
+	if (fd < 0)
+		return NULL;
+	file = fdopen(fd, "w");
+	if (file == NULL)
+	{
+		close(fd);
+		unlink(temp);
+	}
+	return file;
+}
+
+/*** cache_commit
+*		This function closes a file opened by cache_begin and renames it into place. If anything was
+*		not written, the temporary file is removed instead. Returns 1 if the entry was not stored.
+***/
+int cache_commit(FILE *file, const char *temp, const char *dir, unsigned long long key, const char *ext)
+{
+	char path[BUFFER_SIZE];
+	int error = ferror(file);
+	error |= fclose(file);
+	cache_path(path, dir, key, ext);
+	if (error || rename(temp, path) < 0)
+	{
+		unlink(temp);
+		return 1;
+	}
+	return 0;
+}
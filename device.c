@@ -0,0 +1,373 @@
+/*
+ * device.c - Memory-mapped device bus: a UART console, a timer, a DMA engine and a block device on a
+ * host file. The host side of the UART and the block device runs on a worker thread fed through a
+ * single-producer single-consumer ring, so a guest store to a device register only queues the work
+ * and never waits for a host syscall. The guest polls the status registers to see it done.
+ * authors: Josiah Nethery
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "device.h"
+#include "statehash.h"
+
+#define DEV_QUEUE 4096		// jobs in flight, a power of two
+#define UART_BUFFER 4096	// bytes the worker collects before writing them out
+
+/* work for the host thread */
+#define JOB_PUTC 0
+#define JOB_READ 1
+#define JOB_WRITE 2
+#define JOB_QUIT 3
+
+typedef struct
+{
+	int type;
+	unsigned value;		// the byte for the UART, the first block for the disk
+	unsigned addr;
+	unsigned count;
+	unsigned char *data;	// blocks to write, copied when the command was given
+}struct_job;
+
+typedef struct
+{
+	unsigned src, dst, len;
+	unsigned status;
+}struct_dma;
+
+typedef struct
+{
+	int fd;
+	unsigned block, addr, count;
+	unsigned blocks;
+	unsigned pending;	// commands the worker has not finished, shared with it
+	unsigned error;		// shared with the worker
+	unsigned read_from, read_to;	// memory filled by reads since the hash was last told
+}struct_disk;
+
+static struct_job Queue[DEV_QUEUE];
+static unsigned QueueHead, QueueTail;	// free running; the worker owns the head, the simulator the tail
+static sem_t QueueReady;
+static pthread_t Worker;
+static int WorkerRunning = 0;
+
+static struct_device Devices[DEV_MAX];
+static int DeviceCount = 0;
+static unsigned *BusMem;
+static unsigned long long BusStart;
+static struct_dma Dma;
+static struct_disk Disk = { -1 };
+
+unsigned long long *BusClock = NULL;
+
+static unsigned long long now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/*** push_job
+*		The producer side of the ring. Waits only if DEV_QUEUE jobs are still waiting for the worker.
+***/
+static void push_job(const struct_job *job)
+{
+	unsigned tail = QueueTail;
+
+	while (tail - __atomic_load_n(&QueueHead, __ATOMIC_ACQUIRE) == DEV_QUEUE)
+		sched_yield();
+	Queue[tail & (DEV_QUEUE - 1)] = *job;
+	__atomic_store_n(&QueueTail, tail + 1, __ATOMIC_RELEASE);
+	sem_post(&QueueReady);
+}
+
+static void disk_job(const struct_job *job)
+{
+	size_t size = (size_t) job->count * DISK_BLOCK_BYTES;
+	off_t at = (off_t) job->value * DISK_BLOCK_BYTES;
+	unsigned char *buf;
+	int failed;
+
+	if (job->type == JOB_READ)
+	{
+		buf = (unsigned char *) malloc(size);
+		failed = pread(Disk.fd, buf, size, at) != (ssize_t) size;
+		if (!failed)
+			memcpy(BusMem + (job->addr >> 2), buf, size);
+		free(buf);
+	}
+	else
+	{
+		failed = pwrite(Disk.fd, job->data, size, at) != (ssize_t) size;
+		free(job->data);
+	}
+	if (failed)
+		__atomic_store_n(&Disk.error, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&Disk.pending, 1, __ATOMIC_RELEASE);
+}
+
+/*** device_worker
+*		Takes the jobs off the ring in order. UART bytes are collected and written out together once
+*		the ring runs dry or the buffer is full.
+***/
+static void *device_worker(void *arg)
+{
+	char out[UART_BUFFER];
+	size_t n = 0;
+	struct_job job;
+
+	(void) arg;
+	for (;;)
+	{
+		sem_wait(&QueueReady);
+		job = Queue[QueueHead & (DEV_QUEUE - 1)];
+		__atomic_store_n(&QueueHead, QueueHead + 1, __ATOMIC_RELEASE);
+		if (job.type == JOB_PUTC)
+			out[n++] = (char) job.value;
+		if (n > 0 && (job.type != JOB_PUTC || n == UART_BUFFER
+			|| QueueHead == __atomic_load_n(&QueueTail, __ATOMIC_ACQUIRE)))
+		{
+			fwrite(out, 1, n, stdout);
+			fflush(stdout);
+			n = 0;
+		}
+		if (job.type == JOB_READ || job.type == JOB_WRITE)
+			disk_job(&job);
+		else if (job.type == JOB_QUIT)
+			return NULL;
+	}
+}
+
+static int uart_load(struct_device *dev, unsigned offset, unsigned *value, unsigned long long icount)
+{
+	*value = offset == UART_STATUS && QueueTail - __atomic_load_n(&QueueHead, __ATOMIC_ACQUIRE) < DEV_QUEUE
+		? UART_TX_READY : 0;
+	return 0;
+}
+
+static int uart_store(struct_device *dev, unsigned offset, unsigned value, unsigned long long icount)
+{
+	struct_job job = { JOB_PUTC, value & 0xFF, 0, 0, NULL };
+
+	if (offset == UART_DATA)
+		push_job(&job);
+	return 0;
+}
+
+static int timer_load(struct_device *dev, unsigned offset, unsigned *value, unsigned long long icount)
+{
+	if (offset == TIMER_COUNT_LO)
+		*value = (unsigned) icount;
+	else if (offset == TIMER_COUNT_HI)
+		*value = (unsigned) (icount >> 32);
+	else if (offset == TIMER_USEC)
+		*value = (unsigned) (now_usec() - BusStart);
+	else
+		*value = 0;
+	return 0;
+}
+
+static int timer_store(struct_device *dev, unsigned offset, unsigned value, unsigned long long icount)
+{
+	return 0;
+}
+
+static int dma_load(struct_device *dev, unsigned offset, unsigned *value, unsigned long long icount)
+{
+	*value = offset == DMA_SRC ? Dma.src : offset == DMA_DST ? Dma.dst : offset == DMA_LEN ? Dma.len
+		: offset == DMA_CTRL ? Dma.status : 0;
+	return 0;
+}
+
+/*** dma_store
+*		A copy within guest memory is cheaper than handing it to the worker, so the engine finishes it
+*		on the spot and is never seen busy. Ranges outside memory or not word aligned set the error.
+***/
+static int dma_store(struct_device *dev, unsigned offset, unsigned value, unsigned long long icount)
+{
+	if (offset == DMA_SRC)
+		Dma.src = value;
+	else if (offset == DMA_DST)
+		Dma.dst = value;
+	else if (offset == DMA_LEN)
+		Dma.len = value;
+	else if (offset == DMA_CTRL && value == DMA_START)
+	{
+		if (((Dma.src | Dma.dst | Dma.len) & 3) || Dma.src >= MEMBYTES || Dma.dst >= MEMBYTES
+			|| Dma.len > MEMBYTES - Dma.src || Dma.len > MEMBYTES - Dma.dst)
+			Dma.status = DEV_ERROR;
+		else
+		{
+			memmove(BusMem + (Dma.dst >> 2), BusMem + (Dma.src >> 2), Dma.len);
+			if (StateHash != NULL)
+				hash_stale(StateHash, Dma.dst, Dma.len);
+			Dma.status = DEV_IDLE;
+		}
+	}
+	return 0;
+}
+
+/*** disk_settled
+*		Once no command is pending, the memory filled by the reads is final and handed to the state
+*		hash, which cannot be told from the worker thread.
+***/
+static int disk_settled(void)
+{
+	if (__atomic_load_n(&Disk.pending, __ATOMIC_ACQUIRE))
+		return 0;
+	if (Disk.read_to > Disk.read_from && StateHash != NULL)
+		hash_stale(StateHash, Disk.read_from, Disk.read_to - Disk.read_from);
+	Disk.read_from = Disk.read_to = 0;
+	return 1;
+}
+
+static int disk_load(struct_device *dev, unsigned offset, unsigned *value, unsigned long long icount)
+{
+	if (offset == DISK_STATUS)
+		*value = !disk_settled() ? DEV_BUSY
+			: __atomic_load_n(&Disk.error, __ATOMIC_RELAXED) ? DEV_ERROR : DEV_IDLE;
+	else
+		*value = offset == DISK_BLOCK ? Disk.block : offset == DISK_ADDR ? Disk.addr
+			: offset == DISK_COUNT ? Disk.count : offset == DISK_BLOCKS ? Disk.blocks : 0;
+	return 0;
+}
+
+/*** disk_store
+*		A command is checked and queued for the worker; the blocks of a write are copied first, so the
+*		guest may reuse its buffer at once. A read fills memory some time before STATUS turns idle.
+***/
+static int disk_store(struct_device *dev, unsigned offset, unsigned value, unsigned long long icount)
+{
+	struct_job job;
+	size_t size;
+
+	if (offset == DISK_BLOCK)
+		Disk.block = value;
+	else if (offset == DISK_ADDR)
+		Disk.addr = value;
+	else if (offset == DISK_COUNT)
+		Disk.count = value;
+	else if (offset == DISK_CMD && (value == DISK_READ || value == DISK_WRITE))
+	{
+		if ((Disk.addr & 3) || Disk.addr >= MEMBYTES || Disk.count > (MEMBYTES - Disk.addr) / DISK_BLOCK_BYTES
+			|| Disk.block > Disk.blocks || Disk.count > Disk.blocks - Disk.block)
+		{
+			__atomic_store_n(&Disk.error, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+		size = (size_t) Disk.count * DISK_BLOCK_BYTES;
+		job.type = value == DISK_READ ? JOB_READ : JOB_WRITE;
+		job.value = Disk.block;
+		job.addr = Disk.addr;
+		job.count = Disk.count;
+		job.data = NULL;
+		if (job.type == JOB_WRITE)
+		{
+			job.data = (unsigned char *) malloc(size);
+			memcpy(job.data, BusMem + (Disk.addr >> 2), size);
+		}
+		else if (Disk.read_to == Disk.read_from)
+		{
+			Disk.read_from = Disk.addr;
+			Disk.read_to = Disk.addr + size;
+		}
+		else
+		{
+			Disk.read_from = Disk.addr < Disk.read_from ? Disk.addr : Disk.read_from;
+			Disk.read_to = Disk.addr + size > Disk.read_to ? Disk.addr + size : Disk.read_to;
+		}
+		__atomic_store_n(&Disk.error, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&Disk.pending, 1, __ATOMIC_RELAXED);
+		push_job(&job);
+	}
+	return 0;
+}
+
+int bus_attach(const struct_device *dev)
+{
+	int i;
+
+	if (DeviceCount == DEV_MAX)
+		return 1;
+	for (i = 0; i < DeviceCount; i++)
+	{
+		if (dev->base < Devices[i].base + Devices[i].size && Devices[i].base < dev->base + dev->size)
+			return 1;
+	}
+	Devices[DeviceCount++] = *dev;
+	return 0;
+}
+
+int bus_init(unsigned *Mem, const char *disk)
+{
+	struct_device uart = { "uart", DEV_UART, DEV_SPAN, uart_load, uart_store, NULL };
+	struct_device timer = { "timer", DEV_TIMER, DEV_SPAN, timer_load, timer_store, NULL };
+	struct_device dma = { "dma", DEV_DMA, DEV_SPAN, dma_load, dma_store, NULL };
+	struct_device blk = { "disk", DEV_DISK, DEV_SPAN, disk_load, disk_store, NULL };
+	struct stat st;
+
+	BusMem = Mem;
+	BusStart = now_usec();
+	memset(&Dma, 0, sizeof(Dma));
+	memset(&Disk, 0, sizeof(Disk));
+	Disk.fd = -1;
+	if (disk != NULL)
+	{
+		if ((Disk.fd = open(disk, O_RDWR)) < 0 || fstat(Disk.fd, &st) != 0)
+			return 1;
+		Disk.blocks = (unsigned) (st.st_size / DISK_BLOCK_BYTES);
+	}
+	bus_attach(&uart);
+	bus_attach(&timer);
+	bus_attach(&dma);
+	if (disk != NULL)
+		bus_attach(&blk);
+	sem_init(&QueueReady, 0, 0);
+	WorkerRunning = pthread_create(&Worker, NULL, device_worker, NULL) == 0;
+	return !WorkerRunning;
+}
+
+void bus_close(void)
+{
+	struct_job quit = { JOB_QUIT, 0, 0, 0, NULL };
+
+	if (WorkerRunning)
+	{
+		push_job(&quit);
+		pthread_join(Worker, NULL);
+		WorkerRunning = 0;
+		disk_settled();
+	}
+	if (Disk.fd >= 0)
+		close(Disk.fd);
+	Disk.fd = -1;
+}
+
+int bus_idle(void)
+{
+	return !WorkerRunning || __atomic_load_n(&Disk.pending, __ATOMIC_ACQUIRE) == 0;
+}
+
+/*** bus_access
+*		Only reached for addresses outside memory, so a linear search of the few devices is enough.
+***/
+int bus_access(unsigned addr, int write, unsigned *value, unsigned long long icount)
+{
+	struct_device *dev;
+	int i;
+
+	for (i = 0; i < DeviceCount; i++)
+	{
+		dev = &Devices[i];
+		if (addr - dev->base < dev->size)
+			return write ? dev->store(dev, addr - dev->base, *value, icount)
+				: dev->load(dev, addr - dev->base, value, icount);
+	}
+	return 1;
+}
@@ -0,0 +1,83 @@
+#include "spimcore.h"
+
+#ifndef DEVICE
+
+/***
+*		Physical addresses from DEV_BASE up belong to the device bus, above the end of memory, so a
+*		load or store only looks for a device after it has failed the memory bounds check. With the
+*		MMU, the bus is reached through kseg1 at 0xbf000000. Every device has DEV_SPAN bytes of word
+*		registers.
+***/
+#define DEV_BASE 0x1F000000
+#define DEV_SPAN 0x100
+#define DEV_MAX 16		// devices on the bus
+
+/* UART console: a byte stored to DATA is written to the host stdout */
+#define DEV_UART (DEV_BASE + 0x000)
+#define UART_DATA 0
+#define UART_STATUS 4		// bit 0: DATA can take a byte
+#define UART_TX_READY 1
+
+/* timer */
+#define DEV_TIMER (DEV_BASE + 0x100)
+#define TIMER_COUNT_LO 0	// instructions completed
+#define TIMER_COUNT_HI 4
+#define TIMER_USEC 8		// host microseconds since the bus was set up
+
+/* DMA engine: copies LEN bytes of memory from SRC to DST when 1 is stored to CTRL */
+#define DEV_DMA (DEV_BASE + 0x200)
+#define DMA_SRC 0
+#define DMA_DST 4
+#define DMA_LEN 8
+#define DMA_CTRL 12		// reads as the status
+#define DMA_START 1
+
+/* block device on a host file: moves COUNT blocks between BLOCK of the file and memory at ADDR */
+#define DEV_DISK (DEV_BASE + 0x300)
+#define DISK_BLOCK 0
+#define DISK_ADDR 4
+#define DISK_COUNT 8
+#define DISK_CMD 12
+#define DISK_STATUS 16
+#define DISK_BLOCKS 20		// size of the file in blocks
+#define DISK_READ 1
+#define DISK_WRITE 2
+#define DISK_BLOCK_BYTES 512
+
+/* device status */
+#define DEV_IDLE 0
+#define DEV_BUSY 1
+#define DEV_ERROR 2
+
+typedef struct struct_device
+{
+	const char *name;
+	unsigned base;
+	unsigned size;
+	/* access the register at offset (word aligned); return 1 to halt the machine */
+	int (*load)(struct struct_device *dev, unsigned offset, unsigned *value, unsigned long long icount);
+	int (*store)(struct struct_device *dev, unsigned offset, unsigned value, unsigned long long icount);
+	void *state;
+}struct_device;
+
+/* set up the bus for Mem with the UART, the timer and the DMA engine, and the block device if disk
+   is not NULL; returns 1 if the disk cannot be opened */
+int bus_init(unsigned *Mem, const char *disk);
+
+/* put a device on the bus; returns 1 if its range is taken or the bus is full */
+int bus_attach(const struct_device *dev);
+
+/* wait for the host side of the devices to finish and stop it */
+void bus_close(void);
+
+/* a load (write 0) or store (write 1) outside memory; returns 1 if no device claims addr */
+int bus_access(unsigned addr, int write, unsigned *value, unsigned long long icount);
+
+/* 1 if no device is working on the host side, so memory only changes through the guest */
+int bus_idle(void);
+
+/* the instruction count seen by devices accessed from rw_memory(), which has no count of its own */
+extern unsigned long long *BusClock;
+
+#define DEVICE
+#endif
@@ -0,0 +1,165 @@
+/*
+ * fast.c - A fast engine for the datapath of project.c. Every instruction is decoded straight from its
+ * op-code and funct by one switch, without control signals, and the program counter is kept in a local
+ * between instructions. The results must match Step() bit for bit, quirks included; fuzz.c checks that.
+ * authors: Josiah Nethery
+ */
+
+#include "fast.h"
+#include "sysio.h"
+#include "device.h"
+#include "statehash.h"
+#include "skip.h"
+
+struct_coverage *Coverage = NULL;
+
+/* control reached the block at pc: count the edge from the last one, as AFL does */
+static inline void cover(unsigned pc)
+{
+	unsigned block;
+
+	if (__builtin_expect(Coverage != NULL, 0))
+	{
+		block = ((pc >> 2) * 2654435761u) >> 16;
+		Coverage->map[(block ^ Coverage->prev) & (COVERAGE_MAP - 1)]++;
+		Coverage->prev = block >> 1;
+	}
+}
+
+/*** fast_run
+*		Runs instructions until one halts or max have completed. A halting instruction changes nothing,
+*		as in the datapath, and leaves the PC pointing at it.
+***/
+unsigned long long fast_run(unsigned *Mem, unsigned *Reg, int *Halt, unsigned long long *InstCount,
+	unsigned long long max, fast_syscall sys, void *arg)
+{
+	unsigned pc = Reg[REGSIZE];
+	unsigned instruction, rs, rt, imm, addr, value;
+	unsigned long long n;
+
+	*Halt = 0;
+	for (n = 0; n < max; n++)
+	{
+		if ((pc & 3) || pc >= MEMBYTES)
+			break;
+		instruction = Mem[pc >> 2];
+		rs = instruction >> 21 & 0x1F;
+		rt = instruction >> 16 & 0x1F;
+		imm = (instruction & 0x8000) ? (instruction | 0xFFFF0000) : (instruction & 0xFFFF);
+		switch (instruction >> 26)
+		{
+			case 0: //r-type
+				switch (instruction & 0x3F)
+				{
+					case 12: //syscall
+						Reg[REGSIZE] = pc;
+						if (sys != NULL ? sys(arg, Reg, Mem, *InstCount + n) : syscall_exec(Reg, Mem, *InstCount + n))
+						{
+							*Halt = 1;
+							*InstCount += n;
+							return n;
+						}
+						pc = Reg[REGSIZE];
+						break;
+					case 32: //add
+						Reg[instruction >> 11 & 0x1F] = Reg[rs] + Reg[rt];
+						break;
+					case 34: //sub
+						Reg[instruction >> 11 & 0x1F] = Reg[rs] - Reg[rt];
+						break;
+					case 36: //and
+						Reg[instruction >> 11 & 0x1F] = Reg[rs] & Reg[rt];
+						break;
+					case 37: //or
+						Reg[instruction >> 11 & 0x1F] = Reg[rs] | Reg[rt];
+						break;
+					case 42: //slt, unsigned in the ALU
+						Reg[instruction >> 11 & 0x1F] = Reg[rs] < Reg[rt];
+						break;
+					case 43: //sltu, signed in the ALU
+						Reg[instruction >> 11 & 0x1F] = (int) Reg[rs] < (int) Reg[rt];
+						break;
+					default:
+						goto halt;
+				}
+				pc += 4;
+				break;
+			case 2: //j
+				addr = (pc & 0xF8000000) + ((instruction & 0x3FFFFFF) << 2);
+				if (addr <= pc && LoopSkip)
+					n += skip_loop(Mem, Reg, addr, pc, max - n - 1);
+				pc = addr;
+				cover(pc);
+				break;
+			case 4: //beq
+				if (Reg[rs] != Reg[rt])
+				{
+					pc += 4;
+					cover(pc);
+					break;
+				}
+				addr = pc + (imm << 2) + 4;
+				if (addr <= pc && LoopSkip)
+					n += skip_loop(Mem, Reg, addr, pc, max - n - 1);
+				pc = addr;
+				cover(pc);
+				break;
+			case 8: //addi
+				Reg[rt] = Reg[rs] + imm;
+				pc += 4;
+				break;
+			case 10: //slti, unsigned in the ALU
+				Reg[rt] = Reg[rs] < imm;
+				pc += 4;
+				break;
+			case 11: //sltiu, signed in the ALU
+				Reg[rt] = (int) Reg[rs] < (int) imm;
+				pc += 4;
+				break;
+			case 15: //lui
+				Reg[rt] = imm << 16;
+				pc += 4;
+				break;
+			case 35: //lw
+				addr = Reg[rs] + imm;
+				if (__builtin_expect((addr & 3) || addr >= MEMBYTES, 0))
+				{
+					if ((addr & 3) || bus_access(addr, 0, &value, *InstCount + n))
+						goto halt;
+					Reg[rt] = value;
+				}
+				else
+					Reg[rt] = Mem[addr >> 2];
+				pc += 4;
+				break;
+			case 43: //sw
+				addr = Reg[rs] + imm;
+				if (__builtin_expect((addr & 3) || addr >= MEMBYTES, 0))
+				{
+					if ((addr & 3) || bus_access(addr, 1, &Reg[rt], *InstCount + n))
+						goto halt;
+				}
+				else
+				{
+					if (StateHash != NULL)
+						hash_touch(StateHash, addr >> 2);
+					Mem[addr >> 2] = Reg[rt];
+				}
+				pc += 4;
+				break;
+			default:
+				goto halt;
+		}
+	}
+	if (n == max)
+	{
+		Reg[REGSIZE] = pc;
+		*InstCount += n;
+		return n;
+	}
+halt:
+	Reg[REGSIZE] = pc;
+	*Halt = 1;
+	*InstCount += n;
+	return n;
+}
@@ -0,0 +1,27 @@
+#include "spimcore.h"
+
+#ifndef FAST
+
+/* a syscall handler: executes the service requested in $v0 and returns 1 if the machine halts */
+typedef int (*fast_syscall)(void *arg, unsigned *Reg, unsigned *Mem, unsigned long long icount);
+
+#define COVERAGE_MAP 65536	// bytes of an edge map in the layout of AFL
+
+typedef struct
+{
+	unsigned char *map;	// hit counts of the edges, indexed by the hashes of both ends
+	unsigned prev;		// hash of the last block, shifted right by one
+}struct_coverage;
+
+/* edge coverage recorded by fast_run() at every branch and jump, or NULL */
+extern struct_coverage *Coverage;
+
+/* run at most max instructions on Mem/Reg exactly as repeated calls of Step() would: *Halt is set
+   when an instruction halts the machine and *InstCount counts the completed instructions. Syscalls
+   go to sys with arg, or to syscall_exec() if sys is NULL.
+   Returns the number of instructions completed by this call */
+unsigned long long fast_run(unsigned *Mem, unsigned *Reg, int *Halt, unsigned long long *InstCount,
+	unsigned long long max, fast_syscall sys, void *arg);
+
+#define FAST
+#endif
@@ -0,0 +1,23 @@
+#include <stddef.h>
+
+#ifndef FNV
+
+/* 64-bit FNV-1a of size bytes, continuing from hash (0 to start). Shared by the assembler's build
+   cache and the image keys of the simulator, which link different sets of files */
+static inline unsigned long long hash_bytes(const void *data, size_t size, unsigned long long hash)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	size_t i;
+
+	if (hash == 0)
+		hash = 14695981039346656037ULL;
+	for (i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+#define FNV
+#endif
@@ -0,0 +1,520 @@
+/*
+ * fuzz.c - Differential fuzzer between the reference datapath (Step() over the stage functions of
+ * project.c) and the fast engine of fast.c. Random instruction streams, valid and invalid, run from
+ * random initial registers and data on both, and the registers, memory, halt point and instruction
+ * count must agree. The machines are reset in place between cases (persistent mode): only the words
+ * a case can have written are compared and cleared, and the whole memory is compared every
+ * FUZZ_FULL_CHECK cases to catch stray writes. Worker processes split the cases between them, and
+ * every difference found is minimized before it is reported.
+ * authors: Josiah Nethery
+ */
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "fuzz.h"
+#include "fast.h"
+
+#define NOP 0x00000020	// add $zero, $zero, $zero
+#define SYSCALL_FUNCT 12
+
+typedef struct
+{
+	unsigned text[FUZZ_MAX_WORDS];
+	int length;
+	unsigned data[FUZZ_DATA_WORDS];
+	unsigned Reg[REGSIZE + 4];
+}struct_case;
+
+/* both machines of a worker: the reference one belongs to spimcore, the fast one to the worker */
+typedef struct
+{
+	unsigned *Mem;
+	unsigned *Reg;
+	int *Halt;
+	unsigned long long *InstCount;
+	void (*step)(void);
+	unsigned *FastMem;
+	unsigned FastReg[REGSIZE + 4];
+	int FastHalt;
+	unsigned long long FastCount;
+	unsigned dirty[FUZZ_BUDGET];	// words the reference stored to
+	int dirty_count;
+}struct_harness;
+
+typedef struct
+{
+	unsigned long long cases;
+	unsigned long long insts;
+	unsigned long long failures;
+}struct_fuzz_result;
+
+static const char RegExtra[4][6] = { "$pc", "$stat", "$lo", "$hi" };
+
+static const unsigned Edge[] = { 0, 1, 0xFFFFFFFF, 0x7FFFFFFF, 0x80000000, 0xFFFC, MEMBYTES, MEMBYTES - 4 };
+static const unsigned Functs[] = { 32, 34, 36, 37, 42, 43 };
+static const unsigned ImmOps[] = { 8, 10, 11, 15 };
+static unsigned Values[256];
+
+/*** next_random
+*		splitmix64: cheap, and good enough that every case index gives an unrelated case.
+***/
+static unsigned long long next_random(unsigned long long *state)
+{
+	unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/*** init_values
+*		Fills the table random_value() draws from: small numbers, addresses in the data and text of a
+*		case, aligned and not, and values at the edges of signed and unsigned comparisons and of memory.
+***/
+static void init_values(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+	{
+		if (i < 64)
+			Values[i] = i & 7;
+		else if (i < 128)
+			Values[i] = GPINIT + (i % FUZZ_DATA_WORDS) * 4;
+		else if (i < 160)
+			Values[i] = PCINIT + (i % FUZZ_MAX_WORDS) * 4;
+		else if (i < 192)
+			Values[i] = Edge[i % (sizeof(Edge) / sizeof(Edge[0]))];
+		else
+			Values[i] = GPINIT + (i & 63);
+	}
+}
+
+/* a register or data value: three times out of four from the table, otherwise anything at all.
+   Written without branches, which the generator would mispredict all the time */
+static unsigned random_value(unsigned long long r)
+{
+	return (r & 0x300) ? Values[r & 255] : (unsigned) (r >> 32);
+}
+
+/* mostly the first eight registers, so that instructions depend on each other */
+static unsigned random_reg(unsigned long long r)
+{
+	return (r & 3) ? (r >> 2) & 7 : (r >> 2) & 31;
+}
+
+static unsigned random_imm(unsigned long long r)
+{
+	switch (r & 3)
+	{
+		case 0:
+			return ((r >> 2) % 17 - 8) & 0xFFFF;
+		case 1:
+			return (((r >> 2) % 17 - 8) * 4) & 0xFFFF;
+		case 2:
+			return Edge[(r >> 2) % (sizeof(Edge) / sizeof(Edge[0]))] & 0xFFFF;
+		default:
+			return (r >> 2) & 0xFFFF;
+	}
+}
+
+/*** random_instruction
+*		Mostly instructions the datapath knows, with operands that exercise its corner cases; branches
+*		and jumps mostly stay within the case. The rest are random words, which rarely decode.
+*		Syscalls are left out, since both engines hand them to the same syscall_exec().
+***/
+static unsigned random_instruction(unsigned long long *state, int length)
+{
+	unsigned long long r = next_random(state);
+	unsigned word, rs = random_reg(r >> 8), rt = random_reg(r >> 16), rd = random_reg(r >> 24);
+
+	switch (r & 15)
+	{
+		case 0: case 1: case 2: case 3: case 4: case 5: case 15:
+			word = rs << 21 | rt << 16 | rd << 11 | Functs[(r >> 32) % 6];
+			break;
+		case 6: case 7: case 8:
+			word = ImmOps[(r >> 32) & 3] << 26 | rs << 21 | rt << 16 | random_imm(r >> 40);
+			break;
+		case 9:
+			word = 35u << 26 | rs << 21 | rt << 16 | random_imm(r >> 40);
+			break;
+		case 10:
+			word = 43u << 26 | rs << 21 | rt << 16 | random_imm(r >> 40);
+			break;
+		case 11:
+			word = 4u << 26 | rs << 21 | rt << 16 | (((r >> 32) % (2 * length + 1) - length) & 0xFFFF);
+			break;
+		case 12:
+			word = 2u << 26 | ((r >> 32) & 3 ? (PCINIT >> 2) + (r >> 40) % (FUZZ_MAX_WORDS + 1) : (r >> 38) & 0x3FFFFFF);
+			break;
+		case 13:
+			word = rs << 21 | rt << 16 | rd << 11 | ((r >> 32) & 0x7FF);
+			break;
+		default:
+			word = (unsigned) (r >> 32);
+			break;
+	}
+	if (word >> 26 == 0 && (word & 0x3F) == SYSCALL_FUNCT)
+		word = (word & ~0x3Fu) | Functs[0];
+	return word;
+}
+
+/*** generate_case
+*		Builds case index of the run with the given seed; the same seed and index give the same case.
+***/
+static void generate_case(unsigned long long seed, unsigned long long index, struct_case *c)
+{
+	unsigned long long state = seed ^ (index * 0xD1B54A32D192ED03ULL);
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	c->length = 1 + (int) (next_random(&state) % FUZZ_MAX_WORDS);
+	for (i = 0; i < c->length; i++)
+		c->text[i] = random_instruction(&state, c->length);
+	for (i = 0; i < FUZZ_DATA_WORDS; i++)
+		c->data[i] = random_value(next_random(&state));
+	for (i = 1; i < REGSIZE + 4; i++)
+		c->Reg[i] = random_value(next_random(&state));
+	if ((next_random(&state) & 15) == 0)
+		c->Reg[0] = random_value(next_random(&state));
+	c->Reg[REGSIZE] = PCINIT;
+}
+
+/*** run_case
+*		Loads the case into both (clean) machines and runs it on both. The reference runs one Step()
+*		at a time, and the word every sw is about to store to is remembered for the comparison. A
+*		syscall the case stores into its own text ends it early on both, as host I/O is not under test.
+*		Returns the number of instructions the reference completed.
+***/
+static unsigned long long run_case(struct_harness *h, const struct_case *c)
+{
+	unsigned pc, word, addr;
+	int n;
+
+	memcpy(h->Mem + (PCINIT >> 2), c->text, sizeof(c->text));
+	memcpy(h->Mem + (GPINIT >> 2), c->data, sizeof(c->data));
+	memcpy(h->FastMem + (PCINIT >> 2), c->text, sizeof(c->text));
+	memcpy(h->FastMem + (GPINIT >> 2), c->data, sizeof(c->data));
+	memcpy(h->Reg, c->Reg, sizeof(c->Reg));
+	memcpy(h->FastReg, c->Reg, sizeof(c->Reg));
+	*h->Halt = 0;
+	*h->InstCount = 0;
+	h->FastCount = 0;
+	h->dirty_count = 0;
+
+	for (n = 0; n < FUZZ_BUDGET && !*h->Halt; n++)
+	{
+		pc = h->Reg[REGSIZE];
+		word = (!(pc & 3) && pc < MEMBYTES) ? h->Mem[pc >> 2] : 0;
+		if (word >> 26 == 0 && (word & 0x3F) == SYSCALL_FUNCT)
+			break;
+		if (word >> 26 == 43)
+		{
+			addr = h->Reg[word >> 21 & 0x1F] + ((word & 0x8000) ? (word | 0xFFFF0000) : (word & 0xFFFF));
+			if (!(addr & 3) && addr < MEMBYTES)
+				h->dirty[h->dirty_count++] = addr >> 2;
+		}
+		h->step();
+	}
+	fast_run(h->FastMem, h->FastReg, &h->FastHalt, &h->FastCount, n, NULL, NULL);
+	return *h->InstCount;
+}
+
+/* the words a case can have changed: its text, its data and whatever the reference stored to */
+#define FOR_CASE_WORDS(h, i, w, body) \
+	for (i = 0; i < FUZZ_MAX_WORDS; i++) { w = (PCINIT >> 2) + i; body; } \
+	for (i = 0; i < FUZZ_DATA_WORDS; i++) { w = (GPINIT >> 2) + i; body; } \
+	for (i = 0; i < (h)->dirty_count; i++) { w = (h)->dirty[i]; body; }
+
+/*** same_state
+*		Compares halt, instruction count and registers, and either the words of the case or the whole memory.
+***/
+static int same_state(const struct_harness *h, int full)
+{
+	unsigned w;
+	int i;
+
+	if (*h->Halt != h->FastHalt || *h->InstCount != h->FastCount
+		|| memcmp(h->Reg, h->FastReg, sizeof(h->FastReg)) != 0)
+		return 0;
+	if (full)
+		return memcmp(h->Mem, h->FastMem, MEMBYTES) == 0;
+	FOR_CASE_WORDS(h, i, w, if (h->Mem[w] != h->FastMem[w]) return 0)
+	return 1;
+}
+
+static void clean_case(struct_harness *h)
+{
+	unsigned w;
+	int i;
+
+	FOR_CASE_WORDS(h, i, w, h->Mem[w] = 0; h->FastMem[w] = 0)
+}
+
+/*** check_case
+*		Runs a case on freshly zeroed machines and compares everything; returns 1 if the engines differ.
+*		Slow, for minimizing and for finding the case behind a stray write.
+***/
+static int check_case(struct_harness *h, const struct_case *c)
+{
+	int differs;
+
+	memset(h->Mem, 0, MEMBYTES);
+	memset(h->FastMem, 0, MEMBYTES);
+	run_case(h, c);
+	differs = !same_state(h, 1);
+	memset(h->Mem, 0, MEMBYTES);
+	memset(h->FastMem, 0, MEMBYTES);
+	return differs;
+}
+
+/*** minimize
+*		Deletes instructions, replaces them by nops and zeroes registers and data words for as long
+*		as the engines still differ on the case.
+***/
+static void minimize(struct_harness *h, struct_case *c)
+{
+	struct_case t;
+	int changed = 1, i;
+
+	while (changed)
+	{
+		changed = 0;
+		for (i = c->length - 1; i >= 0 && c->length > 1; i--)
+		{
+			t = *c;
+			memmove(t.text + i, t.text + i + 1, (t.length - i - 1) * sizeof(unsigned));
+			t.text[--t.length] = 0;
+			if (check_case(h, &t))
+			{
+				*c = t;
+				changed = 1;
+			}
+		}
+		for (i = 0; i < c->length; i++)
+		{
+			t = *c;
+			t.text[i] = NOP;
+			if (c->text[i] != NOP && check_case(h, &t))
+			{
+				*c = t;
+				changed = 1;
+			}
+		}
+		for (i = 0; i < REGSIZE + 4; i++)
+		{
+			t = *c;
+			t.Reg[i] = 0;
+			if (i != REGSIZE && c->Reg[i] != 0 && check_case(h, &t))
+			{
+				*c = t;
+				changed = 1;
+			}
+		}
+		for (i = 0; i < FUZZ_DATA_WORDS; i++)
+		{
+			t = *c;
+			t.data[i] = 0;
+			if (c->data[i] != 0 && check_case(h, &t))
+			{
+				*c = t;
+				changed = 1;
+			}
+		}
+	}
+}
+
+static void print_reg_name(FILE *out, int i)
+{
+	if (i < REGSIZE)
+		fprintf(out, "$%-4d", i);
+	else
+		fprintf(out, "%-5s", RegExtra[i - REGSIZE]);
+}
+
+/*** report
+*		Minimizes a differing case and prints it: how to run it again, its initial state and program,
+*		and every register and memory word on which the engines ended up different.
+***/
+static void report(struct_harness *h, const struct_fuzz_config *cfg, unsigned long long index, struct_case *c,
+	FILE *out, const char *prefix)
+{
+	char *text = NULL;
+	size_t size = 0;
+	FILE *s = open_memstream(&text, &size);
+	int i;
+
+	minimize(h, c);
+	memset(h->Mem, 0, MEMBYTES);
+	memset(h->FastMem, 0, MEMBYTES);
+	run_case(h, c);
+	fprintf(s, "%s fuzz: case %llu differs (rerun with -fuzz 1 -seed %llu -first %llu), minimized:\n",
+		prefix, index, cfg->seed, index);
+	for (i = 0; i < REGSIZE + 4; i++)
+	{
+		if (c->Reg[i] != 0 && i != REGSIZE)
+		{
+			fprintf(s, "%s   ", prefix);
+			print_reg_name(s, i);
+			fprintf(s, " %08x\n", c->Reg[i]);
+		}
+	}
+	for (i = 0; i < FUZZ_DATA_WORDS; i++)
+	{
+		if (c->data[i] != 0)
+			fprintf(s, "%s   %04x  %08x\n", prefix, GPINIT + i * 4, c->data[i]);
+	}
+	for (i = 0; i < c->length; i++)
+		fprintf(s, "%s   %04x  %08x\n", prefix, PCINIT + i * 4, c->text[i]);
+	fprintf(s, "%s   reference: %llu instructions, halted: %s\n", prefix, *h->InstCount, *h->Halt ? "true" : "false");
+	fprintf(s, "%s   fast:      %llu instructions, halted: %s\n", prefix, h->FastCount, h->FastHalt ? "true" : "false");
+	for (i = 0; i < REGSIZE + 4; i++)
+	{
+		if (h->Reg[i] != h->FastReg[i])
+		{
+			fprintf(s, "%s   ", prefix);
+			print_reg_name(s, i);
+			fprintf(s, " reference %08x  fast %08x\n", h->Reg[i], h->FastReg[i]);
+		}
+	}
+	for (i = 0; i < MEMSIZE; i++)
+	{
+		if (h->Mem[i] != h->FastMem[i])
+			fprintf(s, "%s   %04x  reference %08x  fast %08x\n", prefix, i * 4, h->Mem[i], h->FastMem[i]);
+	}
+	fclose(s);
+	fwrite(text, 1, size, out);
+	fflush(out);
+	free(text);
+}
+
+/*** fuzz_worker
+*		Runs every threads-th case from cfg->first + w and stops at the first difference. When the
+*		whole-memory comparison fails, the cases since the last one that passed are run again one by
+*		one to find the culprit.
+***/
+static void fuzz_worker(const struct_fuzz_config *cfg, struct_harness *h, int w, struct_fuzz_result *res,
+	FILE *out, const char *prefix)
+{
+	unsigned long long end = cfg->first + cfg->cases, i, j, batch = cfg->first + w, since = 0;
+	struct_case c;
+	int differs;
+
+	memset(h->Mem, 0, MEMBYTES);
+	memset(h->FastMem, 0, MEMBYTES);
+	for (i = batch; i < end; i += cfg->threads)
+	{
+		generate_case(cfg->seed, i, &c);
+		res->insts += run_case(h, &c);
+		res->cases++;
+		differs = !same_state(h, 0);
+		clean_case(h);
+		if (!differs && (++since == FUZZ_FULL_CHECK || i + cfg->threads >= end))
+		{
+			since = 0;
+			if (memcmp(h->Mem, h->FastMem, MEMBYTES) != 0)
+			{
+				fprintf(out, "%s fuzz: memory differs after cases %llu to %llu, looking for the case\n", prefix, batch, i);
+				memset(h->Mem, 0, MEMBYTES);
+				memset(h->FastMem, 0, MEMBYTES);
+				for (j = batch; j <= i; j += cfg->threads)
+				{
+					generate_case(cfg->seed, j, &c);
+					if (check_case(h, &c))
+						break;
+				}
+				res->failures++;
+				if (j <= i)
+					report(h, cfg, j, &c, out, prefix);
+				return;
+			}
+			batch = i + cfg->threads;
+		}
+		if (differs)
+		{
+			res->failures++;
+			report(h, cfg, i, &c, out, prefix);
+			return;
+		}
+	}
+}
+
+/*** fuzz_run
+*		Forks cfg->threads workers, each with its own copy of the reference machine, collects their counts
+*		through pipes and prints the throughput. A single worker runs in this process.
+***/
+int fuzz_run(const struct_fuzz_config *cfg, unsigned *Mem, unsigned *Reg, int *Halt,
+	unsigned long long *InstCount, void (*step)(void), FILE *out, const char *prefix)
+{
+	struct_harness *h = (struct_harness *) malloc(sizeof(struct_harness));
+	struct_fuzz_result total, res;
+	struct timespec start, stop;
+	int *fds = (int *) malloc(cfg->threads * sizeof(int));
+	int w, pipefd[2];
+	double seconds;
+	pid_t pid;
+
+	h->Mem = Mem;
+	h->Reg = Reg;
+	h->Halt = Halt;
+	h->InstCount = InstCount;
+	h->step = step;
+	h->FastMem = (unsigned *) malloc(MEMSIZE * sizeof(unsigned));
+	init_values();
+	memset(&total, 0, sizeof(total));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (cfg->threads == 1)
+		fuzz_worker(cfg, h, 0, &total, out, prefix);
+	else
+	{
+		fflush(out);
+		for (w = 0; w < cfg->threads; w++)
+		{
+			fds[w] = -1;
+			if (pipe(pipefd) != 0)
+				break;
+			if ((pid = fork()) == 0)
+			{
+				close(pipefd[0]);
+				memset(&res, 0, sizeof(res));
+				fuzz_worker(cfg, h, w, &res, out, prefix);
+				fflush(out);
+				_exit(write(pipefd[1], &res, sizeof(res)) != sizeof(res));
+			}
+			close(pipefd[1]);
+			if (pid < 0)
+			{
+				close(pipefd[0]);
+				break;
+			}
+			fds[w] = pipefd[0];
+		}
+		if (w < cfg->threads)
+			fprintf(out, "%s fuzz: only %d of %d workers started\n", prefix, w, cfg->threads);
+		while (w-- > 0)
+		{
+			if (read(fds[w], &res, sizeof(res)) == sizeof(res))
+			{
+				total.cases += res.cases;
+				total.insts += res.insts;
+				total.failures += res.failures;
+			}
+			else
+				total.failures++;
+			close(fds[w]);
+		}
+		while (wait(NULL) > 0)
+			;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(out, "%s fuzz: %llu cases, %llu instructions in %.2fs, %.0f cases/s on %d workers, %llu failed\n",
+		prefix, total.cases, total.insts, seconds, seconds > 0 ? total.cases / seconds : 0.0, cfg->threads,
+		total.failures);
+	free(h->FastMem);
+	free(h);
+	free(fds);
+	return total.failures != 0;
+}
@@ -0,0 +1,25 @@
+#include "spimcore.h"
+
+#ifndef FUZZ
+
+/* shape of the generated cases */
+#define FUZZ_MAX_WORDS 16	// instructions per case, placed from PCINIT
+#define FUZZ_DATA_WORDS 16	// initial data words, placed from GPINIT
+#define FUZZ_BUDGET 64		// instructions run per case by each engine
+#define FUZZ_FULL_CHECK 4096	// cases between two comparisons of the whole memory
+
+typedef struct
+{
+	unsigned long long seed;	// cases are a function of the seed and their index only
+	unsigned long long first;	// index of the first case
+	unsigned long long cases;	// number of cases
+	int threads;			// worker processes
+}struct_fuzz_config;
+
+/* run the cases through step (the reference datapath on Mem/Reg/Halt/InstCount) and fast_run(),
+   report every difference, minimized, and print the throughput; returns 1 if any case differed */
+int fuzz_run(const struct_fuzz_config *cfg, unsigned *Mem, unsigned *Reg, int *Halt,
+	unsigned long long *InstCount, void (*step)(void), FILE *out, const char *prefix);
+
+#define FUZZ
+#endif
@@ -0,0 +1,180 @@
+/*
+ * guestfuzz.c - Guest fuzzing under AFL. The simulator takes the fork server's place: it answers the
+ * handshake, forks one child that loops over inputs, and stops it with SIGSTOP between them as a
+ * persistent-mode target does, so a process serves GUESTFUZZ_PERSIST inputs instead of one. Between
+ * inputs the child puts back only the pages the last run wrote, which the fast engine already marks
+ * for the state hash, and the registers; the .asc is never read again.
+ * authors: Josiah Nethery
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include "guestfuzz.h"
+#include "fast.h"
+#include "sysio.h"
+#include "statehash.h"
+#include "skip.h"
+
+/* afl-fuzz looks for these in the binary */
+const char GuestfuzzSignatures[] = "##SIG_AFL_PERSISTENT##";
+
+static unsigned char PrivateMap[COVERAGE_MAP];	// without AFL
+static struct_coverage Edges;
+static struct_hash Written;			// only its stale pages are used
+static unsigned SnapshotMem[MEMSIZE];
+static unsigned SnapshotReg[REGSIZE + 4];
+static unsigned char Input[MEMBYTES];
+
+/* prints are dropped; every other service halts the input, and is not a crash */
+static int guest_syscall(void *arg, unsigned *Reg, unsigned *Mem, unsigned long long icount)
+{
+	if (Reg[2] == SYS_PRINT_INT || Reg[2] == SYS_PRINT_CHAR)
+		return 0;
+	*(int *) arg = 1;
+	return 1;
+}
+
+static unsigned read_input(const struct_guestfuzz *cfg)
+{
+	unsigned n = 0;
+	ssize_t got;
+	int fd = 0;
+
+	if (cfg->input != NULL && (fd = open(cfg->input, O_RDONLY)) < 0)
+		return 0;
+	if (cfg->input == NULL)
+		lseek(0, 0, SEEK_SET);
+	while (n < cfg->size && ((got = read(fd, Input + n, cfg->size - n)) > 0 || (got < 0 && errno == EINTR)))
+		n += got > 0 ? (unsigned) got : 0;
+	if (fd != 0)
+		close(fd);
+	return n;
+}
+
+/*** execute
+*		Runs one input from the snapshot; returns 1 if it crashed, with the PC of the crash in *pc.
+***/
+static int execute(const struct_guestfuzz *cfg, unsigned *Mem, unsigned *Reg, unsigned *pc)
+{
+	unsigned long long icount = 0;
+	unsigned n, page;
+	int halt, syscall = 0;
+
+	for (page = 0; Written.any_stale && page < HASH_PAGES; page++)
+	{
+		if (Written.stale[page])
+			memcpy(Mem + page * HASH_PAGE_WORDS, SnapshotMem + page * HASH_PAGE_WORDS, HASH_PAGE_WORDS * sizeof(unsigned));
+	}
+	memset(Written.stale, 0, sizeof(Written.stale));
+	Written.any_stale = 0;
+	memcpy(Reg, SnapshotReg, sizeof(SnapshotReg));
+	n = read_input(cfg);
+	memcpy((unsigned char *) Mem + cfg->addr, Input, n);
+	memset((unsigned char *) Mem + cfg->addr + n, 0, cfg->size - n);
+	hash_stale(&Written, cfg->addr, cfg->size);
+	Reg[4] = cfg->addr;
+	Reg[5] = n;
+	Edges.prev = 0;
+	fast_run(Mem, Reg, &halt, &icount, cfg->budget, guest_syscall, &syscall);
+	*pc = Reg[REGSIZE];
+	return halt && !syscall && Reg[REGSIZE] != cfg->text_end;
+}
+
+/*** persist
+*		The child of the fork server: one input per SIGCONT, aborting on a crash so that the server
+*		sees the signal.
+***/
+static void persist(const struct_guestfuzz *cfg, unsigned *Mem, unsigned *Reg)
+{
+	unsigned pc;
+	int i;
+
+	close(GUESTFUZZ_FD);
+	close(GUESTFUZZ_FD + 1);
+	for (i = 0; i < GUESTFUZZ_PERSIST; i++)
+	{
+		if (i > 0)
+			raise(SIGSTOP);
+		if (execute(cfg, Mem, Reg, &pc))
+			abort();
+	}
+	_exit(0);
+}
+
+/*** serve
+*		The fork server protocol of AFL: after a four byte hello, every four bytes on the control fd
+*		ask for a run, answered with the pid of the child and then its wait status. A stopped child is
+*		continued, one that exited or crashed is replaced.
+***/
+static int serve(const struct_guestfuzz *cfg, unsigned *Mem, unsigned *Reg)
+{
+	unsigned word = 0;
+	int status, stopped = 0;
+	pid_t child = -1;
+
+	if (write(GUESTFUZZ_FD + 1, &word, 4) != 4)
+		return 1;
+	while (read(GUESTFUZZ_FD, &word, 4) == 4)
+	{
+		if (stopped && word)	//the fuzzer killed the stopped child on a timeout
+		{
+			stopped = 0;
+			waitpid(child, &status, 0);
+		}
+		if (!stopped)
+		{
+			if ((child = fork()) < 0)
+				return 1;
+			if (child == 0)
+				persist(cfg, Mem, Reg);
+		}
+		else
+		{
+			kill(child, SIGCONT);
+			stopped = 0;
+		}
+		if (write(GUESTFUZZ_FD + 1, &child, 4) != 4 || waitpid(child, &status, WUNTRACED) < 0)
+			return 1;
+		stopped = WIFSTOPPED(status);
+		if (write(GUESTFUZZ_FD + 1, &status, 4) != 4)
+			return 1;
+	}
+	return 0;
+}
+
+int guestfuzz_run(const struct_guestfuzz *cfg, unsigned *Mem, unsigned *Reg, FILE *err)
+{
+	const char *shm = getenv("__AFL_SHM_ID");
+	unsigned pc;
+	int i, edges = 0;
+
+	Edges.map = PrivateMap;
+	if (shm != NULL && (Edges.map = (unsigned char *) shmat(atoi(shm), NULL, 0)) == (void *) -1)
+	{
+		fprintf(err, "cannot attach the AFL map %s\n", shm);
+		return 1;
+	}
+	Edges.prev = 0;
+	Coverage = &Edges;
+	LoopSkip = 0;		//every iteration counts its back edge, as AFL's hit-count buckets expect
+	Written.Mem = Mem;
+	StateHash = &Written;
+	memcpy(SnapshotMem, Mem, sizeof(SnapshotMem));
+	memcpy(SnapshotReg, Reg, sizeof(SnapshotReg));
+	signal(SIGPIPE, SIG_IGN);
+	if (fcntl(GUESTFUZZ_FD, F_GETFD) != -1)
+		return serve(cfg, Mem, Reg);
+	if (execute(cfg, Mem, Reg, &pc))
+	{
+		fprintf(err, "crash at pc %08x\n", pc);
+		abort();
+	}
+	for (i = 0; i < COVERAGE_MAP; i++)
+		edges += Edges.map[i] != 0;
+	fprintf(err, "%d edges, halted at pc %08x\n", edges, Reg[REGSIZE]);
+	return 0;
+}
@@ -0,0 +1,31 @@
+#include "spimcore.h"
+
+#ifndef GUESTFUZZ
+
+/***
+*		Coverage-guided fuzzing of a guest program by AFL or a fuzzer that speaks its protocol:
+*		afl-fuzz -i in -o out -- spimcore prog.asc -guestfuzz addr:size. Each input is copied to the
+*		guest memory at addr (at most size bytes, the rest zeroed), with addr in $a0 and the length in
+*		$a1, and the program is run from a snapshot of the loaded machine on the fast engine. Edges go
+*		to the AFL shared memory map. A halt is a crash unless it is a syscall (exit, or a service that
+*		needs the host) or the fetch just past the loaded program.
+***/
+#define GUESTFUZZ_BUDGET (1ULL << 20)	// instructions per input without -max
+#define GUESTFUZZ_PERSIST 100000	// inputs per process before the fork server starts a new one
+#define GUESTFUZZ_FD 198		// the fork server control pipe of AFL; status goes to the next fd
+
+typedef struct
+{
+	unsigned addr;			// the input region
+	unsigned size;
+	unsigned text_end;		// address after the loaded program
+	unsigned long long budget;	// instructions per input
+	const char *input;		// file read for every input, or NULL for stdin
+}struct_guestfuzz;
+
+/* serve the fork server if AFL started the simulator, or run the one input otherwise; Mem and Reg hold
+   the loaded machine. A crash aborts the process, as AFL expects; returns 0 otherwise */
+int guestfuzz_run(const struct_guestfuzz *cfg, unsigned *Mem, unsigned *Reg, FILE *err);
+
+#define GUESTFUZZ
+#endif
@@ -0,0 +1,259 @@
+/*
+ * hostperf.c - Host performance counters for profiling the simulator itself. The cycles, instructions,
+ * branch misses and cache misses of the simulator thread are read as one perf event group around
+ * batch runs, and between the phases of every HP_SAMPLE-th instruction of Step(), with the cost of a
+ * read measured at the start and taken off. Where the PMU cannot be opened, in most containers and
+ * virtual machines, the monotonic clock stands in for the cycles and the other counters are left out.
+ * authors: Josiah Nethery
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "hostperf.h"
+#include "sysio.h"
+
+#define HP_CALIBRATE 256	// reads timed to find the cost of one
+
+static const unsigned long long Events[HP_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+static const char *CounterName[HP_COUNTERS] = { NULL, "instructions", "branch-misses", "cache-misses" };
+static const char *PhaseName[HP_PHASES] = { "decode", "alu", "memory", "writeback", "dispatch" };
+
+static int open_event(unsigned long long config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+void hostperf_open(struct_hostperf *hp)
+{
+	unsigned long long first[HP_COUNTERS], value[HP_COUNTERS];
+	int i, n = 1;
+
+	memset(hp, 0, sizeof(*hp));
+	for (i = 0; i < HP_COUNTERS; i++)
+	{
+		hp->fd[i] = -1;
+		hp->slot[i] = -1;
+	}
+	hp->countdown = HP_SAMPLE;
+	if ((hp->fd[HP_TIME] = open_event(Events[HP_TIME], -1)) < 0)
+	{
+		snprintf(hp->why, sizeof(hp->why), "%s", strerror(errno));
+		hp->clock = 1;
+		hp->time_unit = "ns";
+	}
+	else
+	{
+		hp->time_unit = "cycles";
+		hp->slot[HP_TIME] = 0;
+		for (i = 1; i < HP_COUNTERS; i++)
+		{
+			if ((hp->fd[i] = open_event(Events[i], hp->fd[HP_TIME])) >= 0)
+				hp->slot[i] = n++;
+		}
+	}
+	hostperf_read(hp, first);
+	for (i = 0; i < HP_CALIBRATE; i++)
+		hostperf_read(hp, value);
+	hostperf_read(hp, value);
+	for (i = 0; i < HP_COUNTERS; i++)
+		hp->read_cost[i] = (value[i] - first[i]) / (HP_CALIBRATE + 1);
+}
+
+void hostperf_read(const struct_hostperf *hp, unsigned long long *value)
+{
+	unsigned long long group[1 + HP_COUNTERS];
+	struct timespec t;
+	int i;
+
+	memset(value, 0, HP_COUNTERS * sizeof(unsigned long long));
+	if (hp->clock)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		value[HP_TIME] = t.tv_sec * 1000000000ULL + t.tv_nsec;
+		return;
+	}
+	if (read(hp->fd[HP_TIME], group, sizeof(group)) <= 0)
+		return;
+	for (i = 0; i < HP_COUNTERS; i++)
+	{
+		if (hp->slot[i] >= 0)
+			value[i] = group[1 + hp->slot[i]];
+	}
+}
+
+void hostperf_start(struct_hostperf *hp)
+{
+	hostperf_read(hp, hp->start);
+}
+
+void hostperf_stop(struct_hostperf *hp, unsigned long long guest)
+{
+	unsigned long long now[HP_COUNTERS];
+	int i;
+
+	hostperf_read(hp, now);
+	for (i = 0; i < HP_COUNTERS; i++)
+		hp->run[i] += now[i] - hp->start[i];
+	hp->guest += guest;
+}
+
+/* what happened from a to b, less the read at the end of it */
+static unsigned long long spent(const struct_hostperf *hp, const unsigned long long *a, const unsigned long long *b, int i)
+{
+	return b[i] - a[i] > hp->read_cost[i] ? b[i] - a[i] - hp->read_cost[i] : 0;
+}
+
+/* the instruction read at t[0] to t[phases] was of class mix; only whole datapaths have phases */
+static void account(struct_hostperf *hp, unsigned long long t[HP_DATAPATH + 1][HP_COUNTERS], int phases, int mix)
+{
+	int p, i;
+
+	for (i = 0; i < HP_COUNTERS; i++)
+	{
+		for (p = 0; phases == HP_DATAPATH && p < HP_DATAPATH; p++)
+			hp->phase[p][i] += spent(hp, t[p], t[p + 1], i);
+		hp->class_cost[mix][i] += t[phases][i] - t[0][i] > phases * hp->read_cost[i]
+			? t[phases][i] - t[0][i] - phases * hp->read_cost[i] : 0;
+	}
+	memcpy(hp->last, t[phases], sizeof(hp->last));
+	hp->dispatching = 1;
+	hp->class_count[mix]++;
+	hp->sampled += phases == HP_DATAPATH;
+	hp->reads += phases + 1;
+}
+
+/*** hostperf_step
+*		The datapath of Step(). A sampled syscall is only charged to its class, as it has no phases; the
+*		instruction after a sampled one starts with a read that closes its dispatch.
+***/
+int hostperf_step(struct_hostperf *hp, unsigned *Mem, unsigned *Reg, unsigned long long icount)
+{
+	unsigned long long t[HP_DATAPATH + 1][HP_COUNTERS];
+	unsigned instruction, op, r1, r2, r3, funct, offset, jsec;
+	unsigned data1, data2, extended_value, ALUresult, memdata = 0;
+	struct_controls controls;
+	char Zero;
+	int sample = --hp->countdown == 0, mix, i;
+
+	if (hp->dispatching)
+	{
+		hostperf_read(hp, t[0]);
+		for (i = 0; i < HP_COUNTERS; i++)
+			hp->phase[HP_DISPATCH][i] += spent(hp, hp->last, t[0], i);
+		hp->dispatching = 0;
+		hp->reads++;
+	}
+	if (sample)
+	{
+		hp->countdown = HP_SAMPLE;
+		hostperf_read(hp, t[0]);
+	}
+	if (instruction_fetch(Reg[REGSIZE], Mem, &instruction))
+		return HP_HALT;
+	instruction_partition(instruction, &op, &r1, &r2, &r3, &funct, &offset, &jsec);
+	if (instruction_decode(op, &controls))
+		return HP_HALT;
+	if (op == 0 && funct == 12)
+	{
+		if (syscall_exec(Reg, Mem, icount))
+			return HP_HALT;
+		Reg[REGSIZE] += 4;
+		if (sample)
+		{
+			hostperf_read(hp, t[1]);
+			account(hp, t, 1, MIX_SYSCALL);
+		}
+		return HP_DONE;
+	}
+	if (sample)
+		hostperf_read(hp, t[HP_DECODE + 1]);
+	read_register(r1, r2, Reg, &data1, &data2);
+	sign_extend(offset, &extended_value);
+	if (ALU_operations(data1, data2, extended_value, funct, controls.ALUOp, controls.ALUSrc, &ALUresult, &Zero))
+		return HP_HALT;
+	if (sample)
+		hostperf_read(hp, t[HP_ALU + 1]);
+	if (rw_memory(ALUresult, data2, controls.MemWrite, controls.MemRead, &memdata, Mem))
+		return HP_HALT;
+	if (sample)
+		hostperf_read(hp, t[HP_MEMORY + 1]);
+	write_register(r2, r3, memdata, ALUresult, controls.RegWrite, controls.RegDst, controls.MemtoReg, Reg);
+	PC_update(jsec, extended_value, controls.Branch, controls.Jump, Zero, &Reg[REGSIZE]);
+	if (sample)
+	{
+		hostperf_read(hp, t[HP_WRITEBACK + 1]);
+		mix = op == 0 ? MIX_ALU : op == 2 ? MIX_JUMP : op == 4 ? (Zero == '1' ? MIX_TAKEN : MIX_NOT_TAKEN)
+			: op == 35 ? MIX_LOAD : op == 43 ? MIX_STORE : MIX_IMM;
+		account(hp, t, HP_DATAPATH, mix);
+	}
+	return HP_DONE;
+}
+
+/*** hostperf_print
+*		The run costs are per guest instruction, less the reads made for the samples; the phase and
+*		class costs are per sampled instruction.
+***/
+void hostperf_print(const struct_hostperf *hp, FILE *out, const char *prefix)
+{
+	unsigned long long run[HP_COUNTERS], samples = 0, n;
+	int i, p;
+
+	if (hp->clock)
+		fprintf(out, "%s host counters unavailable (%s), timing with the clock\n", prefix, hp->why);
+	for (i = 0; i < HP_COUNTERS; i++)
+	{
+		run[i] = hp->run[i] > hp->reads * hp->read_cost[i] ? hp->run[i] - hp->reads * hp->read_cost[i] : 0;
+		if (i == HP_TIME || hp->slot[i] >= 0)
+			fprintf(out, "%s host %-14s %15llu  %10.2f per guest instruction\n", prefix,
+				i == HP_TIME ? hp->time_unit : CounterName[i], run[i], hp->guest ? (double) run[i] / hp->guest : 0.0);
+	}
+	if (!hp->clock && hp->slot[HP_INSTRUCTIONS] >= 0 && run[HP_TIME])
+		fprintf(out, "%s host IPC %37.2f\n", prefix, (double) run[HP_INSTRUCTIONS] / run[HP_TIME]);
+	if (hp->sampled == 0)
+		return;
+	for (p = 0; p < MIX_CLASSES; p++)
+		samples += hp->class_count[p];
+	for (p = 0; p < HP_PHASES; p++)
+	{
+		n = p == HP_DISPATCH ? samples : hp->sampled;
+		fprintf(out, "%s host phase %-10s %10.2f %s", prefix, PhaseName[p],
+			(double) hp->phase[p][HP_TIME] / n, hp->time_unit);
+		for (i = 1; i < HP_COUNTERS; i++)
+		{
+			if (hp->slot[i] >= 0)
+				fprintf(out, "  %8.3f %s", (double) hp->phase[p][i] / n, CounterName[i]);
+		}
+		fputc('\n', out);
+	}
+	for (p = 0; p < MIX_CLASSES; p++)
+	{
+		if (hp->class_count[p])
+			fprintf(out, "%s host class %-16s %10.2f %s  (%llu sampled)\n", prefix, MixName[p],
+				(double) hp->class_cost[p][HP_TIME] / hp->class_count[p], hp->time_unit, hp->class_count[p]);
+	}
+}
+
+void hostperf_close(struct_hostperf *hp)
+{
+	int i;
+
+	for (i = HP_COUNTERS - 1; i >= 0; i--)
+	{
+		if (hp->fd[i] >= 0)
+			close(hp->fd[i]);
+		hp->fd[i] = -1;
+	}
+}
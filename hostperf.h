@@ -0,0 +1,71 @@
+#include "spimcore.h"
+#include "instrument.h"
+
+#ifndef HOSTPERF
+
+/* host counters, read as a group */
+#define HP_TIME 0		// CPU cycles, or nanoseconds when the PMU is not available
+#define HP_INSTRUCTIONS 1
+#define HP_BRANCH_MISSES 2
+#define HP_CACHE_MISSES 3
+#define HP_COUNTERS 4
+
+/* phases of Step() */
+#define HP_DECODE 0		// fetch, partition and decode
+#define HP_ALU 1		// register read, sign extension and ALU
+#define HP_MEMORY 2
+#define HP_WRITEBACK 3		// register write and PC update
+#define HP_DATAPATH 4		// the phases above are the datapath
+#define HP_DISPATCH 4		// from the end of one instruction to the start of the next
+#define HP_PHASES 5
+
+#define HP_SAMPLE 64		// one instruction in this many is measured phase by phase
+
+#define HP_DONE 0
+#define HP_HALT 1
+
+typedef struct
+{
+	int fd[HP_COUNTERS];		// -1 for the counters that could not be opened
+	int slot[HP_COUNTERS];		// position of each counter in a group read
+	int clock;			// HP_TIME is the clock: no perf event could be opened
+	const char *time_unit;		// "cycles" or "ns"
+	char why[80];			// why the hardware counters are missing
+	unsigned long long read_cost[HP_COUNTERS];	// what one hostperf_read() adds to each counter
+
+	unsigned long long start[HP_COUNTERS];
+	unsigned long long run[HP_COUNTERS];		// around the runs
+	unsigned long long guest;			// guest instructions of the runs
+
+	unsigned long long phase[HP_PHASES][HP_COUNTERS];	// of the sampled instructions
+	unsigned long long class_cost[MIX_CLASSES][HP_COUNTERS];
+	unsigned long long class_count[MIX_CLASSES];
+	unsigned long long sampled;			// instructions measured phase by phase
+	unsigned long long reads;			// made by hostperf_step()
+	unsigned long long last[HP_COUNTERS];		// at the end of the last sampled instruction
+	int dispatching;				// last is to be charged to the dispatch
+	unsigned countdown;
+}struct_hostperf;
+
+/* open the counters, or fall back to the monotonic clock if the cycles cannot be counted; never
+   fails */
+void hostperf_open(struct_hostperf *hp);
+
+/* read every counter; the ones that are not open read 0 */
+void hostperf_read(const struct_hostperf *hp, unsigned long long *value);
+
+/* bracket a run of guest instructions */
+void hostperf_start(struct_hostperf *hp);
+void hostperf_stop(struct_hostperf *hp, unsigned long long guest);
+
+/* Step() with the counters read between the phases of every HP_SAMPLE-th instruction; returns HP_DONE
+   or HP_HALT */
+int hostperf_step(struct_hostperf *hp, unsigned *Mem, unsigned *Reg, unsigned long long icount);
+
+/* costs per guest instruction of the runs, the phases and the instruction classes */
+void hostperf_print(const struct_hostperf *hp, FILE *out, const char *prefix);
+
+void hostperf_close(struct_hostperf *hp);
+
+#define HOSTPERF
+#endif
@@ -0,0 +1,95 @@
+/*
+ * instrument.c - Counters of the instrumented datapath: policy names and printing. The hooks
+ * themselves are inline in instrument.h, so that the datapath can be specialized per policy.
+ * authors: Josiah Nethery
+ */
+
+#include "instrument.h"
+
+static const char *PolicyName[] = { "mix", "ops", "mem", "halt" };
+
+const char *MixName[MIX_CLASSES] = {
+	"alu", "alu imm", "load", "store", "branch taken", "branch not taken", "jump", "syscall" };
+
+static const char *HaltName[HALT_CAUSES] = {
+	"running", "fetch", "decode", "alu", "memory", "exit", "syscall" };
+
+/*** counters_policy
+*		Turns a comma separated list of policy names (or "all") into a policy bit mask.
+***/
+int counters_policy(const char *list)
+{
+	int policy = 0, i, n;
+
+	while (*list)
+	{
+		n = (int) strcspn(list, ",");
+		if (n == 3 && strncmp(list, "all", 3) == 0)
+			policy = INST_POLICIES - 1;
+		else
+		{
+			for (i = 0; i < 4; i++)
+			{
+				if ((int) strlen(PolicyName[i]) == n && strncmp(list, PolicyName[i], n) == 0)
+					break;
+			}
+			if (i == 4)
+				return -1;
+			policy |= 1 << i;
+		}
+		list += n;
+		if (*list == ',')
+			list++;
+	}
+	return policy;
+}
+
+/*** counters_print
+*		Prints the counters of every enabled policy. Op-codes and functs that never ran are left out.
+***/
+void counters_print(const struct_counters *c, int policy, FILE *out, const char *prefix)
+{
+	unsigned long long total = 0;
+	int i;
+
+	policy &= INST_BUILD;
+	if (policy == 0)
+	{
+		fprintf(out, "%s no counters (start with -count)\n", prefix);
+		return;
+	}
+	if (policy & INST_MIX)
+	{
+		for (i = 0; i < MIX_CLASSES; i++)
+			total += c->mix[i];
+		for (i = 0; i < MIX_CLASSES; i++)
+			fprintf(out, "%s mix  %-16s %12llu  %5.1f%%\n", prefix, MixName[i], c->mix[i],
+				total ? 100.0 * c->mix[i] / total : 0.0);
+	}
+	if (policy & INST_OPS)
+	{
+		for (i = 0; i < 64; i++)
+		{
+			if (c->ops[i])
+				fprintf(out, "%s op   %2d %25llu\n", prefix, i, c->ops[i]);
+		}
+		for (i = 0; i < 64; i++)
+		{
+			if (c->functs[i])
+				fprintf(out, "%s funct %2d %24llu\n", prefix, i, c->functs[i]);
+		}
+	}
+	if (policy & INST_MEM)
+	{
+		fprintf(out, "%s mem  reads  %15llu  %llu bytes\n", prefix, c->reads, c->read_bytes);
+		fprintf(out, "%s mem  writes %15llu  %llu bytes\n", prefix, c->writes, c->write_bytes);
+	}
+	if (policy & INST_HALT)
+	{
+		if (c->halt_cause == HALT_NONE)
+			fprintf(out, "%s halt running\n", prefix);
+		else
+			fprintf(out, "%s halt %s at pc %08x after %llu instructions\n", prefix,
+				HaltName[c->halt_cause], c->halt_pc, c->halt_count);
+	}
+}
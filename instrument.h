@@ -0,0 +1,130 @@
+#include "spimcore.h"
+
+#ifndef INSTRUMENT
+
+/* instrumentation policies, combined as a bit mask; 0 is the plain datapath */
+#define INST_MIX 1	// instruction classes, taken and not taken branches
+#define INST_OPS 2	// executions per op-code and per R-type funct
+#define INST_MEM 4	// datapath memory reads and writes and their bytes
+#define INST_HALT 8	// why and where the machine halted
+#define INST_POLICIES 16
+
+/* policy bits of the plugin hooks in plugin.h, set for the kinds of callbacks the loaded plugins use.
+   They are never combined with the counters, and NO_INSTRUMENT leaves them in */
+#define INST_PLUGIN_STAGE 16	// a callback between every two stages
+#define INST_PLUGIN_BLOCK 32	// one per basic block
+#define INST_PLUGIN_EVENTS 64	// loads, stores, taken branches and syscalls, batched
+#define INST_PLUGIN_KINDS 8	// combinations of the three
+
+/* compile with -DNO_INSTRUMENT to leave the hooks out of every policy */
+#ifdef NO_INSTRUMENT
+#define INST_BUILD 0
+#else
+#define INST_BUILD (INST_POLICIES - 1)
+#endif
+
+/* instruction classes */
+#define MIX_ALU 0
+#define MIX_IMM 1
+#define MIX_LOAD 2
+#define MIX_STORE 3
+#define MIX_TAKEN 4
+#define MIX_NOT_TAKEN 5
+#define MIX_JUMP 6
+#define MIX_SYSCALL 7
+#define MIX_CLASSES 8
+
+/* halt causes */
+#define HALT_NONE 0
+#define HALT_FETCH 1	// PC out of memory or not word aligned
+#define HALT_DECODE 2	// unknown op-code
+#define HALT_ALU 3	// unknown R-type funct
+#define HALT_MEMORY 4	// load or store address out of memory or not word aligned
+#define HALT_EXIT 5	// exit syscall
+#define HALT_SYSCALL 6	// unknown service, bad guest buffer or replay divergence
+#define HALT_CAUSES 7
+
+typedef struct
+{
+	unsigned long long mix[MIX_CLASSES];
+	unsigned long long ops[64];
+	unsigned long long functs[64];
+	unsigned long long reads, writes, read_bytes, write_bytes;
+	int halt_cause;
+	unsigned halt_pc;
+	unsigned long long halt_count;
+}struct_counters;
+
+/* names of the instruction classes */
+extern const char *MixName[MIX_CLASSES];
+
+/* parse a list such as "mix,mem" or "all" into a policy; returns -1 if a name is unknown */
+int counters_policy(const char *list);
+
+/* print the counters kept by policy, every line starting with prefix */
+void counters_print(const struct_counters *c, int policy, FILE *out, const char *prefix);
+
+/* hooks called by the datapath; policy is a constant at every call, so disabled hooks compile to nothing.
+   Executions and memory traffic are counted once an instruction has completed. */
+static inline void hook_decode(int policy, struct_counters *c, unsigned op, unsigned funct)
+{
+	if (policy & INST_BUILD & INST_OPS)
+	{
+		c->ops[op & 63]++;
+		if (op == 0)
+			c->functs[funct & 63]++;
+	}
+}
+
+static inline void hook_memory(int policy, struct_counters *c, const struct_controls *controls)
+{
+	if (policy & INST_BUILD & INST_MEM)
+	{
+		if (controls->MemRead == '1')
+		{
+			c->reads++;
+			c->read_bytes += 4;
+		}
+		if (controls->MemWrite == '1')
+		{
+			c->writes++;
+			c->write_bytes += 4;
+		}
+	}
+}
+
+static inline void hook_writeback(int policy, struct_counters *c, const struct_controls *controls, unsigned pc, unsigned next)
+{
+	if (policy & INST_BUILD & INST_MIX)
+	{
+		if (controls->Jump == '1')
+			c->mix[MIX_JUMP]++;
+		else if (controls->Branch == '1')
+			c->mix[next != pc + 4 ? MIX_TAKEN : MIX_NOT_TAKEN]++;
+		else if (controls->MemRead == '1')
+			c->mix[MIX_LOAD]++;
+		else if (controls->MemWrite == '1')
+			c->mix[MIX_STORE]++;
+		else
+			c->mix[controls->ALUSrc == '1' ? MIX_IMM : MIX_ALU]++;
+	}
+}
+
+static inline void hook_syscall(int policy, struct_counters *c)
+{
+	if (policy & INST_BUILD & INST_MIX)
+		c->mix[MIX_SYSCALL]++;
+}
+
+static inline void hook_halt(int policy, struct_counters *c, int halt, int cause, unsigned pc, unsigned long long count)
+{
+	if ((policy & INST_BUILD & INST_HALT) && halt)
+	{
+		c->halt_cause = cause;
+		c->halt_pc = pc;
+		c->halt_count = count;
+	}
+}
+
+#define INSTRUMENT
+#endif
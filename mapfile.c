@@ -0,0 +1,130 @@
+/*
+ * mapfile.c - Host files in the guest address space. Every mapped file is a device on the bus whose
+ * registers are the words of the file: a load returns the word at the offset from the mapping, and a
+ * store of a copy-on-write mapping writes it in place, where the kernel gives the process its own copy
+ * of the page. Nothing is read or copied up front, so a file of gigabytes maps as fast as a small one.
+ * authors: Josiah Nethery
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapfile.h"
+#include "device.h"
+
+typedef struct
+{
+	const char *path;
+	unsigned *words;
+	size_t length;		// bytes mapped from the host
+	unsigned base;
+	unsigned bytes;		// guest bytes, the file rounded up to a word
+	int mode;		// MAP_*
+}struct_mapped;
+
+static struct_mapped Mapped[MAP_MAX];
+static int MappedCount = 0;
+static const char *ModeName[] = { "ro", "cow" };
+
+static int map_load(struct_device *dev, unsigned offset, unsigned *value, unsigned long long icount)
+{
+	*value = ((const struct_mapped *) dev->state)->words[offset >> 2];
+	return 0;
+}
+
+static int map_store(struct_device *dev, unsigned offset, unsigned value, unsigned long long icount)
+{
+	struct_mapped *m = (struct_mapped *) dev->state;
+
+	if (m->mode == MAP_READ)
+		return 1;
+	m->words[offset >> 2] = value;
+	return 0;
+}
+
+int map_mode(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (strcmp(name, ModeName[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*** map_host_file
+*		The range is checked against the whole of the device window, not only the devices attached,
+*		so a file never hides a device that bus_init() attaches later. A file whose size is not a
+*		multiple of 4 ends in a word padded with zeros, which the mapping provides past the end of the
+*		file within its last page.
+***/
+int map_host_file(const char *path, unsigned base, int mode, FILE *err)
+{
+	struct_mapped *m = &Mapped[MappedCount];
+	struct_device dev = { "map", base, 0, map_load, map_store, m };
+	struct stat st;
+	unsigned long long end;
+	void *host;
+	int fd;
+
+	if (MappedCount == MAP_MAX)
+	{
+		fprintf(err, "cannot map %s: %d files are mapped already\n", path, MAP_MAX);
+		return 1;
+	}
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(err, "cannot map %s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	end = (unsigned long long) base + (((unsigned long long) st.st_size + 3) & ~3ULL);
+	if (st.st_size == 0 || (base & 3) || base < MEMBYTES || end > 0x100000000ULL
+		|| (base < DEV_BASE + DEV_MAX * DEV_SPAN && end > DEV_BASE))
+	{
+		fprintf(err, "cannot map %s at %08x: %s\n", path, base, st.st_size == 0 ? "empty file"
+			: "not a word-aligned range above memory that fits in 32 bits and is clear of the devices");
+		close(fd);
+		return 1;
+	}
+	host = mmap(NULL, (size_t) st.st_size, mode == MAP_READ ? PROT_READ : PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+	close(fd);
+	if (host == MAP_FAILED)
+	{
+		fprintf(err, "cannot map %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	m->path = strdup(path);
+	m->words = (unsigned *) host;
+	m->length = (size_t) st.st_size;
+	m->base = base;
+	m->bytes = (unsigned) (end - base);
+	m->mode = mode;
+	dev.size = m->bytes;
+	if (bus_attach(&dev))
+	{
+		fprintf(err, "cannot map %s at %08x: the range is taken or the bus is full\n", path, base);
+		munmap(host, m->length);
+		free((void *) m->path);
+		return 1;
+	}
+	MappedCount++;
+	return 0;
+}
+
+void map_print(FILE *out, const char *prefix)
+{
+	int i;
+
+	for (i = 0; i < MappedCount; i++)
+		fprintf(out, "%s %08x-%08x %-3s %s\n", prefix, Mapped[i].base, Mapped[i].base + Mapped[i].bytes - 1,
+			ModeName[Mapped[i].mode], Mapped[i].path);
+	if (MappedCount == 0)
+		fprintf(out, "%s no files mapped\n", prefix);
+}
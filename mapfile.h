@@ -0,0 +1,26 @@
+#include "spimcore.h"
+
+#ifndef MAPFILE
+
+/***
+*		Host files mapped into the guest's physical address space, above the end of memory like the
+*		devices, so loads and stores reach them through bus_access() from every engine. The file is
+*		mapped with mmap() and paged in as the guest touches it: mapping costs the same for any size,
+*		and a word read by the guest is read straight from the page cache.
+***/
+#define MAP_MAX 8		// files mapped at once
+#define MAP_READ 0		// stores to the file halt the machine
+#define MAP_COPY 1		// private copy on write: stores change the guest's view, never the file
+
+/* map the file at path from the guest address base, which must be word aligned, above memory and
+   clear of the devices; returns 1 with a message on err if it cannot be mapped */
+int map_host_file(const char *path, unsigned base, int mode, FILE *err);
+
+/* parse a mode name, "ro" or "cow"; returns -1 for anything else */
+int map_mode(const char *name);
+
+/* list the mapped files */
+void map_print(FILE *out, const char *prefix);
+
+#define MAPFILE
+#endif
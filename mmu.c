@@ -0,0 +1,290 @@
+/*
+ * mmu.c - An R3000-style MMU for the simulator: kuseg/kseg0/kseg1/kseg2 segments, a software-refilled
+ * TLB, coprocessor 0 and exceptions. Translations that succeeded are kept in a direct-mapped host
+ * cache per access kind, so that most fetches, loads and stores cost one compare and one add; only
+ * the misses segment-check the address and search the TLB.
+ * authors: Josiah Nethery
+ */
+
+#include "mmu.h"
+#include "sysio.h"
+
+static const char *ExcName[EXC_CODES] = {
+	"int", "mod", "tlbl", "tlbs", "adel", "ades", "ibe", "dbe",
+	"sys", "bp", "ri", "cpu", "ov", "13", "14", "15" };
+
+static void flush_cache(struct_mmu *mmu)
+{
+	memset(mmu->tc, 0xFF, sizeof(mmu->tc));
+	mmu->stats.flushes++;
+}
+
+/* drop the cached translations of one virtual page */
+static void flush_page(struct_mmu *mmu, unsigned page)
+{
+	int kind;
+	struct_tc_entry *tc;
+
+	for (kind = 0; kind < 2; kind++)
+	{
+		tc = &mmu->tc[kind][(page >> MMU_PAGE_SHIFT) & (MMU_TC_SIZE - 1)];
+		if ((tc->tag & MMU_PAGE_MASK) == page)
+			tc->tag = MMU_TC_EMPTY;
+	}
+}
+
+void mmu_init(struct_mmu *mmu, int entries)
+{
+	int i;
+
+	memset(mmu, 0, sizeof(*mmu));
+	mmu->entries = entries;
+	for (i = 0; i < MMU_MAX_ENTRIES; i++)	//unused entries hold kseg0 pages, which never reach the TLB
+		mmu->tlb[i].hi = KSEG0 + (i << MMU_PAGE_SHIFT);
+	mmu->cp0[CP0_EBASE] = KSEG0;
+	memset(mmu->tc, 0xFF, sizeof(mmu->tc));
+}
+
+/*** mmu_miss
+*		Translates an address that is not in the host cache: kernel segments are refused in user mode,
+*		kseg0 and kseg1 are unmapped and the rest goes through the TLB. A successful translation is put
+*		in the cache. Returns 0 or the exception code.
+***/
+static int mmu_miss(struct_mmu *mmu, unsigned va, int access, unsigned *pa)
+{
+	unsigned page = va & MMU_PAGE_MASK, asid = mmu->cp0[CP0_ENTRYHI] & MMU_ASID_MASK;
+	unsigned offset, hi, lo = 0;
+	struct_tc_entry *tc;
+	int i;
+
+	mmu->stats.cache_misses++;
+	if (va >= KSEG0 && mmu->ku)
+		return access == MMU_STORE ? EXC_ADES : EXC_ADEL;
+	if (va >= KSEG0 && va < KSEG2)
+		offset = va < KSEG1 ? 0u - KSEG0 : 0u - KSEG1;
+	else
+	{
+		mmu->stats.tlb_lookups++;
+		for (i = 0; i < mmu->entries; i++)
+		{
+			hi = mmu->tlb[i].hi;
+			lo = mmu->tlb[i].lo;
+			if ((hi & MMU_PAGE_MASK) == page && ((lo & ENTRYLO_G) || (hi & MMU_ASID_MASK) == asid))
+				break;
+		}
+		if (i == mmu->entries)
+			return (access == MMU_STORE ? EXC_TLBS : EXC_TLBL) | (va < KSEG0 ? EXC_REFILL : 0);
+		if (!(lo & ENTRYLO_V))
+			return access == MMU_STORE ? EXC_TLBS : EXC_TLBL;
+		if (access == MMU_STORE && !(lo & ENTRYLO_D))
+			return EXC_MOD;
+		mmu->stats.tlb_hits++;
+		offset = (lo & MMU_PAGE_MASK) - page;
+	}
+	tc = &mmu->tc[access == MMU_STORE][(va >> MMU_PAGE_SHIFT) & (MMU_TC_SIZE - 1)];
+	tc->tag = page | mmu->ku;
+	tc->offset = offset;
+	*pa = va + offset;
+	return 0;
+}
+
+/* the fast path: one compare against the host cache and one add */
+static inline int mmu_translate(struct_mmu *mmu, unsigned va, int access, unsigned *pa)
+{
+	const struct_tc_entry *tc = &mmu->tc[access == MMU_STORE][(va >> MMU_PAGE_SHIFT) & (MMU_TC_SIZE - 1)];
+
+	mmu->stats.translations++;
+	if (tc->tag == ((va & MMU_PAGE_MASK) | mmu->ku))
+	{
+		*pa = va + tc->offset;
+		return 0;
+	}
+	return mmu_miss(mmu, va, access, pa);
+}
+
+/*** take_exception
+*		Saves the PC in EPC and the cause, and for address and TLB exceptions the bad address (also in
+*		EntryHi and Context for the refill handler), enters kernel mode by pushing the Status stack and
+*		goes to the refill or the general vector.
+***/
+static int take_exception(struct_mmu *mmu, unsigned *Reg, int code, unsigned va)
+{
+	unsigned vector = (code & EXC_REFILL) ? MMU_REFILL_VECTOR : MMU_GENERAL_VECTOR;
+
+	code &= ~EXC_REFILL;
+	mmu->cp0[CP0_EPC] = Reg[REGSIZE];
+	mmu->cp0[CP0_CAUSE] = (mmu->cp0[CP0_CAUSE] & ~0x7Cu) | code << 2;
+	if (code != EXC_CPU)
+		mmu->cp0[CP0_BADVADDR] = va;
+	if (code == EXC_MOD || code == EXC_TLBL || code == EXC_TLBS)
+	{
+		mmu->cp0[CP0_ENTRYHI] = (va & MMU_PAGE_MASK) | (mmu->cp0[CP0_ENTRYHI] & MMU_ASID_MASK);
+		mmu->cp0[CP0_CONTEXT] = (mmu->cp0[CP0_CONTEXT] & 0xFFE00000) | ((va >> 10) & 0x001FFFFC);
+	}
+	Reg[REGSIZE + 1] = (Reg[REGSIZE + 1] & ~0x3Fu) | ((Reg[REGSIZE + 1] << 2) & 0x3C);
+	Reg[REGSIZE] = mmu->cp0[CP0_EBASE] + vector;
+	mmu->stats.exceptions[code]++;
+	if (vector == MMU_REFILL_VECTOR)
+		mmu->stats.refills++;
+	return MMU_EXCEPTION;
+}
+
+static void write_entryhi(struct_mmu *mmu, unsigned value)
+{
+	if ((value ^ mmu->cp0[CP0_ENTRYHI]) & MMU_ASID_MASK)
+		flush_cache(mmu);
+	mmu->cp0[CP0_ENTRYHI] = value & (MMU_PAGE_MASK | MMU_ASID_MASK);
+}
+
+static void write_tlb(struct_mmu *mmu, int index)
+{
+	flush_page(mmu, mmu->tlb[index].hi & MMU_PAGE_MASK);
+	mmu->tlb[index].hi = mmu->cp0[CP0_ENTRYHI];
+	mmu->tlb[index].lo = mmu->cp0[CP0_ENTRYLO];
+	flush_page(mmu, mmu->tlb[index].hi & MMU_PAGE_MASK);
+	mmu->stats.tlb_writes++;
+}
+
+/* Random counts down through the TLB as instructions run */
+static int random_index(const struct_mmu *mmu)
+{
+	return mmu->entries - 1 - (int) (mmu->icount % mmu->entries);
+}
+
+/*** cop0
+*		mfc0 and mtc0 move registers of coprocessor 0, tlbr/tlbwi/tlbwr/tlbp read, write and probe the
+*		TLB through EntryHi, EntryLo and Index, and eret pops the Status stack and returns to EPC.
+*		Only Index, EntryLo, the PTEBase of Context, EntryHi, Status, EPC and EBase are writable.
+***/
+static int cop0(struct_mmu *mmu, unsigned *Reg, unsigned rs, unsigned rt, unsigned rd, unsigned funct)
+{
+	int i, index = ((mmu->cp0[CP0_INDEX] >> 8) & 0x3F) % mmu->entries;
+	unsigned hi;
+
+	if (mmu->ku)
+		return take_exception(mmu, Reg, EXC_CPU, 0);
+	if (rs == COP0_MF)
+	{
+		if (rd == CP0_RANDOM)
+			Reg[rt] = random_index(mmu) << 8;
+		else if (rd == CP0_STATUS)
+			Reg[rt] = Reg[REGSIZE + 1];
+		else
+			Reg[rt] = mmu->cp0[rd];
+	}
+	else if (rs == COP0_MT)
+	{
+		if (rd == CP0_INDEX)
+			mmu->cp0[CP0_INDEX] = Reg[rt] & 0x3F00;
+		else if (rd == CP0_ENTRYLO)
+			mmu->cp0[CP0_ENTRYLO] = Reg[rt] & 0xFFFFFF00;
+		else if (rd == CP0_CONTEXT)
+			mmu->cp0[CP0_CONTEXT] = (mmu->cp0[CP0_CONTEXT] & 0x001FFFFC) | (Reg[rt] & 0xFFE00000);
+		else if (rd == CP0_ENTRYHI)
+			write_entryhi(mmu, Reg[rt]);
+		else if (rd == CP0_STATUS)
+			Reg[REGSIZE + 1] = Reg[rt];
+		else if (rd == CP0_EPC || rd == CP0_EBASE)
+			mmu->cp0[rd] = Reg[rt];
+	}
+	else if (rs == COP0_CO && funct == COP0_TLBR)
+	{
+		write_entryhi(mmu, mmu->tlb[index].hi);
+		mmu->cp0[CP0_ENTRYLO] = mmu->tlb[index].lo;
+	}
+	else if (rs == COP0_CO && funct == COP0_TLBWI)
+		write_tlb(mmu, index);
+	else if (rs == COP0_CO && funct == COP0_TLBWR)
+		write_tlb(mmu, random_index(mmu));
+	else if (rs == COP0_CO && funct == COP0_TLBP)
+	{
+		hi = mmu->cp0[CP0_ENTRYHI];
+		mmu->cp0[CP0_INDEX] = 0x80000000;
+		for (i = 0; i < mmu->entries; i++)
+		{
+			if ((mmu->tlb[i].hi & MMU_PAGE_MASK) == (hi & MMU_PAGE_MASK)
+				&& ((mmu->tlb[i].lo & ENTRYLO_G) || (mmu->tlb[i].hi & MMU_ASID_MASK) == (hi & MMU_ASID_MASK)))
+			{
+				mmu->cp0[CP0_INDEX] = i << 8;
+				break;
+			}
+		}
+	}
+	else if (rs == COP0_CO && funct == COP0_ERET)
+	{
+		Reg[REGSIZE + 1] = (Reg[REGSIZE + 1] & ~0xFu) | ((Reg[REGSIZE + 1] >> 2) & 0xF);
+		Reg[REGSIZE] = mmu->cp0[CP0_EPC];
+		return MMU_DONE;
+	}
+	else
+		return MMU_HALT;
+	Reg[REGSIZE] += 4;
+	return MMU_DONE;
+}
+
+/*** mmu_step
+*		The datapath of Step() with the fetch address and the address of a load or store translated
+*		first. Physical addresses are checked by the datapath as before, so a page outside memory or a
+*		misaligned address halts the machine. Syscall buffers are physical addresses.
+***/
+int mmu_step(struct_mmu *mmu, unsigned *Mem, unsigned *Reg, unsigned long long icount)
+{
+	unsigned instruction, op, r1, r2, r3, funct, offset, jsec;
+	unsigned data1, data2, extended_value, ALUresult, memdata = 0, pa;
+	struct_controls controls;
+	char Zero;
+	int e;
+
+	mmu->ku = (Reg[REGSIZE + 1] & STATUS_KUC) >> 1;
+	mmu->icount = icount;
+	if ((e = mmu_translate(mmu, Reg[REGSIZE], MMU_FETCH, &pa)) != 0)
+		return take_exception(mmu, Reg, e, Reg[REGSIZE]);
+	if (instruction_fetch(pa, Mem, &instruction))
+		return MMU_HALT;
+	instruction_partition(instruction, &op, &r1, &r2, &r3, &funct, &offset, &jsec);
+	if (op == COP0_OP)
+		return cop0(mmu, Reg, r1, r2, r3, funct);
+	if (instruction_decode(op, &controls))
+		return MMU_HALT;
+	if (op == 0 && funct == 12)
+	{
+		if (syscall_exec(Reg, Mem, icount))
+			return MMU_HALT;
+		Reg[REGSIZE] += 4;
+		return MMU_DONE;
+	}
+	read_register(r1, r2, Reg, &data1, &data2);
+	sign_extend(offset, &extended_value);
+	if (ALU_operations(data1, data2, extended_value, funct, controls.ALUOp, controls.ALUSrc, &ALUresult, &Zero))
+		return MMU_HALT;
+	pa = ALUresult;
+	if (controls.MemRead == '1' || controls.MemWrite == '1')
+	{
+		if ((e = mmu_translate(mmu, ALUresult, controls.MemWrite == '1' ? MMU_STORE : MMU_LOAD, &pa)) != 0)
+			return take_exception(mmu, Reg, e, ALUresult);
+	}
+	if (rw_memory(pa, data2, controls.MemWrite, controls.MemRead, &memdata, Mem))
+		return MMU_HALT;
+	write_register(r2, r3, memdata, ALUresult, controls.RegWrite, controls.RegDst, controls.MemtoReg, Reg);
+	PC_update(jsec, extended_value, controls.Branch, controls.Jump, Zero, &Reg[REGSIZE]);
+	return MMU_DONE;
+}
+
+void mmu_print(const struct_mmu *mmu, FILE *out, const char *prefix)
+{
+	const struct_mmu_stats *s = &mmu->stats;
+	int i;
+
+	fprintf(out, "%s mmu  translations   %15llu  %5.1f%% from the host cache\n", prefix, s->translations,
+		s->translations ? 100.0 * (s->translations - s->cache_misses) / s->translations : 0.0);
+	fprintf(out, "%s mmu  tlb lookups    %15llu  %5.1f%% hits\n", prefix, s->tlb_lookups,
+		s->tlb_lookups ? 100.0 * s->tlb_hits / s->tlb_lookups : 0.0);
+	fprintf(out, "%s mmu  refills        %15llu\n", prefix, s->refills);
+	fprintf(out, "%s mmu  tlb writes     %15llu\n", prefix, s->tlb_writes);
+	fprintf(out, "%s mmu  cache flushes  %15llu\n", prefix, s->flushes);
+	for (i = 0; i < EXC_CODES; i++)
+	{
+		if (s->exceptions[i])
+			fprintf(out, "%s mmu  exception %-4s %15llu\n", prefix, ExcName[i], s->exceptions[i]);
+	}
+}
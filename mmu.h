@@ -0,0 +1,120 @@
+#include "spimcore.h"
+
+#ifndef MMU
+
+/* segments of the 32-bit virtual address space, as on the R3000 */
+#define KSEG0 0x80000000	// kernel, unmapped: physical = virtual - KSEG0
+#define KSEG1 0xA0000000	// kernel, unmapped and uncached: physical = virtual - KSEG1
+#define KSEG2 0xC0000000	// kernel, mapped by the TLB; below KSEG0 is kuseg, mapped and open to user mode
+
+#define MMU_PAGE_SHIFT 12
+#define MMU_PAGE_MASK 0xFFFFF000
+#define MMU_ASID_MASK 0x00000FC0
+#define MMU_MAX_ENTRIES 64
+#define MMU_TC_SIZE 256			// entries of each host translation cache, a power of 2
+#define MMU_TC_EMPTY 0xFFFFFFFF		// tag no address matches
+
+/* offsets of the exception vectors from EBase */
+#define MMU_REFILL_VECTOR 0x000		// TLB miss in kuseg
+#define MMU_GENERAL_VECTOR 0x080	// every other exception
+
+/* coprocessor 0 registers (mfc0/mtc0); Status is the machine's $stat register */
+#define CP0_INDEX 0
+#define CP0_RANDOM 1
+#define CP0_ENTRYLO 2
+#define CP0_CONTEXT 4
+#define CP0_BADVADDR 8
+#define CP0_ENTRYHI 10
+#define CP0_STATUS 12
+#define CP0_CAUSE 13
+#define CP0_EPC 14
+#define CP0_EBASE 15	// base of the exception vectors; PRId on a real R3000
+
+/* EntryLo bits below the page frame number */
+#define ENTRYLO_N 0x800	// noncacheable, ignored
+#define ENTRYLO_D 0x400	// dirty: stores allowed
+#define ENTRYLO_V 0x200	// valid
+#define ENTRYLO_G 0x100	// global: matches every ASID
+
+/* Status keeps a stack of three kernel/user and interrupt enable pairs; the current pair is the lowest */
+#define STATUS_KUC 0x2	// 1 in user mode
+
+/* exception codes in Cause (bits 6..2) */
+#define EXC_MOD 1	// store to a page that is not dirty
+#define EXC_TLBL 2	// TLB miss or invalid page on a fetch or load
+#define EXC_TLBS 3	// TLB miss or invalid page on a store
+#define EXC_ADEL 4	// user fetch or load from a kernel segment
+#define EXC_ADES 5	// user store to a kernel segment
+#define EXC_CPU 11	// coprocessor 0 instruction in user mode
+#define EXC_CODES 16
+#define EXC_REFILL 0x100	// or-ed into a TLB miss in kuseg, which goes to the refill vector
+
+/* coprocessor 0 instructions: op-code 16, the rs field selects the kind and funct the TLB operation */
+#define COP0_OP 16
+#define COP0_MF 0
+#define COP0_MT 4
+#define COP0_CO 16
+#define COP0_TLBR 1
+#define COP0_TLBWI 2
+#define COP0_TLBWR 6
+#define COP0_TLBP 8
+#define COP0_ERET 24
+
+/* results of mmu_step */
+#define MMU_DONE 0
+#define MMU_HALT 1
+#define MMU_EXCEPTION 2
+
+/* access kinds */
+#define MMU_FETCH 0
+#define MMU_LOAD 1
+#define MMU_STORE 2
+
+typedef struct
+{
+	unsigned hi;	// virtual page number and ASID, laid out as EntryHi
+	unsigned lo;	// page frame number and N D V G, laid out as EntryLo
+}struct_tlb_entry;
+
+/* host translation cache entry: a page the current mode has used without an exception */
+typedef struct
+{
+	unsigned tag;		// virtual page | KUc, or MMU_TC_EMPTY
+	unsigned offset;	// physical minus virtual address
+}struct_tc_entry;
+
+typedef struct
+{
+	unsigned long long translations;
+	unsigned long long cache_misses;	// translations that went past the host cache
+	unsigned long long tlb_lookups;
+	unsigned long long tlb_hits;
+	unsigned long long refills;
+	unsigned long long tlb_writes;
+	unsigned long long flushes;
+	unsigned long long exceptions[EXC_CODES];
+}struct_mmu_stats;
+
+typedef struct
+{
+	int entries;
+	struct_tlb_entry tlb[MMU_MAX_ENTRIES];
+	unsigned cp0[32];
+	unsigned ku;			// KUc of the instruction being run
+	unsigned long long icount;	// drives Random
+	struct_tc_entry tc[2][MMU_TC_SIZE];	// fetches and loads, stores
+	struct_mmu_stats stats;
+}struct_mmu;
+
+/* reset the MMU with a TLB of entries (1 to MMU_MAX_ENTRIES) entries, in kernel mode with EBase at KSEG0 */
+void mmu_init(struct_mmu *mmu, int entries);
+
+/* run one instruction on Mem/Reg with translated fetches, loads and stores and the coprocessor 0
+   instructions; returns MMU_DONE, MMU_HALT, or MMU_EXCEPTION when the PC went to a vector instead */
+int mmu_step(struct_mmu *mmu, unsigned *Mem, unsigned *Reg, unsigned long long icount);
+
+/* print the translation statistics, every line starting with prefix */
+void mmu_print(const struct_mmu *mmu, FILE *out, const char *prefix);
+
+#define MMU
+#endif
@@ -0,0 +1,221 @@
+/*
+ * object.c - Relocatable object files and the linker for the MIPS assembler.
+ * An object file is text: a header line, the encoded words of the file's text and data in hex,
+ * then one line per symbol and one line per relocation.
+ * authors: Josiah Nethery
+ */
+
+#include "asm.h"
+
+#define OBJECT_MAGIC "SPIMOBJ"
+#define OBJECT_VERSION 2
+
+/*** write_object
+*		This function writes an object in the text object format. Returns 1 on a write error.
+***/
+int write_object(struct object *obj, FILE *output)
+{
+	int i;
+	fprintf(output, "%s %d %d %d %d %d\n", OBJECT_MAGIC, OBJECT_VERSION, obj->text_count, obj->data_count, obj->symbol_count, obj->reloc_count);
+	for (i = 0; i < obj->text_count; i++)
+		fprintf(output, "%08x\n", obj->text[i]);
+	for (i = 0; i < obj->data_count; i++)
+		fprintf(output, "%08x\n", obj->data[i]);
+	for (i = 0; i < obj->symbol_count; i++)
+		fprintf(output, "s %d %d %d %s\n", obj->symbols[i].kind, obj->symbols[i].section, obj->symbols[i].offset, obj->symbols[i].name);
+	for (i = 0; i < obj->reloc_count; i++)
+		fprintf(output, "r %d %d %d %d %s\n", obj->relocs[i].section, obj->relocs[i].index, obj->relocs[i].type, obj->relocs[i].line, obj->relocs[i].name);
+	return ferror(output) ? 1 : 0;
+}
+
+/*** read_object
+*		This function reads an object written by write_object. Returns 1 if the file is not a valid object.
+***/
+int read_object(struct object *obj, FILE *input, const char *name)
+{
+	char magic[BUFFER_SIZE], label[BUFFER_SIZE];
+	int version, i;
+	struct reloc *rel;
+	memset(obj, 0, sizeof(struct object));
+	obj->name = arena_strdup(&obj->strings, name, strlen(name));
+	if (fscanf(input, "%255s %d %d %d %d %d", magic, &version, &obj->text_count, &obj->data_count, &obj->symbol_count, &obj->reloc_count) != 6
+		|| strcmp(magic, OBJECT_MAGIC) != 0 || version != OBJECT_VERSION
+		|| obj->text_count < 0 || obj->data_count < 0 || obj->symbol_count < 0 || obj->reloc_count < 0)
+	{
+		printf("%s: error: not an object file\n", name);
+		obj->text_count = obj->data_count = obj->symbol_count = obj->reloc_count = 0;
+		return 1;
+	}
+	obj->text = (unsigned*)malloc((obj->text_count + 1) * sizeof(unsigned));
+	obj->data = (unsigned*)malloc((obj->data_count + 1) * sizeof(unsigned));
+	obj->symbols = (struct objsymbol*)malloc((obj->symbol_count + 1) * sizeof(struct objsymbol));
+	obj->relocs = (struct reloc*)malloc((obj->reloc_count + 1) * sizeof(struct reloc));
+	for (i = 0; i < obj->text_count; i++)
+	{
+		if (fscanf(input, "%x", &obj->text[i]) != 1)
+		{
+			printf("%s: error: truncated object file\n", name);
+			return 1;
+		}
+	}
+	for (i = 0; i < obj->data_count; i++)
+	{
+		if (fscanf(input, "%x", &obj->data[i]) != 1)
+		{
+			printf("%s: error: truncated object file\n", name);
+			return 1;
+		}
+	}
+	for (i = 0; i < obj->symbol_count; i++)
+	{
+		if (fscanf(input, " s %d %d %d %255s", &obj->symbols[i].kind, &obj->symbols[i].section, &obj->symbols[i].offset, label) != 4)
+		{
+			printf("%s: error: truncated object file\n", name);
+			return 1;
+		}
+		obj->symbols[i].name = arena_strdup(&obj->strings, label, strlen(label));
+	}
+	for (i = 0; i < obj->reloc_count; i++)
+	{
+		rel = &obj->relocs[i];
+		if (fscanf(input, " r %d %d %d %d %255s", &rel->section, &rel->index, &rel->type, &rel->line, label) != 5
+			|| rel->index < 0 || rel->index >= (rel->section == SECT_DATA ? obj->data_count : obj->text_count)
+			|| rel->type < RELOC_J || rel->type > RELOC_WORD || (rel->section == SECT_DATA) != (rel->type == RELOC_WORD))
+		{
+			printf("%s: error: truncated object file\n", name);
+			return 1;
+		}
+		rel->name = arena_strdup(&obj->strings, label, strlen(label));
+	}
+	return 0;
+}
+
+/*** link_objects
+*		The linker. Places the text of the objects one after the other from TEXT_BASE and their data one after
+*		the other from DATA_BASE, enters every global symbol into one table and patches every relocation with
+*		the address of its symbol, looked up among the object's own labels first. Returns 1 on duplicate or
+*		undefined symbols, out-of-range branches or sections that do not fit in memory.
+***/
+int link_objects(struct object *objs, int count, struct image *image)
+{
+	struct symtab globals, locals;
+	struct arena *strings = NULL;
+	struct symbol *sym;
+	struct objsymbol *osym;
+	struct reloc *rel;
+	int *base = (int*)malloc((2 * count + 1) * sizeof(int)); //text base, data base of every object
+	int i, j, text = 0, data = 0, error = 0, address, pc, offset;
+	unsigned *words, *values, *word;
+	memset(&globals, 0, sizeof(globals));
+	for (i = 0; i < count; i++)
+	{
+		base[2 * i] = TEXT_BASE + 4 * text;
+		base[2 * i + 1] = DATA_BASE + 4 * data;
+		text += objs[i].text_count;
+		data += objs[i].data_count;
+	}
+	if (TEXT_BASE + 4 * text > DATA_BASE || DATA_BASE + 4 * data > MEM_LIMIT)
+	{
+		printf("error: program does not fit in memory (%d text words, %d data words)\n", text, data);
+		free(base);
+		return 1;
+	}
+	words = (unsigned*)malloc((text ? text : 1) * sizeof(unsigned));
+	values = (unsigned*)malloc((data ? data : 1) * sizeof(unsigned));
+	for (i = 0; i < count; i++)
+	{
+		memcpy(words + (base[2 * i] - TEXT_BASE) / 4, objs[i].text, objs[i].text_count * sizeof(unsigned));
+		memcpy(values + (base[2 * i + 1] - DATA_BASE) / 4, objs[i].data, objs[i].data_count * sizeof(unsigned));
+		for (j = 0; j < objs[i].symbol_count; j++)
+		{
+			osym = &objs[i].symbols[j];
+			if (osym->kind != SYM_GLOBAL)
+				continue;
+			sym = symtab_enter(&globals, &strings, osym->name, strlen(osym->name));
+			if (sym->address >= 0)
+			{
+				printf("%s: error: global label '%s' already defined in %s\n", objs[i].name, osym->name, objs[sym->global].name);
+				error = 1;
+				continue;
+			}
+			sym->address = base[2 * i + (osym->section == SECT_DATA)] + osym->offset;
+			sym->global = i;
+		}
+	}
+	for (i = 0; i < count && !error; i++)
+	{
+		memset(&locals, 0, sizeof(locals));
+		for (j = 0; j < objs[i].symbol_count; j++)
+		{
+			osym = &objs[i].symbols[j];
+			if (osym->kind != SYM_EXTERN)
+				symtab_enter(&locals, &strings, osym->name, strlen(osym->name))->address = base[2 * i + (osym->section == SECT_DATA)] + osym->offset;
+		}
+		for (j = 0; j < objs[i].reloc_count; j++)
+		{
+			rel = &objs[i].relocs[j];
+			sym = locals.capacity ? symtab_lookup(&locals, rel->name, strlen(rel->name), hash_string(rel->name, strlen(rel->name))) : NULL;
+			if ((sym == NULL || sym->name == NULL) && globals.capacity)
+				sym = symtab_lookup(&globals, rel->name, strlen(rel->name), hash_string(rel->name, strlen(rel->name)));
+			if (sym == NULL || sym->name == NULL || sym->address < 0)
+			{
+				printf("%s:%d: error: undefined label '%s'\n", objs[i].name, rel->line, rel->name);
+				error = 1;
+				continue;
+			}
+			address = sym->address;
+			if (rel->section == SECT_DATA)
+			{
+				values[(base[2 * i + 1] - DATA_BASE) / 4 + rel->index] = address;
+				continue;
+			}
+			pc = base[2 * i] + 4 * rel->index;
+			word = &words[pc / 4 - TEXT_BASE / 4];
+			if (rel->type == RELOC_J)
+				*word = (*word & 0xFC000000) | ((address >> 2) & 0x3FFFFFF);
+			else if (rel->type == RELOC_HI16)
+				*word = (*word & 0xFFFF0000) | (((address + 0x8000) >> 16) & 0xFFFF);
+			else if (rel->type == RELOC_LO16)
+				*word = (*word & 0xFFFF0000) | (address & 0xFFFF);
+			else
+			{
+				offset = calculate_offset(pc, address);
+				if (offset < -32768 || offset > 32767)
+				{
+					printf("%s:%d: error: branch to '%s' out of range\n", objs[i].name, rel->line, rel->name);
+					error = 1;
+					continue;
+				}
+				*word = (*word & 0xFFFF0000) | (offset & 0xFFFF);
+			}
+		}
+		free(locals.slots);
+	}
+	free(globals.slots);
+	arena_free(strings);
+	free(base);
+	if (error)
+	{
+		free(words);
+		free(values);
+		return 1;
+	}
+	image->text = words;
+	image->text_count = text;
+	image->data = values;
+	image->data_count = data;
+	return 0;
+}
+
+/*** free_object
+*		This function releases everything an object holds.
+***/
+void free_object(struct object *obj)
+{
+	free(obj->text);
+	free(obj->data);
+	free(obj->symbols);
+	free(obj->relocs);
+	arena_free(obj->strings);
+	memset(obj, 0, sizeof(struct object));
+}
@@ -0,0 +1,600 @@
+/*
+ * optimize.c - The peephole optimizer of the MIPS assembler. Runs over the instruction array of one
+ * file after it has been assembled and backpatched, and before it becomes an object: copy propagation,
+ * jump threading, and removal of redundant, dead and unreachable instructions within basic blocks.
+ * Labels, branch offsets and relocations are moved to the compacted array afterwards.
+ * authors: Josiah Nethery
+ */
+
+#include "asm.h"
+
+#define OPT_ROUNDS 8
+#define OPT_THREAD_HOPS 16
+
+#define LEAD_FALL 1	// a block starts after a branch
+#define LEAD_ENTRY 2	// a block starts at a label or branch target
+
+#define VAL_UNKNOWN 0
+#define VAL_CONST 1
+#define VAL_LABEL 2
+
+static const char *RuleName[OPT_RULES] = {
+	"copy propagation (operands)", "jump threading (branches)", "self moves", "branches to next",
+	"redundant values", "dead results", "unreachable code" };
+
+/***
+*		What is known about a register inside a basic block: nothing, a constant, or the address of a label
+*		(loaded by la). copy is another register holding the same value, or -1.
+***/
+struct value
+{
+	int kind;
+	int number;
+	struct token *label;
+	int copy;
+};
+
+/***
+*		The state of one optimization: for every instruction its branch target (an instruction index, or -1
+*		for a target outside the file), its text fixup (or -1), whether and why a basic block starts there
+*		and whether it was removed.
+***/
+struct optimizer
+{
+	struct program *prog;
+	struct opt_stats *stats;
+	int *target;
+	int *fix;
+	char *leader;
+	char *removed;
+	int zero;	// 1 if the file never writes $zero, so it can be taken as 0
+};
+
+/* coprocessor 0 instructions count as branches without a target: they can change the mode or, for eret, the PC */
+static int is_branch(struct instruction *inst)
+{
+	return inst->op == 2 || inst->op == 4 || inst->op == 16;
+}
+
+/*** is_pure
+*		Returns 1 for the instructions that only write a register (no memory, no syscall, no halt).
+***/
+static int is_pure(struct instruction *inst)
+{
+	if (inst->op == 0)
+		return inst->funct == 32 || inst->funct == 34 || inst->funct == 36 || inst->funct == 37 || inst->funct == 42 || inst->funct == 43;
+	return inst->op == 8 || inst->op == 10 || inst->op == 11 || inst->op == 15;
+}
+
+/*** may_halt
+*		Returns 1 for the instructions that can stop the machine: syscall, a load or store of an unaligned
+*		or unmapped address, and the coprocessor 0 instructions, which halt without the MMU.
+***/
+static int may_halt(struct instruction *inst)
+{
+	return (inst->op == 0 && inst->funct == 12) || inst->op == 35 || inst->op == 43 || inst->op == 16;
+}
+
+/*** dest_reg
+*		Returns the register an instruction writes, or -1.
+***/
+static int dest_reg(struct instruction *inst)
+{
+	if (inst->op == 0 && inst->funct != 12)
+		return inst->r3;
+	if (inst->op == 8 || inst->op == 10 || inst->op == 11 || inst->op == 15 || inst->op == 35)
+		return inst->r2;
+	if (inst->op == 16 && inst->r1 == 0) //mfc0
+		return inst->r2;
+	return -1;
+}
+
+/*** source_regs
+*		Stores pointers to the register fields an instruction reads and returns how many there are.
+*		syscall reads registers implicitly and has none.
+***/
+static int source_regs(struct instruction *inst, int **regs)
+{
+	if ((inst->op == 0 && inst->funct != 12) || inst->op == 4 || inst->op == 43)
+	{
+		regs[0] = &inst->r1;
+		regs[1] = &inst->r2;
+		return 2;
+	}
+	if (inst->op == 8 || inst->op == 10 || inst->op == 11 || inst->op == 35)
+	{
+		regs[0] = &inst->r1;
+		return 1;
+	}
+	if (inst->op == 16 && inst->r1 == 4) //mtc0
+	{
+		regs[0] = &inst->r2;
+		return 1;
+	}
+	return 0;
+}
+
+/*** next_kept
+*		Returns the first instruction at or after index that was not removed (count at the end).
+***/
+static int next_kept(struct optimizer *opt, int index)
+{
+	while (index < opt->prog->count && opt->removed[index])
+		index++;
+	return index;
+}
+
+static void remove_instruction(struct optimizer *opt, int index, int rule)
+{
+	opt->removed[index] = 1;
+	opt->stats->count[rule]++;
+}
+
+static int same_value(struct value *a, struct value *b)
+{
+	if (a->kind != b->kind || a->kind == VAL_UNKNOWN)
+		return 0;
+	if (a->kind == VAL_CONST)
+		return a->number == b->number;
+	return a->label->length == b->label->length && strncmp(a->label->start, b->label->start, a->label->length) == 0;
+}
+
+/*** forget
+*		Invalidates what is known about a register that is written, including copies of it.
+***/
+static void forget(struct value *val, int reg)
+{
+	int i;
+	for (i = 0; i < 32; i++)
+	{
+		if (val[i].copy == reg)
+			val[i].copy = -1;
+	}
+	val[reg].kind = VAL_UNKNOWN;
+	val[reg].copy = -1;
+}
+
+static void reset_values(struct optimizer *opt, struct value *val)
+{
+	int i;
+	for (i = 0; i < 32; i++)
+	{
+		val[i].kind = VAL_UNKNOWN;
+		val[i].copy = -1;
+	}
+	if (opt->zero)
+	{
+		val[0].kind = VAL_CONST;
+		val[0].number = 0;
+	}
+}
+
+/*** evaluate
+*		Works out the value a pure instruction writes from the known values of its sources. Sets *copy to the
+*		source register when the instruction only copies it.
+***/
+static void evaluate(struct optimizer *opt, int index, struct value *val, struct value *result, int *copy)
+{
+	struct instruction *inst = &opt->prog->inst[index];
+	struct value *a = &val[inst->r1], *b = &val[inst->r2];
+	int zero_a = a->kind == VAL_CONST && a->number == 0, zero_b = b->kind == VAL_CONST && b->number == 0;
+	result->kind = VAL_UNKNOWN;
+	result->copy = -1;
+	*copy = -1;
+	if (opt->fix[index] >= 0) //half of an la, worked out together with the other half
+		return;
+	if (inst->op == 15)
+	{
+		result->kind = VAL_CONST;
+		result->number = (int)(((unsigned)inst->offset & 0xFFFF) << 16);
+	}
+	else if (inst->op == 8)
+	{
+		if ((short)inst->offset == 0)
+			*copy = inst->r1;
+		else if (a->kind == VAL_CONST)
+		{
+			result->kind = VAL_CONST;
+			result->number = (int)((unsigned)a->number + (unsigned)(short)inst->offset);
+		}
+	}
+	else if (inst->op == 0 && (inst->funct == 32 || inst->funct == 37)) //add, or
+	{
+		if (zero_b)
+			*copy = inst->r1;
+		else if (zero_a)
+			*copy = inst->r2;
+		else if (inst->funct == 37 && inst->r1 == inst->r2)
+			*copy = inst->r1;
+		else if (a->kind == VAL_CONST && b->kind == VAL_CONST)
+		{
+			result->kind = VAL_CONST;
+			result->number = inst->funct == 32 ? (int)((unsigned)a->number + (unsigned)b->number) : (a->number | b->number);
+		}
+	}
+	else if (inst->op == 0 && inst->funct == 34 && zero_b) //sub
+		*copy = inst->r1;
+	else if (inst->op == 0 && inst->funct == 36 && inst->r1 == inst->r2) //and
+		*copy = inst->r1;
+	if (*copy >= 0)
+	{
+		*result = val[*copy];
+		result->copy = *copy;
+	}
+}
+
+/*** load_pair
+*		Recognizes lui rt followed by addi rt, rt in the same block (li and la) and works out the value the
+*		pair loads: a constant, or the address of a label when both halves are relocated against it.
+*		Returns 0 if the instruction at index does not start such a pair.
+***/
+static int load_pair(struct optimizer *opt, int index, struct value *result)
+{
+	struct program *prog = opt->prog;
+	struct instruction *hi = &prog->inst[index], *lo;
+	struct fixup *fhi, *flo;
+	if (hi->op != 15 || index + 1 >= prog->count || opt->leader[index + 1] || opt->removed[index + 1])
+		return 0;
+	lo = &prog->inst[index + 1];
+	if (lo->op != 8 || lo->r1 != hi->r2 || lo->r2 != hi->r2)
+		return 0;
+	result->copy = -1;
+	if (opt->fix[index] < 0 && opt->fix[index + 1] < 0)
+	{
+		result->kind = VAL_CONST;
+		result->number = (int)((((unsigned)hi->offset & 0xFFFF) << 16) + (unsigned)(short)lo->offset);
+		return 1;
+	}
+	if (opt->fix[index] < 0 || opt->fix[index + 1] < 0)
+		return 0;
+	fhi = &prog->fixups[opt->fix[index]];
+	flo = &prog->fixups[opt->fix[index + 1]];
+	if (fhi->type != RELOC_HI16 || flo->type != RELOC_LO16 || fhi->label.length != flo->label.length
+		|| strncmp(fhi->label.start, flo->label.start, fhi->label.length) != 0)
+		return 0;
+	result->kind = VAL_LABEL;
+	result->label = &fhi->label;
+	return 1;
+}
+
+/*** forward_pass
+*		Walks every basic block tracking register values. Sources are replaced by the register they were
+*		copied from (or $zero for a known 0), and instructions that write a register with the value it already
+*		holds are removed.
+***/
+static int forward_pass(struct optimizer *opt)
+{
+	struct program *prog = opt->prog;
+	struct instruction *inst;
+	struct value val[32], result;
+	int *regs[2];
+	int i, j, n, d, copy, changed = 0;
+	for (i = 0; i < prog->count; i++)
+	{
+		if (opt->leader[i])
+			reset_values(opt, val);
+		if (opt->removed[i])
+			continue;
+		inst = &prog->inst[i];
+		n = source_regs(inst, regs);
+		for (j = 0; j < n; j++)
+		{
+			d = *regs[j];
+			if (d != 0 && opt->zero && val[d].kind == VAL_CONST && val[d].number == 0)
+				*regs[j] = 0;
+			else if (val[d].copy >= 0)
+				*regs[j] = val[d].copy;
+			if (*regs[j] != d)
+			{
+				opt->stats->count[OPT_COPY]++;
+				changed = 1;
+			}
+		}
+		if (inst->op == 0 && inst->funct == 12) //syscall: the services write $v0, $a0 and $a1
+		{
+			forget(val, 2);
+			forget(val, 4);
+			forget(val, 5);
+			continue;
+		}
+		d = dest_reg(inst);
+		if (d < 0)
+			continue;
+		if (!is_pure(inst))
+		{
+			forget(val, d);
+			continue;
+		}
+		if (load_pair(opt, i, &result))
+		{
+			if (same_value(&val[d], &result))
+			{
+				remove_instruction(opt, i, OPT_REDUNDANT);
+				remove_instruction(opt, i + 1, OPT_REDUNDANT);
+				changed = 1;
+			}
+			else
+			{
+				forget(val, d);
+				val[d] = result;
+			}
+			i++;
+			continue;
+		}
+		evaluate(opt, i, val, &result, &copy);
+		if (copy == d)
+		{
+			remove_instruction(opt, i, OPT_SELF);
+			changed = 1;
+		}
+		else if (same_value(&val[d], &result) || (copy >= 0 && (val[d].copy == copy || val[copy].copy == d)))
+		{
+			remove_instruction(opt, i, OPT_REDUNDANT);
+			changed = 1;
+		}
+		else
+		{
+			forget(val, d);
+			val[d] = result;
+			if (copy >= 0 && val[copy].copy >= 0)
+				val[d].copy = val[copy].copy;
+		}
+	}
+	return changed;
+}
+
+/*** dead_pass
+*		Walks every basic block backwards and removes pure instructions whose result is overwritten before
+*		it is read. Every register is live at the end of a block and before any instruction that may halt,
+*		since the registers the machine stops with are part of what the program does.
+***/
+static int dead_pass(struct optimizer *opt)
+{
+	struct program *prog = opt->prog;
+	struct instruction *inst;
+	unsigned live = 0xFFFFFFFF;
+	int *regs[2];
+	int i, j, n, d, changed = 0;
+	for (i = prog->count - 1; i >= 0; i--)
+	{
+		if (i + 1 < prog->count && opt->leader[i + 1])
+			live = 0xFFFFFFFF;
+		if (opt->removed[i])
+			continue;
+		inst = &prog->inst[i];
+		if (may_halt(inst))
+		{
+			live = 0xFFFFFFFF;
+			continue;
+		}
+		d = dest_reg(inst);
+		if (d >= 0 && !(live & (1u << d)) && is_pure(inst) && opt->fix[i] < 0)
+		{
+			remove_instruction(opt, i, OPT_DEAD);
+			changed = 1;
+			continue;
+		}
+		if (d >= 0)
+			live &= ~(1u << d);
+		n = source_regs(inst, regs);
+		for (j = 0; j < n; j++)
+			live |= 1u << *regs[j];
+	}
+	return changed;
+}
+
+/*** thread_jumps
+*		Points every branch to a j at the target of that j.
+***/
+static void thread_jumps(struct optimizer *opt)
+{
+	struct program *prog = opt->prog;
+	int i, k, hops, f;
+	for (i = 0; i < prog->count; i++)
+	{
+		if (opt->removed[i] || !is_branch(&prog->inst[i]) || opt->target[i] < 0)
+			continue;
+		for (hops = 0; hops < OPT_THREAD_HOPS; hops++)
+		{
+			k = next_kept(opt, opt->target[i]);
+			if (k == prog->count || k == i || prog->inst[k].op != 2)
+				break;
+			f = opt->fix[k];
+			if (opt->fix[i] < 0)
+			{
+				if (add_fixup(prog, &prog->fixups[f].label, i, RELOC_BEQ, SECT_TEXT))
+					return;
+				opt->fix[i] = prog->fixup_count - 1;
+			}
+			else
+				prog->fixups[opt->fix[i]].label = prog->fixups[f].label;
+			opt->target[i] = opt->target[k];
+			opt->stats->count[OPT_THREAD]++;
+			if (opt->target[i] < 0)
+				break;
+		}
+	}
+}
+
+/*** control_pass
+*		Removes the code that follows a j up to the next block, and branches to the instruction that comes next anyway.
+***/
+static int control_pass(struct optimizer *opt)
+{
+	struct program *prog = opt->prog;
+	int i, j, changed = 0;
+	for (i = prog->count - 1; i >= 0; i--)
+	{
+		if (opt->removed[i] || !is_branch(&prog->inst[i]) || opt->target[i] < 0)
+			continue;
+		if (next_kept(opt, i + 1) == next_kept(opt, opt->target[i]))
+		{
+			remove_instruction(opt, i, OPT_NEXT);
+			changed = 1;
+		}
+	}
+	for (i = 0; i < prog->count; i++)
+	{
+		if (opt->removed[i] || prog->inst[i].op != 2)
+			continue;
+		for (j = i + 1; j < prog->count && opt->leader[j] != LEAD_ENTRY; j++)
+		{
+			if (!opt->removed[j])
+			{
+				remove_instruction(opt, j, OPT_UNREACHABLE);
+				changed = 1;
+			}
+		}
+	}
+	return changed;
+}
+
+/*** find_targets
+*		Works out the branch targets, the text fixups and the basic block leaders of the file, and whether
+*		$zero is ever written.
+***/
+static void find_targets(struct optimizer *opt)
+{
+	struct program *prog = opt->prog;
+	struct instruction *inst;
+	struct symbol *sym;
+	struct fixup *fix;
+	int i, d;
+	opt->zero = 1;
+	for (i = 0; i < prog->count; i++)
+	{
+		inst = &prog->inst[i];
+		opt->target[i] = inst->op == 4 ? i + 1 + inst->offset : -1;
+		opt->fix[i] = -1;
+		d = dest_reg(inst);
+		if (d == 0 && !(inst->op == 0 && inst->r1 == 0 && inst->r2 == 0 && (inst->funct == 32 || inst->funct == 36 || inst->funct == 37)))
+			opt->zero = 0;
+	}
+	for (i = 0; i < prog->fixup_count; i++)
+	{
+		fix = &prog->fixups[i];
+		if (fix->section != SECT_TEXT)
+			continue;
+		opt->fix[fix->index] = i;
+		if (fix->type != RELOC_J && fix->type != RELOC_BEQ)
+			continue;
+		sym = prog->symbols.capacity ? symtab_lookup(&prog->symbols, fix->label.start, fix->label.length, hash_string(fix->label.start, fix->label.length)) : NULL;
+		opt->target[fix->index] = (sym != NULL && sym->name != NULL && sym->address >= 0 && sym->section == SECT_TEXT) ? sym->address / 4 : -1;
+	}
+	memset(opt->leader, 0, prog->count + 1);
+	opt->leader[0] = LEAD_ENTRY;
+	for (i = 0; i < prog->count; i++)
+	{
+		if (is_branch(&prog->inst[i]) && !opt->leader[i + 1])
+			opt->leader[i + 1] = LEAD_FALL;
+		if (opt->target[i] >= 0 && opt->target[i] <= prog->count)
+			opt->leader[opt->target[i]] = LEAD_ENTRY;
+	}
+	for (i = 0; i < prog->symbols.capacity; i++)
+	{
+		sym = &prog->symbols.slots[i];
+		if (sym->name != NULL && sym->address >= 0 && sym->section == SECT_TEXT)
+			opt->leader[sym->address / 4] = LEAD_ENTRY;
+	}
+}
+
+/*** compact
+*		Drops the removed instructions and moves the text labels, the beq offsets within the file and the text
+*		fixups to the new indices. A label of a removed instruction moves to the next one that is kept.
+*		Returns 1 if a branch no longer reaches its target.
+***/
+static int compact(struct optimizer *opt)
+{
+	struct program *prog = opt->prog;
+	struct symbol *sym;
+	struct fixup *fix;
+	int *index = (int*)malloc((prog->count + 1) * sizeof(int));
+	int i, kept = 0, offset, error = 0;
+	for (i = 0; i <= prog->count; i++)
+	{
+		index[i] = kept;
+		if (i < prog->count && !opt->removed[i])
+			kept++;
+	}
+	for (i = 0; i < prog->count; i++)
+	{
+		if (opt->removed[i] || prog->inst[i].op != 4 || opt->fix[i] >= 0)
+			continue;
+		offset = index[opt->target[i]] - index[i] - 1;
+		if (offset < -32768 || offset > 32767)
+			error = 1;
+		prog->inst[i].offset = offset;
+	}
+	for (i = 0; i < prog->symbols.capacity; i++)
+	{
+		sym = &prog->symbols.slots[i];
+		if (sym->name != NULL && sym->address >= 0 && sym->section == SECT_TEXT)
+			sym->address = 4 * index[sym->address / 4];
+	}
+	kept = 0;
+	for (i = 0; i < prog->fixup_count; i++)
+	{
+		fix = &prog->fixups[i];
+		if (fix->section == SECT_TEXT && opt->removed[fix->index])
+			continue;
+		if (fix->section == SECT_TEXT)
+			fix->index = index[fix->index];
+		prog->fixups[kept++] = *fix;
+	}
+	prog->fixup_count = kept;
+	for (i = 0; i < prog->count; i++)
+	{
+		if (!opt->removed[i])
+			prog->inst[index[i]] = prog->inst[i];
+	}
+	prog->count = index[prog->count];
+	free(index);
+	return error;
+}
+
+/*** optimize_program
+*		This function runs the optimizer over an assembled and backpatched file until nothing changes, then
+*		compacts it. The counts of every rule are added to stats. Returns 1 on an error.
+***/
+int optimize_program(struct program *prog, struct opt_stats *stats)
+{
+	struct optimizer opt;
+	int round, changed = 1, error;
+	if (prog->count == 0)
+		return 0;
+	opt.prog = prog;
+	opt.stats = stats;
+	opt.target = (int*)malloc(prog->count * sizeof(int));
+	opt.fix = (int*)malloc(prog->count * sizeof(int));
+	opt.leader = (char*)malloc(prog->count + 1);
+	opt.removed = (char*)calloc(prog->count, 1);
+	find_targets(&opt);
+	thread_jumps(&opt);
+	for (round = 0; round < OPT_ROUNDS && changed; round++)
+	{
+		changed = forward_pass(&opt);
+		changed |= dead_pass(&opt);
+		changed |= control_pass(&opt);
+	}
+	error = compact(&opt);
+	free(opt.target);
+	free(opt.fix);
+	free(opt.leader);
+	free(opt.removed);
+	return error;
+}
+
+/*** print_opt_stats
+*		This function prints how many operands or branches every rule rewrote and how many instructions it removed.
+***/
+void print_opt_stats(struct opt_stats *stats, FILE *output)
+{
+	int i, removed = 0;
+	for (i = 0; i < OPT_RULES; i++)
+	{
+		fprintf(output, "%8d %s\n", stats->count[i], RuleName[i]);
+		if (i >= OPT_SELF)
+			removed += stats->count[i];
+	}
+	fprintf(output, "%8d instructions removed\n", removed);
+}
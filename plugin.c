@@ -0,0 +1,118 @@
+/*
+ * plugin.c - Runtime-loaded analysis plugins (see plugin.h for the ABI). While a plugin is loaded the
+ * simulator steps through the datapath of spimcore.c specialized for the plugin policy bits, whose
+ * hooks in plugin.h call the callbacks between the stages. The bits are set for the kinds of callbacks
+ * (per stage, per basic block, batched events) that the plugins use, so the kinds nobody asked for
+ * cost nothing and a stage without callbacks costs one compare.
+ * authors: Josiah Nethery
+ */
+
+#include <dlfcn.h>
+#include "plugin.h"
+
+struct_plugin_hooks PluginHooks;
+
+static struct_spim_plugin Plugins[PLUGIN_MAX];
+static int PluginCount = 0;
+static int Policy = 0;
+
+void plugin_flush_events(void)
+{
+	if (PluginHooks.buffered > 0)
+		PLUGIN_CALL(PluginHooks.events, events, PluginHooks.buffer, PluginHooks.buffered);
+	PluginHooks.buffered = 0;
+}
+
+void plugin_end_block(void)
+{
+	if (PluginHooks.block_count > 0)
+		PLUGIN_CALL(PluginHooks.block, block, PluginHooks.block_start, PluginHooks.block_count,
+			PluginHooks.block_icount + PluginHooks.block_count);
+	PluginHooks.block_count = 0;
+}
+
+static void add_hook(struct_plugin_hook *hook, struct_spim_plugin *p, int wanted)
+{
+	if (wanted)
+		hook->with[hook->count++] = p;
+}
+
+/*** plugin_load
+*		spec is the file of the plugin, optionally followed by ':' and the arguments given to it.
+***/
+int plugin_load(const char *spec, FILE *err)
+{
+	struct_spim_plugin *p;
+	spim_plugin_init_fn init;
+	char path[4096];
+	const char *args = strchr(spec, ':');
+	size_t length = args != NULL ? (size_t) (args - spec) : strlen(spec);
+	void *handle;
+	int i;
+
+	if (PluginCount == PLUGIN_MAX || length >= sizeof(path))
+	{
+		fprintf(err, "cannot load plugin %s: too many plugins or too long a name\n", spec);
+		return 1;
+	}
+	memcpy(path, spec, length);
+	path[length] = '\0';
+	if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+	{
+		fprintf(err, "cannot load plugin %s: %s\n", path, dlerror());
+		return 1;
+	}
+	*(void **) (&init) = dlsym(handle, SPIM_PLUGIN_ENTRY);
+	p = &Plugins[PluginCount];
+	memset(p, 0, sizeof(*p));
+	p->abi = SPIM_PLUGIN_ABI;
+	if (init == NULL || init(p, args != NULL ? args + 1 : "") != 0)
+	{
+		fprintf(err, "plugin %s: %s\n", path, init == NULL ? "no " SPIM_PLUGIN_ENTRY : "refused to start");
+		dlclose(handle);
+		return 1;
+	}
+	PluginCount++;
+	add_hook(&PluginHooks.fetch, p, p->fetch != NULL);
+	add_hook(&PluginHooks.decode, p, p->decode != NULL);
+	add_hook(&PluginHooks.alu, p, p->alu != NULL);
+	add_hook(&PluginHooks.memory, p, p->memory != NULL);
+	add_hook(&PluginHooks.reg_write, p, p->reg_write != NULL);
+	add_hook(&PluginHooks.pc_update, p, p->pc_update != NULL);
+	add_hook(&PluginHooks.block, p, p->block != NULL);
+	add_hook(&PluginHooks.events, p, p->events != NULL);
+	for (i = 0; i < PluginCount; i++)
+	{
+		p = &Plugins[i];
+		if (p->fetch || p->decode || p->alu || p->memory || p->reg_write || p->pc_update)
+			Policy |= INST_PLUGIN_STAGE;
+		if (p->block)
+			Policy |= INST_PLUGIN_BLOCK;
+		if (p->events)
+			Policy |= INST_PLUGIN_EVENTS;
+	}
+	return 0;
+}
+
+int plugin_active(void)
+{
+	return PluginCount > 0;
+}
+
+int plugin_policy(void)
+{
+	return Policy;
+}
+
+void plugin_finish(FILE *out, const char *prefix)
+{
+	int i;
+
+	plugin_end_block();
+	plugin_flush_events();
+	for (i = 0; i < PluginCount; i++)
+	{
+		if (Plugins[i].finish != NULL)
+			Plugins[i].finish(Plugins[i].data, out, prefix);
+	}
+}
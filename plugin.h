@@ -0,0 +1,205 @@
+#include "spimcore.h"
+#include "instrument.h"
+
+#ifndef PLUGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***
+*		The plugin ABI. A plugin is a shared object, loaded with spimcore -plugin file.so[:args], that
+*		exports spim_plugin_init(). spimcore fills in abi and leaves every callback NULL; the plugin
+*		checks abi, sets the callbacks it wants and its own data, and returns 0 (anything else stops
+*		the simulator). Callbacks left NULL are never called, and when no plugin is loaded the plain
+*		datapath runs. New fields are only ever added at the end, with a new SPIM_PLUGIN_ABI.
+***/
+#define SPIM_PLUGIN_ABI 1
+#define SPIM_PLUGIN_ENTRY "spim_plugin_init"
+
+/* kinds of the batched events */
+#define SPIM_EVENT_LOAD 0	// addr was read, value is the word read
+#define SPIM_EVENT_STORE 1	// addr was written with value
+#define SPIM_EVENT_BRANCH 2	// a taken branch or jump to addr
+#define SPIM_EVENT_SYSCALL 3	// value is the service in $v0
+
+#define SPIM_EVENT_BUFFER 4096	// events per call of events()
+
+typedef struct
+{
+	unsigned kind;
+	unsigned pc;
+	unsigned addr;
+	unsigned value;
+}struct_spim_event;
+
+typedef struct
+{
+	unsigned abi;		// SPIM_PLUGIN_ABI of the simulator
+	void *data;		// passed back to every callback
+
+	/* per instruction, in datapath order; pc is the address of the instruction */
+	void (*fetch)(void *data, unsigned pc, unsigned instruction);
+	void (*decode)(void *data, unsigned pc, unsigned op, unsigned funct, const struct_controls *controls);
+	void (*alu)(void *data, unsigned pc, unsigned result, char zero);
+	void (*memory)(void *data, unsigned pc, unsigned addr, unsigned value, int write);
+	void (*reg_write)(void *data, unsigned pc, unsigned reg, unsigned value);
+	void (*pc_update)(void *data, unsigned pc, unsigned next);
+
+	/* per basic block: count instructions from start ended with a branch, jump, syscall or halt */
+	void (*block)(void *data, unsigned start, unsigned count, unsigned long long icount);
+
+	/* coarse events, delivered SPIM_EVENT_BUFFER at a time instead of one call per instruction */
+	void (*events)(void *data, const struct_spim_event *events, unsigned count);
+
+	/* the run is over: report */
+	void (*finish)(void *data, FILE *out, const char *prefix);
+}struct_spim_plugin;
+
+/* the entry point of a plugin; args is the text after the ':' of -plugin, or "" */
+typedef int (*spim_plugin_init_fn)(struct_spim_plugin *plugin, const char *args);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* simulator side */
+#define PLUGIN_MAX 8
+
+/* the plugins with a callback, so that a stage with none is one compare */
+typedef struct
+{
+	struct_spim_plugin *with[PLUGIN_MAX];
+	int count;
+}struct_plugin_hook;
+
+/* what the plugin hooks of the datapath work on */
+typedef struct
+{
+	struct_plugin_hook fetch, decode, alu, memory, reg_write, pc_update, block, events;
+	unsigned block_start, block_count;
+	unsigned long long block_icount;	// instructions completed before the block
+	struct_spim_event buffer[SPIM_EVENT_BUFFER];
+	unsigned buffered;
+}struct_plugin_hooks;
+
+extern struct_plugin_hooks PluginHooks;
+
+/* load a plugin; returns 1 with a message on err if it cannot be loaded or refuses */
+int plugin_load(const char *spec, FILE *err);
+
+/* 1 once a plugin is loaded */
+int plugin_active(void);
+
+/* the policy bits (INST_PLUGIN_*) of the kinds of callbacks the loaded plugins use */
+int plugin_policy(void);
+
+/* call the block callbacks for the block so far, and start a new one */
+void plugin_end_block(void);
+
+/* deliver the buffered events */
+void plugin_flush_events(void);
+
+/* deliver what is still buffered and let every plugin report */
+void plugin_finish(FILE *out, const char *prefix);
+
+/* call the callback field of every plugin in hook with the arguments */
+#define PLUGIN_CALL(hook, field, ...) \
+	do { int i_; for (i_ = 0; i_ < (hook).count; i_++) (hook).with[i_]->field((hook).with[i_]->data, __VA_ARGS__); } while (0)
+
+/* hooks called by the datapath of spimcore.c, as those of instrument.h; policy is a constant at every
+   call, so the kinds no plugin uses compile to nothing. A block ends after a branch, jump or syscall,
+   and at a halt. */
+static inline void plugin_event(unsigned kind, unsigned pc, unsigned addr, unsigned value)
+{
+	struct_spim_event *e = &PluginHooks.buffer[PluginHooks.buffered++];
+
+	e->kind = kind;
+	e->pc = pc;
+	e->addr = addr;
+	e->value = value;
+	if (PluginHooks.buffered == SPIM_EVENT_BUFFER)
+		plugin_flush_events();
+}
+
+static inline void hook_plugin_begin(int policy, unsigned pc, unsigned long long icount)
+{
+	if ((policy & INST_PLUGIN_BLOCK) && PluginHooks.block_count == 0)
+	{
+		PluginHooks.block_start = pc;
+		PluginHooks.block_icount = icount;
+	}
+}
+
+static inline void hook_plugin_fetch(int policy, unsigned pc, unsigned instruction)
+{
+	if (policy & INST_PLUGIN_STAGE)
+		PLUGIN_CALL(PluginHooks.fetch, fetch, pc, instruction);
+}
+
+static inline void hook_plugin_decode(int policy, unsigned pc, unsigned op, unsigned funct, const struct_controls *controls)
+{
+	if (policy & INST_PLUGIN_STAGE)
+		PLUGIN_CALL(PluginHooks.decode, decode, pc, op, funct, controls);
+}
+
+static inline void hook_plugin_syscall(int policy, unsigned pc, unsigned service)
+{
+	if (policy & INST_PLUGIN_EVENTS)
+		plugin_event(SPIM_EVENT_SYSCALL, pc, 0, service);
+}
+
+static inline void hook_plugin_alu(int policy, unsigned pc, unsigned result, char zero)
+{
+	if (policy & INST_PLUGIN_STAGE)
+		PLUGIN_CALL(PluginHooks.alu, alu, pc, result, zero);
+}
+
+static inline void hook_plugin_memory(int policy, unsigned pc, const struct_controls *controls, unsigned addr,
+	unsigned stored, unsigned loaded)
+{
+	int write = controls->MemWrite == '1';
+
+	if (!write && controls->MemRead != '1')
+		return;
+	if (policy & INST_PLUGIN_STAGE)
+		PLUGIN_CALL(PluginHooks.memory, memory, pc, addr, write ? stored : loaded, write);
+	if (policy & INST_PLUGIN_EVENTS)
+		plugin_event(write ? SPIM_EVENT_STORE : SPIM_EVENT_LOAD, pc, addr, write ? stored : loaded);
+}
+
+static inline void hook_plugin_reg_write(int policy, unsigned pc, const struct_controls *controls, unsigned r2,
+	unsigned r3, unsigned memdata, unsigned ALUresult)
+{
+	if ((policy & INST_PLUGIN_STAGE) && controls->RegWrite == '1')
+		PLUGIN_CALL(PluginHooks.reg_write, reg_write, pc, controls->RegDst == '1' ? r3 : r2,
+			controls->MemtoReg == '1' ? memdata : ALUresult);
+}
+
+static inline void hook_plugin_pc_update(int policy, unsigned pc, unsigned next)
+{
+	if (policy & INST_PLUGIN_STAGE)
+		PLUGIN_CALL(PluginHooks.pc_update, pc_update, pc, next);
+	if ((policy & INST_PLUGIN_EVENTS) && next != pc + 4)
+		plugin_event(SPIM_EVENT_BRANCH, pc, next, 0);
+}
+
+/* an instruction completed; ends says whether it ends the block */
+static inline void hook_plugin_retire(int policy, int ends)
+{
+	if (policy & INST_PLUGIN_BLOCK)
+	{
+		PluginHooks.block_count++;
+		if (ends)
+			plugin_end_block();
+	}
+}
+
+static inline void hook_plugin_halt(int policy, int halt)
+{
+	if ((policy & INST_PLUGIN_BLOCK) && halt)
+		plugin_end_block();
+}
+
+#define PLUGIN
+#endif
@@ -6,6 +6,8 @@
  */
 
 #include "spimcore.h"
+#include "device.h"
+#include "statehash.h"
 
 /* ALU */
 /* 10 Points */
@@ -61,7 +63,7 @@ void ALU(unsigned A,unsigned B,char ALUControl,unsigned *ALUresult,char *Zero)
 ***/
 int instruction_fetch(unsigned PC,unsigned *Mem,unsigned *instruction)
 {
-	if (PC%4 != 0 || PC > 65536) //checking to see if the PC is word-aligned
+	if (PC%4 != 0 || PC >= MEMBYTES) //checking to see if the PC is word-aligned and inside memory
 	{
 		return 1;
 	}
@@ -303,7 +305,12 @@ int ALU_operations(unsigned data1,unsigned data2,unsigned extended_value,unsigne
 {
 	if (ALUSrc == '0') //r-type
 	{
-		if(funct == 32) //add
+		if(ALUOp == '1') //beq, checked first since the low bits of its offset can look like any funct
+		{
+			ALU(data1, data2, '1', ALUresult, Zero);
+			return 0;
+		}
+		else if(funct == 32) //add
 		{
 			ALU(data1, data2, '0', ALUresult, Zero); 
 			return 0; 
@@ -333,11 +340,6 @@ int ALU_operations(unsigned data1,unsigned data2,unsigned extended_value,unsigne
 			ALU(data1, data2, '3', ALUresult, Zero); 
 			return 0;
 		}
-		else if(ALUOp == '1') //beq
-		{
-			ALU(data1, data2, '1', ALUresult, Zero);
-			return 0;
-		}
 		else
 			return 1;
 	}
@@ -386,12 +388,14 @@ int rw_memory(unsigned ALUresult,unsigned data1,char MemWrite,char MemRead,unsig
 {
 	if ((ALUresult % 4) != 0 && (MemWrite == '1' || MemRead == '1'))
 		return 1;
-	if (ALUresult > 65536 && (MemWrite == '1' || MemRead == '1'))
-		return 1;
+	if (ALUresult >= MEMBYTES && (MemWrite == '1' || MemRead == '1'))
+		return bus_access(ALUresult, MemWrite == '1', MemWrite == '1' ? &data1 : memdata, BusClock != NULL ? *BusClock : 0);
 		
 	ALUresult = ALUresult >> 2;
 	if (MemWrite == '1')
 	{
+		if (StateHash != NULL)
+			hash_store(StateHash, ALUresult, Mem[ALUresult], data1);
 		Mem[ALUresult] = data1;
 	}
 	if (MemRead == '1')
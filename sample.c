@@ -0,0 +1,500 @@
+/*
+ * sample.c - Sampled simulation driver for the MIPS simulator. A functional run collects basic block
+ * vectors per interval, k-means groups the intervals into phases, a second functional run takes
+ * page-delta checkpoints in front of the chosen intervals, and worker threads measure those intervals
+ * with the detailed timing model. The whole-program CPI is extrapolated by stratified sampling.
+ * authors: Josiah Nethery
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include "sample.h"
+#include "timing.h"
+#include "sysio.h"
+
+#define CKPT_PAGES (MEMSIZE / CKPT_PAGE_WORDS)
+#define KMEANS_ITERATIONS 50
+
+typedef struct
+{
+	unsigned Reg[REGSIZE + 4];
+	unsigned char changed[CKPT_PAGES];
+	unsigned *pages;
+	struct_sysio_pos input;		// the inputs of the syscalls from here on
+}struct_checkpoint;
+
+typedef struct
+{
+	unsigned long long start;	// index of the first instruction of the interval
+	unsigned long long length;	// instructions in the interval
+	unsigned long long warm;	// instructions of warming in front of the interval
+	int cluster;
+	struct_checkpoint ckpt;
+	unsigned long long cycles;
+	unsigned long long insts;
+}struct_sample;
+
+typedef struct
+{
+	const struct_sample_config *cfg;
+	const unsigned *Mem0;
+	struct_sample *samples;
+	int count;
+	int next;
+	pthread_mutex_t lock;
+}struct_workqueue;
+
+static unsigned Seed = 12345;
+
+static unsigned next_random(void)
+{
+	Seed = Seed * 1103515245 + 12345;
+	return Seed >> 8;
+}
+
+/*** is_control
+*		Returns 1 if the instruction at pc ends a basic block (j or beq).
+***/
+static int is_control(unsigned *Mem, unsigned pc)
+{
+	unsigned op;
+
+	if (pc % 4 != 0 || pc >= MEMBYTES)
+		return 0;
+	op = Mem[pc >> 2] >> 26;
+	return op == 2 || op == 4;
+}
+
+static unsigned bbv_bucket(unsigned pc)
+{
+	return ((pc >> 2) * 2654435761u >> 16) % BBV_DIM;
+}
+
+/*** collect_bbvs
+*		Fast-forwards through the program with step and counts, for every interval, the instructions
+*		executed in each basic block (hashed by its leader PC into BBV_DIM buckets).
+*		Returns the number of instructions executed; *rows receives one BBV per interval.
+***/
+static unsigned long long collect_bbvs(const struct_sample_config *cfg, unsigned *Mem, unsigned *Reg,
+	int *Halt, void (*step)(void), unsigned **rows, int *intervals)
+{
+	unsigned *bbv = NULL;
+	unsigned long long n = 0, len = 0;
+	unsigned leader = Reg[REGSIZE];
+	int cur = 0, cap = 0, ctrl;
+
+	while (!*Halt && n < cfg->max_insts)
+	{
+		if (cur >= cap)
+		{
+			cap = cap ? cap * 2 : 64;
+			bbv = (unsigned *) realloc(bbv, (size_t) cap * BBV_DIM * sizeof(unsigned));
+			memset(bbv + (size_t) cur * BBV_DIM, 0, (size_t) (cap - cur) * BBV_DIM * sizeof(unsigned));
+		}
+		ctrl = is_control(Mem, Reg[REGSIZE]);
+		step();
+		if (*Halt)
+			break;
+		n++;
+		len++;
+		if (ctrl)
+		{
+			bbv[cur * BBV_DIM + bbv_bucket(leader)] += len;
+			leader = Reg[REGSIZE];
+			len = 0;
+		}
+		if (n % cfg->interval == 0)
+		{
+			//a block straddling the boundary is split between the two intervals
+			bbv[cur * BBV_DIM + bbv_bucket(leader)] += len;
+			len = 0;
+			cur++;
+		}
+	}
+	if (n % cfg->interval != 0)
+	{
+		bbv[cur * BBV_DIM + bbv_bucket(leader)] += len;
+		cur++;
+	}
+	*rows = bbv;
+	*intervals = cur;
+	return n;
+}
+
+static double distance(const double *a, const double *b)
+{
+	double d = 0;
+	int i;
+
+	for (i = 0; i < BBV_DIM; i++)
+		d += (a[i] - b[i]) * (a[i] - b[i]);
+	return d;
+}
+
+/*** kmeans
+*		Groups the normalized BBVs into k phases (k-means++ seeding, Lloyd iterations).
+***/
+static void kmeans(const double *vec, int n, int k, int *assign, double *cent)
+{
+	double *best = (double *) malloc(n * sizeof(double));
+	double total, pick, d;
+	int *size = (int *) malloc(k * sizeof(int));
+	int i, j, c, it, moved;
+
+	memcpy(cent, vec + (next_random() % n) * BBV_DIM, BBV_DIM * sizeof(double));
+	for (i = 0; i < n; i++)
+		best[i] = distance(vec + i * BBV_DIM, cent);
+	for (c = 1; c < k; c++)
+	{
+		total = 0;
+		for (i = 0; i < n; i++)
+			total += best[i];
+		pick = total * (next_random() % 1000000) / 1000000.0;
+		for (i = 0; i < n - 1 && pick >= best[i]; i++)
+			pick -= best[i];
+		memcpy(cent + c * BBV_DIM, vec + i * BBV_DIM, BBV_DIM * sizeof(double));
+		for (i = 0; i < n; i++)
+		{
+			d = distance(vec + i * BBV_DIM, cent + c * BBV_DIM);
+			if (d < best[i])
+				best[i] = d;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		assign[i] = -1;
+	for (it = 0; it < KMEANS_ITERATIONS; it++)
+	{
+		moved = 0;
+		for (i = 0; i < n; i++)
+		{
+			c = 0;
+			for (j = 1; j < k; j++)
+				if (distance(vec + i * BBV_DIM, cent + j * BBV_DIM) < distance(vec + i * BBV_DIM, cent + c * BBV_DIM))
+					c = j;
+			if (assign[i] != c)
+			{
+				assign[i] = c;
+				moved = 1;
+			}
+		}
+		if (!moved)
+			break;
+		memset(cent, 0, k * BBV_DIM * sizeof(double));
+		memset(size, 0, k * sizeof(int));
+		for (i = 0; i < n; i++)
+		{
+			size[assign[i]]++;
+			for (j = 0; j < BBV_DIM; j++)
+				cent[assign[i] * BBV_DIM + j] += vec[i * BBV_DIM + j];
+		}
+		for (c = 0; c < k; c++)
+			for (j = 0; j < BBV_DIM && size[c]; j++)
+				cent[c * BBV_DIM + j] /= size[c];
+	}
+	free(best);
+	free(size);
+}
+
+/*** choose_samples
+*		Picks up to per_cluster intervals from every phase: the interval closest to the centroid,
+*		then members spread evenly over the run. Returns the number of samples.
+***/
+static int choose_samples(const struct_sample_config *cfg, const double *vec, const int *assign, const double *cent,
+	int n, int k, unsigned long long total, struct_sample *samples)
+{
+	int *members = (int *) malloc(n * sizeof(int));
+	int count = 0, first, m, c, i, j, s, pick, nearest;
+
+	for (c = 0; c < k; c++)
+	{
+		first = count;
+		m = 0;
+		nearest = -1;
+		for (i = 0; i < n; i++)
+		{
+			if (assign[i] != c)
+				continue;
+			members[m++] = i;
+			if (nearest < 0 || distance(vec + i * BBV_DIM, cent + c * BBV_DIM) < distance(vec + nearest * BBV_DIM, cent + c * BBV_DIM))
+				nearest = i;
+		}
+		for (s = 0; s < cfg->per_cluster && s < m; s++)
+		{
+			pick = (s == 0) ? nearest : members[(long long) s * m / cfg->per_cluster];
+			for (j = first; j < count; j++)
+				if (samples[j].start == (unsigned long long) pick * cfg->interval)
+					break;
+			if (j < count)
+				continue;
+			memset(&samples[count], 0, sizeof(struct_sample));
+			samples[count].start = (unsigned long long) pick * cfg->interval;
+			samples[count].length = (pick == n - 1) ? total - samples[count].start : cfg->interval;
+			samples[count].warm = samples[count].start < cfg->warmup ? samples[count].start : cfg->warmup;
+			samples[count].cluster = c;
+			count++;
+		}
+	}
+	free(members);
+	return count;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	const struct_sample *x = (const struct_sample *) a, *y = (const struct_sample *) b;
+	unsigned long long px = x->start - x->warm, py = y->start - y->warm;
+
+	return (px > py) - (px < py);
+}
+
+/*** take_checkpoint
+*		Saves the registers and only those pages of memory that differ from the initial image. Only the
+*		pages written since the image, touched in written, are compared.
+***/
+static void take_checkpoint(struct_checkpoint *ckpt, const unsigned *Mem, const unsigned *Mem0, const unsigned *Reg,
+	const struct_hash *written)
+{
+	int p, count = 0;
+
+	memcpy(ckpt->Reg, Reg, sizeof(ckpt->Reg));
+	sysio_mark(&ckpt->input);
+	for (p = 0; p < CKPT_PAGES; p++)
+	{
+		ckpt->changed[p] = hash_touched(written, p) && memcmp(Mem + p * CKPT_PAGE_WORDS, Mem0 + p * CKPT_PAGE_WORDS, CKPT_PAGE_WORDS * sizeof(unsigned)) != 0;
+		count += ckpt->changed[p];
+	}
+	ckpt->pages = (unsigned *) malloc((count ? count : 1) * CKPT_PAGE_WORDS * sizeof(unsigned));
+	for (p = 0, count = 0; p < CKPT_PAGES; p++)
+	{
+		if (ckpt->changed[p])
+			memcpy(ckpt->pages + CKPT_PAGE_WORDS * count++, Mem + p * CKPT_PAGE_WORDS, CKPT_PAGE_WORDS * sizeof(unsigned));
+	}
+}
+
+static void restore_checkpoint(const struct_checkpoint *ckpt, unsigned *Mem, const unsigned *Mem0, unsigned *Reg)
+{
+	int p, count = 0;
+
+	memcpy(Mem, Mem0, MEMSIZE * sizeof(unsigned));
+	for (p = 0; p < CKPT_PAGES; p++)
+	{
+		if (ckpt->changed[p])
+			memcpy(Mem + p * CKPT_PAGE_WORDS, ckpt->pages + CKPT_PAGE_WORDS * count++, CKPT_PAGE_WORDS * sizeof(unsigned));
+	}
+	memcpy(Reg, ckpt->Reg, sizeof(ckpt->Reg));
+}
+
+/*** measure_worker
+*		Worker thread: takes samples off the queue, restores each checkpoint into private memory,
+*		warms the caches and predictor and then times the interval in detail. Syscalls replay the
+*		inputs of the functional run from the checkpoint's place in the log, printing nothing.
+***/
+static void *measure_worker(void *arg)
+{
+	struct_workqueue *queue = (struct_workqueue *) arg;
+	unsigned *Mem = (unsigned *) malloc(MEMSIZE * sizeof(unsigned));
+	unsigned Reg[REGSIZE + 4];
+	struct_timing *tm = (struct_timing *) malloc(sizeof(struct_timing));
+	struct_sample *s;
+	struct_sysio_cursor input;
+	unsigned long long i;
+	int halt;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&queue->lock);
+		s = queue->next < queue->count ? &queue->samples[queue->next++] : NULL;
+		pthread_mutex_unlock(&queue->lock);
+		if (s == NULL)
+			break;
+		restore_checkpoint(&s->ckpt, Mem, queue->Mem0, Reg);
+		sysio_cursor(&input, &s->ckpt.input);
+		timing_init(tm);
+		for (i = 0, halt = 0; i < s->warm && !halt; i++)
+			halt = timing_step(tm, Mem, Reg, 0, sysio_replay, &input);
+		for (i = 0; i < s->length && !halt; i++)
+			halt = timing_step(tm, Mem, Reg, 1, sysio_replay, &input);
+		s->cycles = tm->cycles;
+		s->insts = tm->insts;
+	}
+	free(tm);
+	free(Mem);
+	return NULL;
+}
+
+/*** sample_run
+*		Drives the sampled simulation on the machine given by Mem/Reg/Halt, stepping it with step,
+*		and prints the per-phase CPIs and the extrapolated whole-program CPI with a 95% confidence interval.
+*		Returns 0 on success and 1 if the program executed no instructions.
+***/
+int sample_run(const struct_sample_config *cfg, unsigned *Mem, unsigned *Reg, int *Halt,
+	void (*step)(void), FILE *out, const char *prefix)
+{
+	unsigned *Mem0 = (unsigned *) malloc(MEMSIZE * sizeof(unsigned));
+	unsigned Reg0[REGSIZE + 4];
+	unsigned *bbv;
+	unsigned long long total, n, weight_insts, sum;
+	double *vec, *cent, *weight, *mean, *var, cpi = 0, v = 0, pooled = 0, s2, row;
+	int intervals, k, count, i, j, c, pooled_n = 0;
+	int *assign, *measured, *size;
+	struct_sample *samples;
+	struct_workqueue queue;
+	pthread_t *threads;
+	struct_sysio_pos input;
+	struct_hash written;
+
+	memcpy(Mem0, Mem, MEMSIZE * sizeof(unsigned));
+	memcpy(Reg0, Reg, sizeof(Reg0));
+	sysio_mark(&input);
+
+	total = collect_bbvs(cfg, Mem, Reg, Halt, step, &bbv, &intervals);
+	if (total == 0)
+	{
+		fprintf(out, "%s sample: no instructions executed\n", prefix);
+		free(bbv);
+		free(Mem0);
+		return 1;
+	}
+
+	vec = (double *) malloc((size_t) intervals * BBV_DIM * sizeof(double));
+	for (i = 0; i < intervals; i++)
+	{
+		for (j = 0, sum = 0; j < BBV_DIM; j++)
+			sum += bbv[i * BBV_DIM + j];
+		for (j = 0; j < BBV_DIM; j++)
+			vec[i * BBV_DIM + j] = sum ? (double) bbv[i * BBV_DIM + j] / sum : 0;
+	}
+	k = cfg->clusters < intervals ? cfg->clusters : intervals;
+	assign = (int *) malloc(intervals * sizeof(int));
+	cent = (double *) malloc(k * BBV_DIM * sizeof(double));
+	kmeans(vec, intervals, k, assign, cent);
+
+	samples = (struct_sample *) malloc((size_t) k * cfg->per_cluster * sizeof(struct_sample));
+	count = choose_samples(cfg, vec, assign, cent, intervals, k, total, samples);
+	qsort(samples, count, sizeof(struct_sample), compare_samples);
+
+	//second functional pass: fast-forward again, with the guest inputs of the first pass
+	//replayed, and checkpoint in front of every chosen interval
+	memcpy(Mem, Mem0, MEMSIZE * sizeof(unsigned));
+	memcpy(Reg, Reg0, sizeof(Reg0));
+	*Halt = 0;
+	sysio_rewind(&input);
+	hash_init(&written, Mem);
+	hash_untouch(&written);
+	StateHash = &written;
+	for (n = 0, i = 0; i < count && !*Halt; )
+	{
+		if (n == samples[i].start - samples[i].warm)
+		{
+			take_checkpoint(&samples[i++].ckpt, Mem, Mem0, Reg, &written);
+			continue;
+		}
+		step();
+		n++;
+	}
+	StateHash = NULL;
+
+	queue.cfg = cfg;
+	queue.Mem0 = Mem0;
+	queue.samples = samples;
+	queue.count = count;
+	queue.next = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+	threads = (pthread_t *) malloc(cfg->threads * sizeof(pthread_t));
+	for (i = 0; i < cfg->threads; i++)
+		pthread_create(&threads[i], NULL, measure_worker, &queue);
+	for (i = 0; i < cfg->threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&queue.lock);
+
+	//stratified estimate: every phase is a stratum weighted by its share of the instructions
+	weight = (double *) calloc(k, sizeof(double));
+	mean = (double *) calloc(k, sizeof(double));
+	var = (double *) calloc(k, sizeof(double));
+	measured = (int *) calloc(k, sizeof(int));
+	size = (int *) calloc(k, sizeof(int));
+	for (i = 0; i < intervals; i++)
+	{
+		weight_insts = (i == intervals - 1) ? total - (unsigned long long) i * cfg->interval : cfg->interval;
+		weight[assign[i]] += (double) weight_insts / total;
+		size[assign[i]]++;
+	}
+	for (i = 0; i < count; i++)
+	{
+		c = samples[i].cluster;
+		mean[c] += samples[i].insts ? (double) samples[i].cycles / samples[i].insts : 0;
+		measured[c]++;
+	}
+	for (c = 0; c < k; c++)
+		if (measured[c])
+			mean[c] /= measured[c];
+	for (i = 0; i < count; i++)
+	{
+		c = samples[i].cluster;
+		row = samples[i].insts ? (double) samples[i].cycles / samples[i].insts : 0;
+		var[c] += (row - mean[c]) * (row - mean[c]);
+	}
+	for (c = 0; c < k; c++)
+	{
+		if (measured[c] > 1)
+		{
+			pooled += var[c];
+			pooled_n += measured[c] - 1;
+			var[c] /= measured[c] - 1;
+		}
+	}
+	pooled = pooled_n ? pooled / pooled_n : 0;
+
+	fprintf(out, "%s sample: %llu instructions, %d intervals of %llu, %d phases, %d samples, %d threads\n",
+		prefix, total, intervals, cfg->interval, k, count, cfg->threads);
+	for (c = 0; c < k; c++)
+	{
+		s2 = measured[c] > 1 ? var[c] : pooled;
+		if (measured[c])
+			v += weight[c] * weight[c] * s2 / measured[c] * (1.0 - (double) measured[c] / size[c]);
+		cpi += weight[c] * mean[c];
+		fprintf(out, "%s sample: phase %d  weight %.4f  intervals %d  measured %d  cpi %.4f\n",
+			prefix, c, weight[c], size[c], measured[c], mean[c]);
+	}
+	fprintf(out, "%s sample: estimated cpi %.4f +/- %.4f (95%%), %.0f cycles\n",
+		prefix, cpi, 1.96 * sqrt(v), cpi * total);
+
+	for (i = 0; i < count; i++)
+		free(samples[i].ckpt.pages);
+	free(samples);
+	free(threads);
+	free(weight);
+	free(mean);
+	free(var);
+	free(measured);
+	free(size);
+	free(assign);
+	free(cent);
+	free(vec);
+	free(bbv);
+	free(Mem0);
+	return 0;
+}
+
+/*** sample_detailed
+*		Runs the timing model over the whole program on a copy of the machine and prints the exact CPI.
+***/
+int sample_detailed(const struct_sample_config *cfg, unsigned *Mem, unsigned *Reg, FILE *out, const char *prefix)
+{
+	unsigned *Mem1 = (unsigned *) malloc(MEMSIZE * sizeof(unsigned));
+	unsigned Reg1[REGSIZE + 4];
+	struct_timing *tm = (struct_timing *) malloc(sizeof(struct_timing));
+
+	memcpy(Mem1, Mem, MEMSIZE * sizeof(unsigned));
+	memcpy(Reg1, Reg, sizeof(Reg1));
+	timing_init(tm);
+	while (tm->insts < cfg->max_insts && !timing_step(tm, Mem1, Reg1, 1, NULL, NULL))
+		;
+	fprintf(out, "%s detailed: %llu instructions, %llu cycles, cpi %.4f\n",
+		prefix, tm->insts, tm->cycles, tm->insts ? (double) tm->cycles / tm->insts : 0.0);
+	fprintf(out, "%s detailed: icache misses %llu, dcache misses %llu, mispredicts %llu, load stalls %llu\n",
+		prefix, tm->icache_misses, tm->dcache_misses, tm->mispredicts, tm->load_stalls);
+	free(tm);
+	free(Mem1);
+	return 0;
+}
@@ -0,0 +1,31 @@
+#include "spimcore.h"
+#include "statehash.h"
+
+#ifndef SAMPLE
+
+/* dimension of the basic block vectors collected per interval */
+#define BBV_DIM 32
+
+/* granularity of the page-delta checkpoints, in words: the pages of the state hash, whose touched
+   pages are the ones compared */
+#define CKPT_PAGE_WORDS HASH_PAGE_WORDS
+
+typedef struct
+{
+	unsigned long long interval;	// instructions per interval
+	unsigned long long max_insts;	// stop the functional run after this many instructions
+	unsigned long long warmup;	// instructions of cache/predictor warming before a sample
+	int clusters;			// number of phases (k of the k-means over the BBVs)
+	int per_cluster;		// intervals measured in detail per phase
+	int threads;			// detailed timing worker threads
+}struct_sample_config;
+
+/* sampled simulation: fast-forward with step, measure chosen intervals with the timing model */
+int sample_run(const struct_sample_config *cfg, unsigned *Mem, unsigned *Reg, int *Halt,
+	void (*step)(void), FILE *out, const char *prefix);
+
+/* run the detailed timing model over the whole program, for validating the estimate */
+int sample_detailed(const struct_sample_config *cfg, unsigned *Mem, unsigned *Reg, FILE *out, const char *prefix);
+
+#define SAMPLE
+#endif
@@ -0,0 +1,246 @@
+/*
+ * serve.c - Resident simulation server. spimcore -serve listens on a Unix-domain socket and runs the
+ * jobs sent to it on a pool of worker threads, each with a machine that stays allocated between jobs.
+ * Loaded images are kept once per process by shared.c, keyed by a hash of their words, as the memory a
+ * job starts from, so that running an image again costs one copy of the memory and no parsing. The
+ * protocol is in serve.h.
+ * authors: Josiah Nethery
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "serve.h"
+#include "fast.h"
+#include "sysio.h"
+#include "shared.h"
+#include "fnv.h"
+
+#define SERVE_BACKLOG 64
+#define SERVE_QUEUE 256
+
+typedef struct
+{
+	unsigned *Mem;
+	unsigned Reg[REGSIZE + 4];
+	unsigned *words;		// image being received
+	unsigned regs[2 * (REGSIZE + 4)];
+	char console[SERVE_CONSOLE_LIMIT];
+	unsigned console_bytes;
+}struct_worker;
+
+static int Queue[SERVE_QUEUE];
+static int QueueHead, QueueCount;
+static pthread_mutex_t QueueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t QueueFilled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t QueueDrained = PTHREAD_COND_INITIALIZER;
+
+static int read_full(int fd, void *buf, size_t size)
+{
+	char *p = (char *) buf;
+	ssize_t n;
+
+	while (size > 0)
+	{
+		if ((n = read(fd, p, size)) <= 0)
+			return 1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t size)
+{
+	const char *p = (const char *) buf;
+	ssize_t n;
+
+	while (size > 0)
+	{
+		if ((n = write(fd, p, size)) <= 0)
+			return 1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/*** serve_syscall
+*		Syscalls of a job: printing goes to the job's console, exit halts, and so does everything
+*		that would read the host.
+***/
+static int serve_syscall(void *arg, unsigned *Reg, unsigned *Mem, unsigned long long icount)
+{
+	struct_worker *w = (struct_worker *) arg;
+	int n, room = SERVE_CONSOLE_LIMIT - w->console_bytes;
+
+	if (Reg[2] == SYS_PRINT_INT)
+	{
+		if (room > 0)
+		{
+			n = snprintf(w->console + w->console_bytes, room, "%d", (int) Reg[4]);
+			w->console_bytes += n < room ? n : room - 1;
+		}
+		return 0;
+	}
+	if (Reg[2] == SYS_PRINT_CHAR)
+	{
+		if (w->console_bytes < SERVE_CONSOLE_LIMIT)
+			w->console[w->console_bytes++] = (char) Reg[4];
+		return 0;
+	}
+	return 1;
+}
+
+/*** serve_job
+*		Reads the rest of one job after its request, runs it and replies. Returns 1 if the connection
+*		has to be closed.
+***/
+static int serve_job(struct_worker *w, int fd, const struct_serve_request *req)
+{
+	struct_serve_reply reply;
+	struct_shared *img;
+	struct timespec start, stop;
+	unsigned long long key = req->image;
+	unsigned i, words = req->text_words + req->data_words;
+	int halt;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = SERVE_MAGIC;
+	if (req->text_words > MEMSIZE - (PCINIT >> 2) || req->data_words > MEMSIZE - (GPINIT >> 2)
+		|| req->reg_count > REGSIZE + 4 || (req->mem_from & 3) || req->mem_from >= MEMBYTES
+		|| req->mem_words > (MEMBYTES - req->mem_from) / 4)
+	{
+		reply.status = SERVE_BAD_REQUEST;
+		write_full(fd, &reply, sizeof(reply));
+		return 1;
+	}
+	if ((req->flags & SERVE_IMAGE) && read_full(fd, w->words, words * sizeof(unsigned)))
+		return 1;
+	if (read_full(fd, w->regs, req->reg_count * 2 * sizeof(unsigned)))
+		return 1;
+	for (i = 0; i < req->reg_count; i++)
+	{
+		if (w->regs[2 * i] >= REGSIZE + 4)
+		{
+			reply.status = SERVE_BAD_REQUEST;
+			write_full(fd, &reply, sizeof(reply));
+			return 1;
+		}
+	}
+	if (req->flags & SERVE_IMAGE)
+	{
+		key = hash_bytes(&req->text_words, 2 * sizeof(unsigned), 0);
+		key = hash_bytes(w->words, words * sizeof(unsigned), key);
+		img = shared_load(key, w->words, req->text_words, w->words + req->text_words, req->data_words);
+	}
+	else
+		img = shared_find(key);
+	reply.image = key;
+	if (img == NULL)
+	{
+		reply.status = SERVE_UNKNOWN_IMAGE;
+		return write_full(fd, &reply, sizeof(reply));
+	}
+
+	memcpy(w->Mem, img->Mem, MEMBYTES);
+	shared_release(img);
+	memset(w->Reg, 0, sizeof(w->Reg));
+	w->Reg[REGSIZE] = PCINIT;
+	w->Reg[29] = SPINIT;
+	w->Reg[28] = GPINIT;
+	for (i = 0; i < req->reg_count; i++)
+		w->Reg[w->regs[2 * i]] = w->regs[2 * i + 1];
+	w->console_bytes = 0;
+	halt = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fast_run(w->Mem, w->Reg, &halt, &reply.insts, req->max_insts ? req->max_insts : ~0ULL, serve_syscall, w);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	reply.run_ns = (stop.tv_sec - start.tv_sec) * 1000000000ULL + stop.tv_nsec - start.tv_nsec;
+	reply.halted = halt;
+	reply.reg_count = (req->flags & SERVE_OUT_REGS) ? REGSIZE + 4 : 0;
+	reply.mem_words = (req->flags & SERVE_OUT_MEM) ? req->mem_words : 0;
+	reply.console_bytes = (req->flags & SERVE_OUT_CONSOLE) ? w->console_bytes : 0;
+	return write_full(fd, &reply, sizeof(reply))
+		|| write_full(fd, w->Reg, reply.reg_count * sizeof(unsigned))
+		|| write_full(fd, w->Mem + (req->mem_from >> 2), reply.mem_words * sizeof(unsigned))
+		|| write_full(fd, w->console, reply.console_bytes);
+}
+
+/*** serve_worker
+*		Worker thread: takes connections off the queue and serves their jobs one after the other
+*		until the client closes the connection.
+***/
+static void *serve_worker(void *arg)
+{
+	struct_worker *w = (struct_worker *) malloc(sizeof(struct_worker));
+	struct_serve_request req;
+	int fd;
+
+	(void) arg;
+	w->Mem = (unsigned *) malloc(MEMBYTES);
+	w->words = (unsigned *) malloc(2 * MEMBYTES);
+	for (;;)
+	{
+		pthread_mutex_lock(&QueueLock);
+		while (QueueCount == 0)
+			pthread_cond_wait(&QueueFilled, &QueueLock);
+		fd = Queue[QueueHead];
+		QueueHead = (QueueHead + 1) % SERVE_QUEUE;
+		QueueCount--;
+		pthread_cond_signal(&QueueDrained);
+		pthread_mutex_unlock(&QueueLock);
+
+		while (!read_full(fd, &req, sizeof(req)) && req.magic == SERVE_MAGIC)
+		{
+			if (serve_job(w, fd, &req))
+				break;
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+int serve_run(const char *path, int threads, FILE *out, const char *prefix)
+{
+	struct sockaddr_un addr;
+	pthread_t thread;
+	int listener, fd, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path) || (listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return 1;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, SERVE_BACKLOG) != 0)
+	{
+		close(listener);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < threads; i++)
+	{
+		if (pthread_create(&thread, NULL, serve_worker, NULL) != 0)
+			break;
+		pthread_detach(thread);
+	}
+	fprintf(out, "%s serving on %s with %d threads\n", prefix, path, i);
+	fflush(out);
+	for (;;)
+	{
+		if ((fd = accept(listener, NULL, NULL)) < 0)
+			continue;
+		pthread_mutex_lock(&QueueLock);
+		while (QueueCount == SERVE_QUEUE)
+			pthread_cond_wait(&QueueDrained, &QueueLock);
+		Queue[(QueueHead + QueueCount++) % SERVE_QUEUE] = fd;
+		pthread_cond_signal(&QueueFilled);
+		pthread_mutex_unlock(&QueueLock);
+	}
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include "spimcore.h"
+
+#ifndef SERVE
+
+/***
+*		Protocol of spimcore -serve. A client connects to the Unix-domain socket and sends any number of
+*		jobs, each a struct_serve_request followed by
+*			text_words words of text, loaded at PCINIT, and data_words words of data, loaded at GPINIT
+*				(only with SERVE_IMAGE; without it the image given by the key runs again). The words
+*				sent are always the ones run, even if a cached image has the same key
+*			reg_count pairs of words: register index (0 to REGSIZE + 3) and initial value
+*		and gets back a struct_serve_reply followed by
+*			reg_count words: all the registers (SERVE_OUT_REGS)
+*			mem_words words of memory from mem_from (SERVE_OUT_MEM)
+*			console_bytes bytes printed by the print_int and print_char syscalls (SERVE_OUT_CONSOLE)
+*		All numbers are in host byte order. The other registers start as after Init() in spimcore.
+*		Jobs read no input: read, open and time syscalls halt the machine.
+***/
+#define SERVE_MAGIC 0x314A5053		// "SPJ1"
+
+/* request flags */
+#define SERVE_IMAGE 1			// an image follows the request
+#define SERVE_OUT_REGS 2
+#define SERVE_OUT_MEM 4
+#define SERVE_OUT_CONSOLE 8
+
+/* reply status */
+#define SERVE_OK 0
+#define SERVE_BAD_REQUEST 1		// the connection is closed after this reply
+#define SERVE_UNKNOWN_IMAGE 2		// no image with that key is cached: send it again with SERVE_IMAGE
+
+#define SERVE_CONSOLE_LIMIT 65536	// console bytes kept per job
+
+typedef struct
+{
+	unsigned magic;
+	unsigned flags;
+	unsigned long long image;	// key of the image to run again (without SERVE_IMAGE)
+	unsigned long long max_insts;	// run limit, 0 for none
+	unsigned text_words;
+	unsigned data_words;
+	unsigned reg_count;
+	unsigned mem_from;		// byte address, word aligned
+	unsigned mem_words;
+	unsigned reserved;
+}struct_serve_request;
+
+typedef struct
+{
+	unsigned magic;
+	unsigned status;
+	unsigned long long image;	// key of the image, to run it again without sending it
+	unsigned long long insts;	// instructions completed
+	unsigned long long run_ns;	// time spent simulating
+	unsigned halted;
+	unsigned reg_count;
+	unsigned mem_words;
+	unsigned console_bytes;
+}struct_serve_reply;
+
+/* serve jobs on the socket at path with threads worker threads until the process is killed;
+   returns 1 if the socket cannot be set up */
+int serve_run(const char *path, int threads, FILE *out, const char *prefix);
+
+#define SERVE
+#endif
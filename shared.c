@@ -0,0 +1,138 @@
+/*
+ * shared.c - Program images shared by every machine of a process. An image is written once into an
+ * in-memory file, and a machine's memory is a private mapping of that file: the kernel shares the
+ * pages until the machine writes one, and then copies that page only. A machine's own footprint is
+ * the pages it has written, and mapping the file again takes it back to the loaded image.
+ * authors: Josiah Nethery
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "shared.h"
+
+static struct_shared Images[SHARED_MAX];
+static int ImagesReady = 0;
+static unsigned long long Clock;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the cached image with key, or NULL; with text, only an image holding exactly these words, since
+   keys can collide. Called with the lock held */
+static struct_shared *lookup(unsigned long long key, const unsigned *text, size_t text_words,
+	const unsigned *data, size_t data_words)
+{
+	struct_shared *img;
+	int i;
+
+	if (!ImagesReady)
+	{
+		for (i = 0; i < SHARED_MAX; i++)
+			Images[i].fd = -1;
+		ImagesReady = 1;
+	}
+	for (i = 0; i < SHARED_MAX; i++)
+	{
+		img = &Images[i];
+		if (img->fd < 0 || img->key != key)
+			continue;
+		if (text != NULL && (img->text_words != text_words || img->data_words != data_words
+			|| memcmp(img->Mem + (PCINIT >> 2), text, text_words * sizeof(unsigned)) != 0
+			|| memcmp(img->Mem + (GPINIT >> 2), data, data_words * sizeof(unsigned)) != 0))
+			continue;
+		img->refs++;
+		img->used = ++Clock;
+		return img;
+	}
+	return NULL;
+}
+
+struct_shared *shared_find(unsigned long long key)
+{
+	struct_shared *img;
+
+	pthread_mutex_lock(&Lock);
+	img = lookup(key, NULL, 0, NULL, 0);
+	pthread_mutex_unlock(&Lock);
+	return img;
+}
+
+/*** shared_load
+*		A new image takes a free slot or the least recently used image nobody holds. Machines still
+*		mapped on a dropped image keep its pages, as the mapping keeps the file alive.
+***/
+struct_shared *shared_load(unsigned long long key, const unsigned *text, size_t text_words,
+	const unsigned *data, size_t data_words)
+{
+	struct_shared *img, *victim = NULL;
+	void *view;
+	int i, fd;
+
+	if (text_words > (MEMBYTES - PCINIT) / 4 || data_words > (MEMBYTES - GPINIT) / 4)
+		return NULL;
+	pthread_mutex_lock(&Lock);
+	if ((img = lookup(key, text, text_words, data, data_words)) != NULL)
+	{
+		pthread_mutex_unlock(&Lock);
+		return img;
+	}
+	for (i = 0; i < SHARED_MAX; i++)
+	{
+		if (Images[i].refs == 0 && (victim == NULL || Images[i].fd < 0
+			|| (victim->fd >= 0 && Images[i].used < victim->used)))
+			victim = &Images[i];
+	}
+	if (victim == NULL || (fd = memfd_create("spimcore-image", MFD_CLOEXEC)) < 0)
+	{
+		pthread_mutex_unlock(&Lock);
+		return NULL;
+	}
+	if (ftruncate(fd, MEMBYTES) != 0
+		|| pwrite(fd, text, text_words * sizeof(unsigned), PCINIT) != (ssize_t) (text_words * sizeof(unsigned))
+		|| pwrite(fd, data, data_words * sizeof(unsigned), GPINIT) != (ssize_t) (data_words * sizeof(unsigned))
+		|| (view = mmap(NULL, MEMBYTES, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		pthread_mutex_unlock(&Lock);
+		return NULL;
+	}
+	if (victim->fd >= 0)
+	{
+		munmap((void *) victim->Mem, MEMBYTES);
+		close(victim->fd);
+	}
+	victim->key = key;
+	victim->fd = fd;
+	victim->Mem = (const unsigned *) view;
+	victim->text_words = text_words;
+	victim->data_words = data_words;
+	victim->refs = 1;
+	victim->used = ++Clock;
+	pthread_mutex_unlock(&Lock);
+	return victim;
+}
+
+void shared_release(struct_shared *img)
+{
+	pthread_mutex_lock(&Lock);
+	img->refs--;
+	pthread_mutex_unlock(&Lock);
+}
+
+unsigned *shared_map(const struct_shared *img, unsigned *Mem)
+{
+	int flags = MAP_PRIVATE | (Mem != NULL ? MAP_FIXED : 0);
+	void *p;
+
+	if (img != NULL)
+		p = mmap(Mem, MEMBYTES, PROT_READ | PROT_WRITE, flags, img->fd, 0);
+	else
+		p = mmap(Mem, MEMBYTES, PROT_READ | PROT_WRITE, flags | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : (unsigned *) p;
+}
+
+void shared_unmap(unsigned *Mem)
+{
+	if (Mem != NULL)
+		munmap(Mem, MEMBYTES);
+}
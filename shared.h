@@ -0,0 +1,39 @@
+#include "spimcore.h"
+
+#ifndef SHARED
+
+#define SHARED_MAX 256		// images cached per process, least recently used ones are dropped
+
+/* a program image cached once per process: the memory a machine starts with, in an in-memory file */
+typedef struct
+{
+	unsigned long long key;
+	int fd;			// MEMBYTES of memory, -1 if the slot is free
+	const unsigned *Mem;	// the same memory, mapped read-only
+	size_t text_words;	// words loaded at PCINIT and at GPINIT
+	size_t data_words;
+	int refs;		// holders of the image
+	unsigned long long used;	// when it was last asked for
+}struct_shared;
+
+/* the image cached under key, held for the caller; NULL if there is none */
+struct_shared *shared_find(unsigned long long key);
+
+/* the image cached under key with these words, or a new one with text at PCINIT and data at GPINIT
+   and zeroes elsewhere, held for the caller; NULL if the words do not fit or every slot is held.
+   An image whose key matches but whose words differ is never returned */
+struct_shared *shared_load(unsigned long long key, const unsigned *text, size_t text_words,
+	const unsigned *data, size_t data_words);
+
+/* let go of an image; an image stays cached while a machine's memory is mapped on it anyway */
+void shared_release(struct_shared *img);
+
+/* map MEMBYTES of machine memory copy-on-write on img, or zeroed if img is NULL. With Mem, the
+   mapping replaces the memory there and every page it had written. Returns NULL on failure */
+unsigned *shared_map(const struct_shared *img, unsigned *Mem);
+
+/* unmap machine memory from shared_map() */
+void shared_unmap(unsigned *Mem);
+
+#define SHARED
+#endif
@@ -0,0 +1,188 @@
+/*
+ * skip.c - Fast-forwarding of loops that do nothing but count or wait. A counted loop is a run of
+ * addi r, r, c with one beq out of it and a jump back: every register moves by a constant per
+ * iteration, so the iteration in which the beq is taken solves a linear congruence mod 2^32. A wait
+ * loop is one that comes back to its head with the registers it left with, having only read memory;
+ * while the devices are idle nothing else writes memory, so it would spin until the budget runs out.
+ * Either way the registers and the instruction count come out as if every iteration had run, and the
+ * last iteration, the one that leaves, is run by the engine.
+ * authors: Josiah Nethery
+ */
+
+#include "skip.h"
+#include "device.h"
+
+int LoopSkip = 1;
+
+/* back edges of loops that are neither counted nor waiting, by the address of the branch */
+static __thread struct
+{
+	unsigned from;
+	unsigned instruction;
+}Plain[SKIP_TABLE];
+
+/* the inverse of an odd x mod 2^32, by Newton's iteration */
+static unsigned inverse(unsigned x)
+{
+	unsigned y = x;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		y *= 2 - x * y;
+	return y;
+}
+
+/*** iterations
+*		The first iteration k >= 0 in which value + k * step == target, or ~0 if there is none: with
+*		step = 2^t * odd, a solution exists when 2^t divides the difference, and is unique mod 2^(32 - t).
+***/
+static unsigned long long iterations(unsigned value, unsigned step, unsigned target)
+{
+	unsigned d = target - value;
+	int t;
+
+	if (d == 0)
+		return 0;
+	if (step == 0)
+		return ~0ULL;
+	t = __builtin_ctz(step);
+	if (d & ((1u << t) - 1))
+		return ~0ULL;
+	return (unsigned long long) (((d >> t) * inverse(step >> t)) & (0xFFFFFFFFu >> t));
+}
+
+/*** counted
+*		Iterations of a counted loop from head to the jump back at from that can be skipped, at most
+*		max instructions of them; sets *ok to 0 if it is not one. before[r] and total[r] are what
+*		register r is counted up by before the beq and in a whole iteration.
+***/
+static unsigned long long counted(const unsigned *Mem, unsigned *Reg, unsigned head, unsigned from,
+	unsigned long long max, int *ok)
+{
+	unsigned before[REGSIZE] = { 0 }, total[REGSIZE] = { 0 };
+	unsigned length = (from - head) / 4 + 1, exit = 0, pc, instruction, target, rs, rt;
+	unsigned long long k;
+	int exits = 0, r;
+
+	*ok = 0;
+	instruction = Mem[from >> 2];
+	if (instruction >> 26 == 4 && (instruction >> 21 & 0x1F) != (instruction >> 16 & 0x1F))
+		return 0;
+	for (pc = head; pc < from; pc += 4)
+	{
+		instruction = Mem[pc >> 2];
+		rs = instruction >> 21 & 0x1F;
+		rt = instruction >> 16 & 0x1F;
+		if (instruction >> 26 == 8 && rs == rt) //addi r, r, c
+		{
+			total[rt] += (instruction & 0x8000) ? (instruction | 0xFFFF0000) : (instruction & 0xFFFF);
+			if (!exits)
+				before[rt] = total[rt];
+		}
+		else if (instruction >> 26 == 4 && !exits)
+		{
+			target = pc + 4 + (((instruction & 0x8000) ? (instruction | 0xFFFF0000) : (instruction & 0xFFFF)) << 2);
+			if (target - head <= from - head)
+				return 0;
+			exit = instruction;
+			exits = 1;
+		}
+		else
+			return 0;
+	}
+	if (!exits)
+		return 0;
+	rs = exit >> 21 & 0x1F;
+	rt = exit >> 16 & 0x1F;
+	if (total[rs] == 0 && before[rs] == 0) //rs is the bound, rt counts
+		k = iterations(Reg[rt] + before[rt], total[rt], Reg[rs]);
+	else if (total[rt] == 0 && before[rt] == 0)
+		k = iterations(Reg[rs] + before[rs], total[rs], Reg[rt]);
+	else
+		return 0;
+	*ok = 1;
+	if (k > max / length)
+		k = max / length;
+	for (r = 0; r < REGSIZE; r++)
+		Reg[r] += (unsigned) k * total[r];
+	return k;
+}
+
+/*** waiting
+*		1 if one iteration from head, run on a copy of the registers, comes back to head with the same
+*		registers having only read memory; *length is set to the instructions it took.
+***/
+static int waiting(const unsigned *Mem, const unsigned *Reg, unsigned head, unsigned *length)
+{
+	unsigned R[REGSIZE], pc = head, instruction, rs, rt, imm, addr;
+	unsigned n;
+
+	memcpy(R, Reg, sizeof(R));
+	for (n = 1; n <= 4 * SKIP_BODY; n++)
+	{
+		if ((pc & 3) || pc >= MEMBYTES)
+			return 0;
+		instruction = Mem[pc >> 2];
+		rs = instruction >> 21 & 0x1F;
+		rt = instruction >> 16 & 0x1F;
+		imm = (instruction & 0x8000) ? (instruction | 0xFFFF0000) : (instruction & 0xFFFF);
+		pc += 4;
+		switch (instruction >> 26)
+		{
+			case 0:
+				switch (instruction & 0x3F)
+				{
+					case 32: R[instruction >> 11 & 0x1F] = R[rs] + R[rt]; break;
+					case 34: R[instruction >> 11 & 0x1F] = R[rs] - R[rt]; break;
+					case 36: R[instruction >> 11 & 0x1F] = R[rs] & R[rt]; break;
+					case 37: R[instruction >> 11 & 0x1F] = R[rs] | R[rt]; break;
+					case 42: R[instruction >> 11 & 0x1F] = R[rs] < R[rt]; break;
+					case 43: R[instruction >> 11 & 0x1F] = (int) R[rs] < (int) R[rt]; break;
+					default: return 0;
+				}
+				break;
+			case 2: pc = ((pc - 4) & 0xF8000000) + ((instruction & 0x3FFFFFF) << 2); break;
+			case 4: pc += (R[rs] == R[rt]) ? imm << 2 : 0; break;
+			case 8: R[rt] = R[rs] + imm; break;
+			case 10: R[rt] = R[rs] < imm; break;
+			case 11: R[rt] = (int) R[rs] < (int) imm; break;
+			case 15: R[rt] = imm << 16; break;
+			case 35:
+				addr = R[rs] + imm;
+				if ((addr & 3) || addr >= MEMBYTES)
+					return 0;
+				R[rt] = Mem[addr >> 2];
+				break;
+			default:
+				return 0;
+		}
+		if (pc == head)
+		{
+			*length = n;
+			return memcmp(R, Reg, sizeof(R)) == 0;
+		}
+	}
+	return 0;
+}
+
+unsigned long long skip_loop(const unsigned *Mem, unsigned *Reg, unsigned head, unsigned from,
+	unsigned long long max)
+{
+	unsigned slot = (from >> 2) & (SKIP_TABLE - 1), length;
+	unsigned long long k;
+	int ok;
+
+	if (Plain[slot].from == from && Plain[slot].instruction == Mem[from >> 2])
+		return 0;
+	if (from - head < 4 * SKIP_BODY)
+	{
+		k = counted(Mem, Reg, head, from, max, &ok);
+		if (ok)
+			return k * ((from - head) / 4 + 1);
+	}
+	if (waiting(Mem, Reg, head, &length))
+		return bus_idle() ? max / length * length : 0;
+	Plain[slot].from = from;
+	Plain[slot].instruction = Mem[from >> 2];
+	return 0;
+}
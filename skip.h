@@ -0,0 +1,19 @@
+#include "spimcore.h"
+
+#ifndef SKIP
+
+#define SKIP_BODY 16		// longest loop looked at, in instructions
+#define SKIP_TABLE 64		// loops remembered per thread as not worth looking at again
+
+/* 1 unless -noskip or -guestfuzz: fast_run() calls skip_loop() on every backward branch and jump it takes */
+extern int LoopSkip;
+
+/* the instruction at from has branched back to head, with Reg as it is at head. If the loop only
+   counts registers up to a beq that leaves it, or waits for memory that nothing can change, whole
+   iterations are done at once, as many as fit in max instructions.
+   Returns the number of instructions skipped, a multiple of the length of the loop */
+unsigned long long skip_loop(const unsigned *Mem, unsigned *Reg, unsigned head, unsigned from,
+	unsigned long long max);
+
+#define SKIP
+#endif
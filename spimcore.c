@@ -1,12 +1,36 @@
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
 #include "spimcore.h"
+#include "sample.h"
+#include "sysio.h"
+#include "instrument.h"
+#include "fast.h"
+#include "fuzz.h"
+#include "serve.h"
+#include "mmu.h"
+#include "watchdog.h"
+#include "device.h"
+#include "statehash.h"
+#include "plugin.h"
+#include "aot.h"
+#include "skip.h"
+#include "hostperf.h"
+#include "guestfuzz.h"
+#include "mapfile.h"
 
-#define MEMSIZE (65536 >> 2)
-#define REGSIZE 32
 #define BUFSIZE 256
 
-#define PCINIT 0x4000
-#define SPINIT 0xFFFC
-#define GPINIT 0xC000
+#define MODE_REPL 0
+#define MODE_SAMPLE 1
+#define MODE_DETAILED 2
+#define MODE_BATCH 3
+
+/* what the command loop asks of the runner, looked at between slices */
+#define RUN_GO 0
+#define RUN_PAUSE 1		// park at the next safe point
+#define RUN_STOP 2		// end the run at the next safe point
 
 static unsigned Mem[MEMSIZE];
 static unsigned Reg[REGSIZE + 4];
@@ -32,8 +56,36 @@ const char RedirPrefix[] = ">";
 
 static char Buf[BUFSIZE];
 static int Halt = 0;
+static unsigned long long InstCount = 0;
 static FILE *FP;
 static char *Redir = (char *) RedirNull;
+void Step(void);
+
+static struct_counters Counters;
+static int Policy = 0;			// instrumentation policy (INST_*) selected with -count
+static void (*StepFn)(void) = Step;	// the datapath specialized for Policy or the plugins, or MmuStep
+static struct_mmu Mmu;
+static int MmuEntries = 0;		// TLB entries given with -mmu, 0 without an MMU
+static struct_budget Budget;		// limits given with -max, -timeout and -pages
+static struct_watchdog Watchdog;
+static struct_hash Hash;		// state hash of the command loop and batch mode
+static struct_hash HashMark;		// Hash at the last command k
+static int HashMarked = 0;
+static struct_hostperf HostPerf;	// host counters of -hostperf
+static int HostPerfOn = 0;
+
+/* the runner thread of c and s in the command loop */
+static pthread_t Runner;
+static pthread_mutex_t RunLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t RunChanged = PTHREAD_COND_INITIALIZER;
+static int RunState = RUN_GO;		// set by the command loop and SIGINT
+static int Running = 0;			// a runner is to be joined
+static int Active = 0;			// the runner has not finished
+static int Parked = 0;			// the runner waits at a safe point
+static unsigned long long RunSteps;	// steps of s, 0 for c
+static unsigned long long Progress;	// InstCount at the last safe point
+static unsigned long long RunFirst;	// InstCount when the run started
+static double RunStarted;		// and when, in seconds
 
 /*** DATAPATH Signals ***/
 // names of instruction sections
@@ -85,6 +137,15 @@ void Init(void)
 	NREG("pc") = PCINIT;
 	NREG("sp") = SPINIT;
 	NREG("gp") = GPINIT;
+	if (MmuEntries)
+	{
+		//boot in kernel mode, running the loaded image through kseg0
+		PC |= KSEG0;
+		NREG("sp") |= KSEG0;
+		NREG("gp") |= KSEG0;
+		mmu_init(&Mmu, MmuEntries);
+	}
+	watchdog_start(&Watchdog, &Budget, Mem, InstCount);
 }
 
 
@@ -104,49 +165,175 @@ void DisplayControlSignals(void)
 
 
 
-void Step(void)
+/*** step_body
+*		Runs one instruction through the datapath. policy selects the counters that are kept (INST_*)
+*		or the kinds of plugin callbacks that are called (INST_PLUGIN_*). It is a constant in every
+*		specialization below, so the disabled hooks are compiled out and Step(), policy 0, is the
+*		plain datapath.
+***/
+static inline __attribute__((always_inline)) void step_body(const int policy)
 {
+	unsigned pc = PC;
+
+	hook_plugin_begin(policy,pc,InstCount);
 	/* fetch instruction from memory */
 	Halt = instruction_fetch(PC,Mem,&instruction);
-	//printf("IF\n");
+	hook_halt(policy,&Counters,Halt,HALT_FETCH,pc,InstCount);
 	if(!Halt)
 	{
+		hook_plugin_fetch(policy,pc,instruction);
 		/* partition the instruction */
 		instruction_partition(instruction,&op,&r1,&r2,&r3,&funct,&offset,&jsec);
-		//printf("IP\n");
 		/* instruction decode */
 		Halt = instruction_decode(op,&controls);
-		//printf("ID\n");
+		hook_halt(policy,&Counters,Halt,HALT_DECODE,pc,InstCount);
+	}
+
+	if(!Halt && op == 0 && funct == 12)
+	{
+		/* syscall */
+		hook_decode(policy,&Counters,op,funct);
+		hook_syscall(policy,&Counters);
+		hook_plugin_decode(policy,pc,op,funct,&controls);
+		hook_plugin_syscall(policy,pc,Reg[2]);
+		Halt = syscall_exec(Reg,Mem,InstCount);
+		if(!Halt)
+		{
+			PC += 4;
+			InstCount++;
+			hook_plugin_pc_update(policy,pc,PC);
+			hook_plugin_retire(policy,1);
+		}
+		hook_halt(policy,&Counters,Halt,Reg[2] == SYS_EXIT ? HALT_EXIT : HALT_SYSCALL,pc,InstCount);
+		hook_plugin_halt(policy,Halt);
+		return;
 	}
 
 	if(!Halt)
 	{
+		hook_plugin_decode(policy,pc,op,funct,&controls);
 		/* read_register */
 		read_register(r1,r2,Reg,&data1,&data2);
-		//printf("RR\n");
 		/* sign_extend */
 		sign_extend(offset,&extended_value);
-		//printf("SEXT\n");
 		/* ALU */
 		Halt = ALU_operations(data1,data2,extended_value,funct,controls.ALUOp,controls.ALUSrc,&ALUresult,&Zero);
-		//printf("ALUOP\n");
+		hook_halt(policy,&Counters,Halt,HALT_ALU,pc,InstCount);
 	}
 
 	if(!Halt)
 	{
+		hook_plugin_alu(policy,pc,ALUresult,Zero);
 		/* read/write memory */
 		Halt = rw_memory(ALUresult,data2,controls.MemWrite,controls.MemRead,&memdata,Mem);
-		//printf("RWMEM\n");
+		hook_halt(policy,&Counters,Halt,HALT_MEMORY,pc,InstCount);
 	}
 
 	if(!Halt)
 	{
+		hook_plugin_memory(policy,pc,&controls,ALUresult,data2,memdata);
 		/* write to register */
 		write_register(r2,r3,memdata,ALUresult,controls.RegWrite,controls.RegDst,controls.MemtoReg,Reg);
-		//printf("RW\n");
+		hook_plugin_reg_write(policy,pc,&controls,r2,r3,memdata,ALUresult);
 		/* PC update */
 		PC_update(jsec,extended_value,controls.Branch,controls.Jump,Zero,&PC);
-		//printf("PC\n");
+		hook_plugin_pc_update(policy,pc,PC);
+		hook_decode(policy,&Counters,op,funct);
+		hook_memory(policy,&Counters,&controls);
+		hook_writeback(policy,&Counters,&controls,pc,PC);
+		InstCount++;
+		hook_plugin_retire(policy,controls.Branch == '1' || controls.Jump == '1');
+	}
+	hook_plugin_halt(policy,Halt);
+}
+
+void Step(void)
+{
+	step_body(0);
+}
+
+/* one specialization of the datapath per instrumentation policy */
+#define STEP_POLICY(p) static void Step##p(void) { step_body(p); }
+STEP_POLICY(1) STEP_POLICY(2) STEP_POLICY(3) STEP_POLICY(4) STEP_POLICY(5)
+STEP_POLICY(6) STEP_POLICY(7) STEP_POLICY(8) STEP_POLICY(9) STEP_POLICY(10)
+STEP_POLICY(11) STEP_POLICY(12) STEP_POLICY(13) STEP_POLICY(14) STEP_POLICY(15)
+
+static void (*const StepPolicy[INST_POLICIES])(void) = {
+	Step, Step1, Step2, Step3, Step4, Step5, Step6, Step7,
+	Step8, Step9, Step10, Step11, Step12, Step13, Step14, Step15 };
+
+/* and one per combination of the kinds of plugin callbacks */
+STEP_POLICY(16) STEP_POLICY(32) STEP_POLICY(48) STEP_POLICY(64) STEP_POLICY(80) STEP_POLICY(96) STEP_POLICY(112)
+
+static void (*const StepPlugin[INST_PLUGIN_KINDS])(void) = {
+	Step, Step16, Step32, Step48, Step64, Step80, Step96, Step112 };
+
+/*** MmuStep
+*		Step() through the MMU. An instruction that raises an exception does not complete.
+***/
+static void MmuStep(void)
+{
+	int result = mmu_step(&Mmu, Mem, Reg, InstCount);
+
+	Halt = result == MMU_HALT;
+	if (result == MMU_DONE)
+		InstCount++;
+}
+
+/*** HostStep
+*		Step() with the host counters read between its phases now and then.
+***/
+static void HostStep(void)
+{
+	Halt = hostperf_step(&HostPerf, Mem, Reg, InstCount) == HP_HALT;
+	if (!Halt)
+		InstCount++;
+}
+
+/*** SafePoint
+*		Between two slices of a run, where the machine is consistent: publishes the instruction count,
+*		and parks while the command loop looks at the machine. Returns 1 if the run is to end. The
+*		engines only ever see the slices, so this is all a run in the background costs them.
+***/
+static int SafePoint(void)
+{
+	int state = __atomic_load_n(&RunState, __ATOMIC_ACQUIRE);
+
+	__atomic_store_n(&Progress, InstCount, __ATOMIC_RELAXED);
+	if (state == RUN_PAUSE)
+	{
+		pthread_mutex_lock(&RunLock);
+		Parked = 1;
+		pthread_cond_broadcast(&RunChanged);
+		while ((state = __atomic_load_n(&RunState, __ATOMIC_ACQUIRE)) == RUN_PAUSE)
+			pthread_cond_wait(&RunChanged, &RunLock);
+		Parked = 0;
+		pthread_mutex_unlock(&RunLock);
+	}
+	return state == RUN_STOP;
+}
+
+/*** Run
+*		Runs until the machine halts or the watchdog stops it, in slices between which the limits are
+*		checked and the command loop may pause or end the run. fast selects the fast engine, or the
+*		translation loaded with -native, instead of StepFn. An exception loop under the MMU completes
+*		no instructions, so only the timeout stops it.
+***/
+static void Run(int fast)
+{
+	unsigned long long n, i;
+
+	while (!Halt && (n = watchdog_slice(&Watchdog, InstCount)) > 0)
+	{
+		if (fast && aot_active())
+			aot_execute(Mem, Reg, &Halt, &InstCount, n);
+		else if (fast)
+			fast_run(Mem, Reg, &Halt, &InstCount, n, NULL, NULL);
+		else
+			for (i = 0; i < n && !Halt; i++)
+				StepFn();
+		if (watchdog_check(&Watchdog, Mem, InstCount) != STOP_NONE || SafePoint())
+			break;
 	}
 }
 
@@ -164,6 +351,31 @@ void DumpReg(void)
 	}
 }
 
+/*** RunEnd
+*		The first word from i on, or to, that is not value. The pages that Hash has never seen touched
+*		are all zero, so they are stepped over whole within a run of zeros and end any other run.
+***/
+static int RunEnd(int i, int to, unsigned value)
+{
+	unsigned page;
+
+	for (; i < to; i++)
+	{
+		page = (unsigned) i / HASH_PAGE_WORDS;
+		if (page < HASH_PAGES && !hash_touched(&Hash, page))
+		{
+			if (value != 0)
+				return i;
+			i = (int) (hash_next_touched(&Hash, page) * HASH_PAGE_WORDS);
+			if (i >= to)
+				return to;
+		}
+		if (Mem[i] != value)
+			return i;
+	}
+	return to;
+}
+
 // Dump Memory Content where the addresses are in decimal format
 void DumpMem(int from, int to)
 {
@@ -179,6 +391,7 @@ void DumpMem(int from, int to)
 		mt = Mem[ma = from];
 		for (i = from + 1; i <= to; i++)
 		{
+			i = RunEnd(i, to, mt);
 			if (i == to || Mem[i] != mt)
 			{
 				if (i == ma + 1)
@@ -209,6 +422,7 @@ void DumpMemHex(int from, int to)
 		mt = Mem[ma = from];
 		for (i = from + 1; i <= to; i++)
 		{
+			i = RunEnd(i, to, mt);
 			if (i == to || Mem[i] != mt)
 			{
 				if (i == ma + 1)
@@ -251,21 +465,224 @@ void DumpHex(int from, int to)
 		fputc('\n', stdout);
 }
 
+/*** PrintHash
+*		Prints the state hash and, with mark, the pages changed since the last mark, which becomes the
+*		current state.
+***/
+void PrintHash(int mark)
+{
+	int pages[HASH_PAGES], i, n;
+
+	fprintf(stdout, "%s state %016llx memory %016llx registers %016llx\n", Redir,
+		hash_state(&Hash, Reg), hash_memory(&Hash), hash_registers(Reg));
+	if (!mark)
+		return;
+	if (HashMarked)
+	{
+		n = hash_diff(&Hash, &HashMark, pages);
+		fprintf(stdout, "%s %d pages changed since the last k%s", Redir, n, n ? ":" : "");
+		for (i = 0; i < n; i++)
+			fprintf(stdout, " %05x", pages[i] * HASH_PAGE_WORDS * 4);
+		fputc('\n', stdout);
+	}
+	HashMark = Hash;
+	HashMarked = 1;
+}
+
+static double Seconds(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*** RunThread
+*		The runner of c, or of s with RunSteps steps, which it takes in the watchdog's slices with a
+*		safe point between them. Prints what c and s print once the run is over.
+***/
+static void *RunThread(void *arg)
+{
+	unsigned long long n = RunSteps, m, i;
+
+	if (n == 0)
+	{
+		Run(0);
+		fprintf(stdout, "%s cont\n", Redir);
+	}
+	else
+	{
+		while (n > 0 && !Halt && (m = watchdog_slice(&Watchdog, InstCount)) > 0)
+		{
+			for (i = 0; i < m && i < n && !Halt; i++)
+				StepFn();
+			n -= i;
+			if (watchdog_check(&Watchdog, Mem, InstCount) != STOP_NONE || SafePoint())
+				break;
+		}
+		fprintf(stdout, "%s step\n", Redir);
+	}
+	if (!Halt && Watchdog.stop != STOP_NONE)
+		fprintf(stdout, "%s stopped: %s\n", Redir, watchdog_reason(Watchdog.stop));
+	if (!Halt && __atomic_load_n(&RunState, __ATOMIC_ACQUIRE) == RUN_STOP)
+		fprintf(stdout, "%s stopped: interrupt at %08x\n", Redir, PC);
+	__atomic_store_n(&Progress, InstCount, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&RunLock);
+	__atomic_store_n(&Active, 0, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&RunChanged);
+	pthread_mutex_unlock(&RunLock);
+	return NULL;
+}
+
+/* Ctrl-C ends a run at its next safe point, or the simulator when nothing runs */
+static void Interrupt(int sig)
+{
+	if (__atomic_load_n(&Active, __ATOMIC_ACQUIRE))
+		__atomic_store_n(&RunState, RUN_STOP, __ATOMIC_RELEASE);
+	else
+	{
+		signal(SIGINT, SIG_DFL);
+		raise(SIGINT);
+	}
+}
+
+/*** ReadsConsole
+*		1 if the program may read the console: it has a syscall and its inputs are not replayed. Its
+*		runs then keep stdin to themselves in the foreground, where Ctrl-C still ends them.
+***/
+static int ReadsConsole(void)
+{
+	int i;
+
+	if (!sysio_live())
+		return 0;
+	for (i = 0; i < MEMSIZE; i++)
+	{
+		if ((Mem[i] & 0xFC00003F) == 12)
+			return 1;
+	}
+	return 0;
+}
+
+/* every c and s is a run of its own, with the whole budget */
+static void StartRun(unsigned long long steps)
+{
+	watchdog_start(&Watchdog, &Budget, Mem, InstCount);
+	RunSteps = steps;
+	RunState = RUN_GO;
+	RunFirst = Progress = InstCount;
+	RunStarted = Seconds();
+	Active = 1;
+	if (pthread_create(&Runner, NULL, RunThread, NULL) != 0)
+	{
+		Active = 0;
+		fprintf(stdout, "%s cannot start the run\n", Redir);
+		return;
+	}
+	Running = 1;
+}
+
+/* wait for the run to end, first asking it to with stop */
+static void JoinRun(int stop)
+{
+	if (!Running)
+		return;
+	if (stop)
+	{
+		pthread_mutex_lock(&RunLock);
+		__atomic_store_n(&RunState, RUN_STOP, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&RunChanged);
+		pthread_mutex_unlock(&RunLock);
+	}
+	pthread_join(Runner, NULL);
+	Running = 0;
+}
+
+/* hold the runner at a safe point while the command loop reads or prints the machine */
+static void PauseRun(void)
+{
+	if (!Running)
+		return;
+	pthread_mutex_lock(&RunLock);
+	__atomic_compare_exchange_n(&RunState, &(int){ RUN_GO }, RUN_PAUSE, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	while (!Parked && __atomic_load_n(&Active, __ATOMIC_ACQUIRE))
+		pthread_cond_wait(&RunChanged, &RunLock);
+	pthread_mutex_unlock(&RunLock);
+}
+
+static void ResumeRun(void)
+{
+	if (!Running)
+		return;
+	pthread_mutex_lock(&RunLock);
+	__atomic_compare_exchange_n(&RunState, &(int){ RUN_PAUSE }, RUN_GO, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	pthread_cond_broadcast(&RunChanged);
+	pthread_mutex_unlock(&RunLock);
+}
+
+/* the command t: what the runner is doing, read without stopping it */
+static void RunStatus(void)
+{
+	unsigned long long count = __atomic_load_n(&Progress, __ATOMIC_RELAXED);
+	double seconds = Seconds() - RunStarted;
+
+	if (Running && __atomic_load_n(&Active, __ATOMIC_ACQUIRE))
+		fprintf(stdout, "%s running %s, %llu instructions, %.0f per second\n", Redir,
+			RunSteps ? "s" : "c", count, seconds > 0 ? (count - RunFirst) / seconds : 0.0);
+	else
+		fprintf(stdout, "%s idle, %llu instructions, halted: %s\n", Redir, InstCount, Halt ? "true" : "false");
+}
+
+/*** MapCommand
+*		The command f file address [ro|cow] maps a file, f alone lists the mapped files. The rest of
+*		the line is taken whole, as the names of files have dots in them.
+***/
+static void MapCommand(char *args)
+{
+	char path[BUFSIZE], base[BUFSIZE], mode[BUFSIZE] = "ro";
+	int n = args != NULL ? sscanf(args, "%s %s %s", path, base, mode) : 0;
+
+	if (n <= 0)
+		map_print(stdout, Redir);
+	else if (n == 1 || map_mode(mode) < 0)
+		fprintf(stdout, "%s invalid cmd\n", Redir);
+	else
+	{
+		fprintf(stdout, "%s ", Redir);
+		if (map_host_file(path, (unsigned) strtoul(base, (char **) NULL, 0), map_mode(mode), stdout) == 0)
+			fprintf(stdout, "mapped\n");
+	}
+}
+
 void Loop(void)
 {
 	char *tp;
-	int sc;
+	int sc, interactive = isatty(fileno(stdin));
+	struct sigaction action;
+	unsigned long long steps;
 
 	Init();
+	hash_init(&Hash, Mem);
+	StateHash = &Hash;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = Interrupt;
+	sigaction(SIGINT, &action, NULL);
 	for (;;)
 	{
+		if (Running && !__atomic_load_n(&Active, __ATOMIC_ACQUIRE))
+			JoinRun(0);
 		fprintf(stdout, "\n%s cmd: ", Redir);
 		Buf[0] = '\0';
 		if (fgets(Buf, BUFSIZE, stdin) == NULL)
+		{
+			clearerr(stdin);
 			continue;
+		}
 		if ((tp = strtok(Buf, " ,.\t\n\r")) == NULL)
 			continue;
 		fputc('\n', stdout);
+		if (strchr("gGrRmMhHnNkKdDfF", *tp) != NULL)
+			PauseRun();
 		switch (*tp)
 		{
 			case 'g': case 'G':
@@ -294,17 +711,37 @@ void Loop(void)
 				break;
 			case 's': case 'S':
 				if ((tp = strtok(NULL, " ,.\t\n\r")) == NULL)
-					sc = 1;
+					steps = 1;
 				else
-					sc = (int) strtoul(tp, (char **) NULL, 10);
-				while (sc-- > 0 && !Halt)
-					Step();
-				fprintf(stdout, "%s step\n", Redir);
+					steps = (unsigned long long) strtoll(tp, (char **) NULL, 10);
+				if (Running)
+					fprintf(stdout, "%s running\n", Redir);
+				else if ((long long) steps <= 0)
+					fprintf(stdout, "%s step\n", Redir);
+				else
+					StartRun(steps);
+				if (!interactive || ReadsConsole())
+					JoinRun(0);
 				break;
 			case 'c': case 'C':
-				while (!Halt)
-					Step();
-				fprintf(stdout, "%s cont\n", Redir);
+				if (Running)
+					fprintf(stdout, "%s running\n", Redir);
+				else
+					StartRun(0);
+				if (!interactive || ReadsConsole())
+					JoinRun(0);
+				break;
+			case 't': case 'T':
+				RunStatus();
+				break;
+			case 'f': case 'F':
+				MapCommand(strtok(NULL, "\n\r"));
+				break;
+			case 'b': case 'B':
+				JoinRun(1);
+				break;
+			case 'w': case 'W':
+				JoinRun(0);
 				break;
 			case 'h': case 'H':
 				fprintf(stdout, "%s %s\n", Redir, Halt ? "true" : "false");
@@ -318,6 +755,15 @@ void Loop(void)
 						fprintf(stdout, "%s % 5d  %s", Redir, sc++, Buf);
 				}
 				break;
+			case 'n': case 'N':
+				if (MmuEntries)
+					mmu_print(&Mmu, stdout, Redir);
+				else
+					counters_print(&Counters, Policy, stdout, Redir);
+				break;
+			case 'k': case 'K':
+				PrintHash(1);
+				break;
 			case 'i': case 'I':
 				fprintf(stdout, "%s %d\n", Redir, MEMSIZE);
 				break;
@@ -336,7 +782,9 @@ void Loop(void)
 				DumpHex(sc, (int) strtoul(tp, (char **) NULL, 10));
 				break;
 			case 'x': case 'X': case 'q': case 'Q':
+				JoinRun(1);
 				fprintf(stdout, "%s quit\n", Redir);
+				plugin_finish(stdout, Redir);
 				if (Redir == (char *) RedirPrefix)
 				{
 					fprintf(stdout, "%s%s\n", Redir, Redir);
@@ -346,6 +794,7 @@ void Loop(void)
 				fprintf(stdout, "%s invalid cmd\n", Redir);
 				break;
 		}
+		ResumeRun();
 		if (Redir == (char *) RedirPrefix)
 		{
 			fprintf(stdout, "%s%s\n", Redir, Redir);
@@ -353,39 +802,221 @@ void Loop(void)
 	}
 }
 
-int main(int argc, char **argv)
+int Usage(char *name)
 {
+	fprintf(stderr, "syntax: %s input_file [-r] [-b] [-count mix,ops,mem,halt|all] [-sample interval [-clusters n] [-per n] [-warmup n] [-threads n]] [-detailed] [-max n] [-noskip] [-timeout ms] [-pages n] [-devices] [-disk file] [-record log | -replay log] [-mmu entries] [-plugin file.so[:args]]... [-translate out.c | -native file.so] [-hostperf fast|step] [-guestfuzz addr:size [-input file]] [-map file@addr[:ro|:cow]]...\n", name);
+	fprintf(stderr, "        %s -fuzz cases [-seed n] [-first n] [-threads n]\n", name);
+	fprintf(stderr, "        %s -serve socket [-threads n]\n", name);
+	return 1;
+}
+
+/*** Fuzz
+*		spimcore -fuzz: checks the fast engine against Step() on random cases instead of running a file.
+***/
+int Fuzz(int argc, char **argv)
+{
+	struct_fuzz_config fuzzing;
 	int i;
-	unsigned long t;
 
-	setvbuf(stdout, (char *) NULL, _IOLBF, 0);
-	if (argc != 2 && argc != 3)
-	{
-		fprintf(stderr, "syntax: %s input_file [-r]\n", argv[0]);
-		return 1;
-	}
-	if (*argv[1] == '-')
+	fuzzing.cases = strtoull(argv[2], (char **) NULL, 10);
+	fuzzing.seed = 1;
+	fuzzing.first = 0;
+	fuzzing.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 3; i + 1 < argc; i += 2)
 	{
-		fprintf(stderr, "syntax: %s input_file [-r]\n", argv[0]);
-		return 1;
+		if (strcmp(argv[i], "-seed") == 0)
+			fuzzing.seed = strtoull(argv[i + 1], (char **) NULL, 10);
+		else if (strcmp(argv[i], "-first") == 0)
+			fuzzing.first = strtoull(argv[i + 1], (char **) NULL, 10);
+		else if (strcmp(argv[i], "-threads") == 0)
+			fuzzing.threads = atoi(argv[i + 1]);
+		else
+			return Usage(argv[0]);
 	}
-	if ((FP = fopen(argv[1], "r")) == NULL)
+	if (i != argc || fuzzing.threads < 1)
+		return Usage(argv[0]);
+	return fuzz_run(&fuzzing, Mem, Reg, &Halt, &InstCount, Step, stdout, Redir);
+}
+
+/*** Serve
+*		spimcore -serve (or --serve): runs jobs sent to a Unix-domain socket until killed, see serve.h.
+***/
+int Serve(int argc, char **argv)
+{
+	int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (argc == 5 && strcmp(argv[3], "-threads") == 0)
+		threads = atoi(argv[4]);
+	else if (argc != 3)
+		return Usage(argv[0]);
+	if (threads < 1)
+		return Usage(argv[0]);
+	if (serve_run(argv[2], threads, stdout, Redir))
 	{
-		fprintf(stderr, "%s: cannot open input file %s\n", argv[0], argv[1]);
+		fprintf(stderr, "%s: cannot listen on %s\n", argv[0], argv[2]);
 		return 1;
 	}
-	if (argc == 3)
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, mode = MODE_REPL, io = SYSIO_LIVE, devices = 0, data = 0, map, cow = 0;
+	unsigned base;
+	char *disk = NULL, *translate = NULL, *native = NULL, *end;
+	unsigned long t;
+	struct_sample_config sampling;
+	struct_guestfuzz guest;
+	FILE *log = NULL, *out;
+
+	setvbuf(stdout, (char *) NULL, _IOLBF, 0);
+	if (argc >= 3 && strcmp(argv[1], "-fuzz") == 0)
+		return Fuzz(argc, argv);
+	if (argc >= 3 && (strcmp(argv[1], "-serve") == 0 || strcmp(argv[1], "--serve") == 0))
+		return Serve(argc, argv);
+	if (argc < 2 || *argv[1] == '-')
+		return Usage(argv[0]);
+	sampling.interval = 100000;
+	sampling.max_insts = ~0ULL;
+	sampling.warmup = 10000;
+	sampling.clusters = 8;
+	sampling.per_cluster = 3;
+	sampling.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	memset(&guest, 0, sizeof(guest));
+	for (i = 2; i < argc; i++)
 	{
-		if (strcmp(argv[2], "-r") == 0)
+		if (strcmp(argv[i], "-r") == 0)
 		{
 			Redir = (char *) RedirPrefix;
 			fprintf(stdout, "%s\n", argv[0]);
 		}
-		else
+		else if (strcmp(argv[i], "-detailed") == 0)
+			mode = MODE_DETAILED;
+		else if (strcmp(argv[i], "-b") == 0)
+			mode = MODE_BATCH;
+		else if (strcmp(argv[i], "-devices") == 0)
+			devices = 1;
+		else if (strcmp(argv[i], "-noskip") == 0)
+			LoopSkip = 0;
+		else if (i + 1 == argc)
+			return Usage(argv[0]);
+		else if (strcmp(argv[i], "-sample") == 0)
 		{
-			fprintf(stderr, "syntax: %s input_file [-r]\n", argv[0]);
-			return 1;
+			mode = MODE_SAMPLE;
+			sampling.interval = strtoull(argv[++i], (char **) NULL, 10);
+		}
+		else if (strcmp(argv[i], "-clusters") == 0)
+			sampling.clusters = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-per") == 0)
+			sampling.per_cluster = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-warmup") == 0)
+			sampling.warmup = strtoull(argv[++i], (char **) NULL, 10);
+		else if (strcmp(argv[i], "-threads") == 0)
+			sampling.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-count") == 0)
+		{
+			if ((Policy = counters_policy(argv[++i])) < 0)
+				return Usage(argv[0]);
+			StepFn = StepPolicy[Policy & INST_BUILD];
+		}
+		else if (strcmp(argv[i], "-mmu") == 0)
+		{
+			MmuEntries = atoi(argv[++i]);
+			if (MmuEntries < 1 || MmuEntries > MMU_MAX_ENTRIES)
+				return Usage(argv[0]);
+			StepFn = MmuStep;
+		}
+		else if (strcmp(argv[i], "-hostperf") == 0)
+		{
+			i++;
+			if (strcmp(argv[i], "step") == 0)
+				StepFn = HostStep;
+			else if (strcmp(argv[i], "fast") != 0)
+				return Usage(argv[0]);
+			HostPerfOn = 1;
+		}
+		else if (strcmp(argv[i], "-translate") == 0)
+			translate = argv[++i];
+		else if (strcmp(argv[i], "-native") == 0)
+			native = argv[++i];
+		else if (strcmp(argv[i], "-plugin") == 0)
+		{
+			if (plugin_load(argv[++i], stderr))
+				return 1;
+			StepFn = StepPlugin[plugin_policy() / INST_PLUGIN_STAGE];
 		}
+		else if (strcmp(argv[i], "-guestfuzz") == 0)
+		{
+			guest.addr = (unsigned) strtoul(argv[++i], &end, 0);
+			if (*end != ':' || (guest.size = (unsigned) strtoul(end + 1, (char **) NULL, 0)) == 0
+				|| guest.addr >= MEMBYTES || guest.size > MEMBYTES - guest.addr)
+				return Usage(argv[0]);
+		}
+		else if (strcmp(argv[i], "-input") == 0)
+			guest.input = argv[++i];
+		else if (strcmp(argv[i], "-map") == 0)
+		{
+			if ((end = strrchr(argv[++i], '@')) == NULL)
+				return Usage(argv[0]);
+			*end++ = '\0';
+			base = (unsigned) strtoul(end, &end, 0);
+			if ((map = *end == ':' ? map_mode(end + 1) : *end == '\0' ? MAP_READ : -1) < 0)
+				return Usage(argv[0]);
+			if (map_host_file(argv[i], base, map, stderr))
+				return 1;
+			cow |= map == MAP_COPY;
+		}
+		else if (strcmp(argv[i], "-max") == 0)
+			sampling.max_insts = Budget.max_insts = strtoull(argv[++i], (char **) NULL, 10);
+		else if (strcmp(argv[i], "-disk") == 0)
+		{
+			devices = 1;
+			disk = argv[++i];
+		}
+		else if (strcmp(argv[i], "-timeout") == 0)
+			Budget.timeout_ms = strtoull(argv[++i], (char **) NULL, 10);
+		else if (strcmp(argv[i], "-pages") == 0)
+			Budget.max_pages = (unsigned) strtoul(argv[++i], (char **) NULL, 10);
+		else if (strcmp(argv[i], "-record") == 0 || strcmp(argv[i], "-replay") == 0)
+		{
+			io = (strcmp(argv[i], "-record") == 0) ? SYSIO_RECORD : SYSIO_REPLAY;
+			if (log != NULL)
+				return Usage(argv[0]);
+			if ((log = fopen(argv[++i], io == SYSIO_RECORD ? "wb" : "rb")) == NULL)
+			{
+				fprintf(stderr, "%s: cannot open log file %s\n", argv[0], argv[i]);
+				return 1;
+			}
+		}
+		else
+			return Usage(argv[0]);
+	}
+	if (sampling.interval == 0 || sampling.clusters < 1 || sampling.per_cluster < 1 || sampling.threads < 1)
+		return Usage(argv[0]);
+	if (MmuEntries && (Policy || mode == MODE_SAMPLE || mode == MODE_DETAILED))
+		return Usage(argv[0]);
+	if (plugin_active() && (Policy || MmuEntries || mode == MODE_SAMPLE || mode == MODE_DETAILED))
+		return Usage(argv[0]);
+	if ((Budget.timeout_ms || Budget.max_pages || devices || cow) && (mode == MODE_SAMPLE || mode == MODE_DETAILED))
+		return Usage(argv[0]);
+	if (devices && log != NULL)
+		return Usage(argv[0]);
+	if (HostPerfOn && (mode != MODE_BATCH || Policy || MmuEntries || plugin_active()))
+		return Usage(argv[0]);
+	if (native != NULL && (translate != NULL || mode != MODE_BATCH || Policy || MmuEntries || plugin_active()))
+		return Usage(argv[0]);
+	if ((guest.size || guest.input != NULL) && (guest.size == 0 || mode != MODE_REPL || translate != NULL || native != NULL
+		|| Policy || MmuEntries || plugin_active() || HostPerfOn || devices || log != NULL || cow))
+		return Usage(argv[0]);
+	if ((FP = fopen(argv[1], "r")) == NULL)
+	{
+		fprintf(stderr, "%s: cannot open input file %s\n", argv[0], argv[1]);
+		return 1;
+	}
+	if (sysio_init(io, log))
+	{
+		fprintf(stderr, "%s: bad replay log\n", argv[0]);
+		return 1;
 	}
 	memset(Mem, 0, MEMSIZE * sizeof(unsigned));
 	for (i = PCINIT; !feof(FP); i += 4)
@@ -397,6 +1028,17 @@ int main(int argc, char **argv)
 			fprintf(stderr, "%s: file %s reading error\n", argv[0], argv[1]);
 			return 1;
 		}
+		if (Buf[0] == '@') //the following words go to this address (the data segment)
+		{
+			i = (int) strtoul(Buf + 1, (char **) NULL, 16) - 4;
+			data = 1;
+			continue;
+		}
+		if (i < 0 || i >= MEMBYTES || (i & 3))
+		{
+			fprintf(stderr, "%s: file %s does not fit in memory\n", argv[0], argv[1]);
+			return 1;
+		}
 		if (sscanf(Buf, "%lx", &t) != 1)
 		{
 			fprintf(stderr, "%s: file %s error in line %d, continue...\n",
@@ -407,8 +1049,89 @@ int main(int argc, char **argv)
 		{
 			MEM(i) = strtoul(Buf, (char **) NULL, 16);
 		}
+		if (!data)
+			guest.text_end = (unsigned) i + 4;
 	}
-	Loop();
+	if (translate != NULL)
+	{
+		if ((out = fopen(translate, "w")) == NULL)
+		{
+			fprintf(stderr, "%s: cannot open %s\n", argv[0], translate);
+			return 1;
+		}
+		i = aot_translate(Mem, out);
+		fclose(out);
+		fprintf(stdout, "%s %d blocks translated to %s\n", Redir, i, translate);
+		return 0;
+	}
+	if (native != NULL && aot_load(native, Mem, stderr))
+		return 1;
+	if (guest.size)
+	{
+		Init();
+		guest.budget = Budget.max_insts ? Budget.max_insts : GUESTFUZZ_BUDGET;
+		return guestfuzz_run(&guest, Mem, Reg, stderr);
+	}
+	if (devices)
+	{
+		BusClock = &InstCount;
+		if (bus_init(Mem, disk))
+		{
+			fprintf(stderr, "%s: cannot open disk file %s\n", argv[0], disk != NULL ? disk : "");
+			return 1;
+		}
+	}
+	if (mode == MODE_SAMPLE)
+	{
+		Init();
+		i = sample_run(&sampling, Mem, Reg, &Halt, Step, stdout, Redir);
+	}
+	else if (mode == MODE_DETAILED)
+	{
+		Init();
+		i = sample_detailed(&sampling, Mem, Reg, stdout, Redir);
+	}
+	else if (mode == MODE_BATCH)
+	{
+		Init();
+		hash_init(&Hash, Mem);
+		StateHash = &Hash;
+		if (HostPerfOn)
+		{
+			hostperf_open(&HostPerf);
+			hostperf_start(&HostPerf);
+		}
+		Run(StepFn == Step);
+		if (HostPerfOn)
+			hostperf_stop(&HostPerf, InstCount);
+		fprintf(stdout, "%s %llu instructions, halted: %s", Redir, InstCount, Halt ? "true" : "false");
+		if (!Halt && Watchdog.stop != STOP_NONE)
+			fprintf(stdout, ", stopped: %s", watchdog_reason(Watchdog.stop));
+		fputc('\n', stdout);
+		DumpReg();
+		bus_close();
+		PrintHash(0);
+		if (Policy)
+			counters_print(&Counters, Policy, stdout, Redir);
+		if (MmuEntries)
+			mmu_print(&Mmu, stdout, Redir);
+		plugin_finish(stdout, Redir);
+		if (HostPerfOn)
+		{
+			hostperf_print(&HostPerf, stdout, Redir);
+			hostperf_close(&HostPerf);
+		}
+		i = 0;
+	}
+	else
+	{
+		Loop();
+		i = 0;
+	}
+	bus_close();
+	sysio_close();
+	if (log != NULL)
+		fclose(log);
 	fclose(FP);
-	return 0;
+	return i;
 }
@@ -17,6 +17,15 @@ typedef struct
 	char RegWrite;
 }struct_controls;
 
+/* machine geometry shared by the simulator modules */
+#define MEMBYTES 65536
+#define MEMSIZE (MEMBYTES >> 2)
+#define REGSIZE 32
+
+#define PCINIT 0x4000
+#define SPINIT 0xFFFC
+#define GPINIT 0xC000
+
 /* ALU */
 void ALU(unsigned A,unsigned B,char ALUControl,unsigned *ALUresult,char *Zero);
 
@@ -0,0 +1,162 @@
+/*
+ * spimlib.c - The simulator as a library: assembles source in memory, loads it straight into a
+ * guest machine and runs it, without .asc files or the command loop of spimcore.
+ * authors: Josiah Nethery
+ */
+
+#include "spimlib.h"
+#include "sysio.h"
+#include "asm.h"
+#include "shared.h"
+
+/*** spim_create
+*		Allocates a machine and maps its memory, zeroed.
+***/
+struct_machine *spim_create(void)
+{
+	struct_machine *m = (struct_machine *) calloc(1, sizeof(struct_machine));
+
+	if (m == NULL)
+		return NULL;
+	m->Mem = shared_map(NULL, NULL);
+	if (m->Mem == NULL)
+	{
+		free(m);
+		return NULL;
+	}
+	spim_reset(m);
+	return m;
+}
+
+void spim_destroy(struct_machine *m)
+{
+	if (m == NULL)
+		return;
+	shared_unmap(m->Mem);
+	free(m);
+}
+
+/*** spim_reset
+*		Clears the memory, by mapping zero pages over it, and sets the registers as Init() in spimcore.c
+*		does.
+***/
+void spim_reset(struct_machine *m)
+{
+	shared_map(NULL, m->Mem);
+	memset(m->Reg, 0, sizeof(m->Reg));
+	m->Reg[REGSIZE] = PCINIT;
+	m->Reg[29] = SPINIT;
+	m->Reg[28] = GPINIT;
+	m->Halt = 0;
+	m->InstCount = 0;
+}
+
+int spim_load_words(struct_machine *m, unsigned addr, const unsigned *words, size_t count)
+{
+	if ((addr & 3) || addr >= MEMBYTES || count > (MEMBYTES - addr) / 4)
+		return 1;
+	memcpy(m->Mem + (addr >> 2), words, count * sizeof(unsigned));
+	return 0;
+}
+
+/*** spim_load_source
+*		Assembles the text as one file and links it on its own, once per process: the image is cached
+*		under a hash of the name and the text, and the machine's memory is mapped copy-on-write on it.
+***/
+int spim_load_source(struct_machine *m, const char *text, size_t size, const char *name)
+{
+	struct object obj;
+	struct image image;
+	struct_shared *img;
+	unsigned long long key;
+	unsigned *mem;
+	int error;
+
+	key = hash_bytes(text, size, name != NULL ? hash_bytes(name, strlen(name), 0) : 0);
+	if ((img = shared_find(key)) == NULL)
+	{
+		if (assemble_buffer(text, size, name, NULL, &obj))
+			return 1;
+		error = link_objects(&obj, 1, &image);
+		free_object(&obj);
+		if (error)
+			return 1;
+		img = shared_load(key, image.text, image.text_count, image.data, image.data_count);
+		free(image.text);
+		free(image.data);
+		if (img == NULL)
+			return 1;
+	}
+	mem = shared_map(img, m->Mem);
+	shared_release(img);
+	return mem == NULL;
+}
+
+/*** spim_step
+*		Runs one instruction through the same datapath as Step() in spimcore.c, with local signals
+*		so that machines do not share their datapath. Syscalls go to the host through syscall_exec(),
+*		whose mode and record/replay log are shared by the whole process.
+***/
+int spim_step(struct_machine *m)
+{
+	unsigned instruction, op, r1, r2, r3, funct, offset, jsec;
+	unsigned data1, data2, extended_value, ALUresult, memdata = 0;
+	struct_controls controls;
+	char Zero;
+
+	if (m->Halt)
+		return 1;
+	m->Halt = instruction_fetch(m->Reg[REGSIZE], m->Mem, &instruction);
+	if (!m->Halt)
+	{
+		instruction_partition(instruction, &op, &r1, &r2, &r3, &funct, &offset, &jsec);
+		m->Halt = instruction_decode(op, &controls);
+	}
+	if (!m->Halt && op == 0 && funct == 12)
+	{
+		m->Halt = syscall_exec(m->Reg, m->Mem, m->InstCount);
+		if (!m->Halt)
+		{
+			m->Reg[REGSIZE] += 4;
+			m->InstCount++;
+		}
+		return m->Halt;
+	}
+	if (!m->Halt)
+	{
+		read_register(r1, r2, m->Reg, &data1, &data2);
+		sign_extend(offset, &extended_value);
+		m->Halt = ALU_operations(data1, data2, extended_value, funct, controls.ALUOp, controls.ALUSrc, &ALUresult, &Zero);
+	}
+	if (!m->Halt)
+		m->Halt = rw_memory(ALUresult, data2, controls.MemWrite, controls.MemRead, &memdata, m->Mem);
+	if (!m->Halt)
+	{
+		write_register(r2, r3, memdata, ALUresult, controls.RegWrite, controls.RegDst, controls.MemtoReg, m->Reg);
+		PC_update(jsec, extended_value, controls.Branch, controls.Jump, Zero, &m->Reg[REGSIZE]);
+		m->InstCount++;
+	}
+	return m->Halt;
+}
+
+unsigned long long spim_run(struct_machine *m, unsigned long long max)
+{
+	unsigned long long start = m->InstCount;
+
+	while ((max == 0 || m->InstCount - start < max) && !spim_step(m))
+		;
+	return m->InstCount - start;
+}
+
+void spim_get_regs(const struct_machine *m, unsigned *regs)
+{
+	memcpy(regs, m->Reg, sizeof(m->Reg));
+}
+
+int spim_read_mem(const struct_machine *m, unsigned addr, unsigned *words, size_t count)
+{
+	if ((addr & 3) || addr >= MEMBYTES || count > (MEMBYTES - addr) / 4)
+		return 1;
+	memcpy(words, m->Mem + (addr >> 2), count * sizeof(unsigned));
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include "spimcore.h"
+
+#ifndef SPIMLIB
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a complete guest machine; any number of them can be used at once, on as many threads, as long as
+   only one thread at a time runs a machine that makes syscalls: those share the process-wide state
+   of sysio.c */
+typedef struct
+{
+	unsigned *Mem;			// MEMSIZE words of guest memory, mapped by shared.c
+	unsigned Reg[REGSIZE + 4];	// general registers, then pc, status, lo and hi
+	int Halt;
+	unsigned long long InstCount;
+}struct_machine;
+
+/* create a machine with zeroed memory and initial registers; NULL if out of memory */
+struct_machine *spim_create(void);
+
+/* release a machine */
+void spim_destroy(struct_machine *m);
+
+/* zero the memory and set the registers to their initial values */
+void spim_reset(struct_machine *m);
+
+/* copy encoded words into guest memory at a word-aligned address; returns 1 if they do not fit */
+int spim_load_words(struct_machine *m, unsigned addr, const unsigned *words, size_t count);
+
+/* assemble and link source text, then replace the whole memory with the text at PCINIT and the data
+   at GPINIT; the same source is assembled once per process and its image shared by every machine.
+   Returns 1 on an assembly error (reported on stdout as by the assembler) */
+int spim_load_source(struct_machine *m, const char *text, size_t size, const char *name);
+
+/* execute one instruction; returns 1 if the machine halts */
+int spim_step(struct_machine *m);
+
+/* run until the machine halts or max instructions have run (0 for no limit); returns the number run */
+unsigned long long spim_run(struct_machine *m, unsigned long long max);
+
+/* copy the REGSIZE + 4 registers out */
+void spim_get_regs(const struct_machine *m, unsigned *regs);
+
+/* copy count words of guest memory from a word-aligned address out; returns 1 if out of range */
+int spim_read_mem(const struct_machine *m, unsigned addr, unsigned *words, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SPIMLIB
+#endif
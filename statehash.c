@@ -0,0 +1,177 @@
+/*
+ * statehash.c - Incremental hash of the architectural state. Every page of memory has an additive
+ * hash, the sum of a mix of each word with its index, so a store updates it with two mixes and a
+ * subtraction. The pages are the leaves of a Merkle tree whose root, combined with the registers,
+ * makes two states equal in one comparison and lists the pages that differ in time proportional to
+ * their number. The fast engine, whose state is mostly read once at the end, only marks the pages it
+ * writes, and they are hashed again when the hash is read. The same reports keep a bitmap of the
+ * pages that were not all zero when the hash was made or have been written since, so the memory can
+ * be dumped or compared page by page without looking at the pages that are known to be zero.
+ * authors: Josiah Nethery
+ */
+
+#include "statehash.h"
+
+struct_hash *StateHash = NULL;
+
+static unsigned long long hash_page(const unsigned *Mem, int page)
+{
+	unsigned long long sum = 0;
+	unsigned i = page * HASH_PAGE_WORDS;
+	unsigned end = i + HASH_PAGE_WORDS;
+
+	for (; i < end; i++)
+		sum += hash_word(i, Mem[i]);
+	return sum;
+}
+
+static unsigned long long hash_pair(unsigned long long left, unsigned long long right)
+{
+	return hash_mix(left + (right << 17 | right >> 47) + 0x9E3779B97F4A7C15ULL);
+}
+
+/* 1 if the page has a word that is not zero */
+static int nonzero_page(const unsigned *Mem, int page)
+{
+	unsigned i = page * HASH_PAGE_WORDS;
+	unsigned end = i + HASH_PAGE_WORDS;
+
+	for (; i < end; i++)
+	{
+		if (Mem[i])
+			return 1;
+	}
+	return 0;
+}
+
+void hash_init(struct_hash *h, const unsigned *Mem)
+{
+	int i;
+
+	h->Mem = Mem;
+	memset(h->touched, 0, sizeof(h->touched));
+	for (i = 0; i < HASH_PAGES; i++)
+	{
+		h->page[i] = hash_page(Mem, i);
+		h->stale[i] = 0;
+		if (nonzero_page(Mem, i))
+			hash_mark(h, i);
+	}
+	h->any_stale = 0;
+	h->dirty = 1;
+}
+
+void hash_stale(struct_hash *h, unsigned addr, unsigned bytes)
+{
+	unsigned page;
+
+	if (bytes == 0 || addr >= MEMBYTES)
+		return;
+	if (bytes > MEMBYTES - addr)
+		bytes = MEMBYTES - addr;
+	for (page = addr / 4 / HASH_PAGE_WORDS; page <= (addr + bytes - 1) / 4 / HASH_PAGE_WORDS; page++)
+	{
+		h->stale[page] = 1;
+		hash_mark(h, page);
+	}
+	h->any_stale = 1;
+}
+
+/*** hash_next_touched
+*		Whole words of the bitmap are skipped at a time, so finding the next page costs one bit scan per
+*		64 pages.
+***/
+unsigned hash_next_touched(const struct_hash *h, unsigned page)
+{
+	unsigned long long bits;
+	unsigned w = page / 64;
+
+	if (page >= HASH_PAGES)
+		return HASH_PAGES;
+	bits = h->touched[w] & (~0ULL << (page % 64));
+	while (bits == 0)
+	{
+		if (++w == HASH_TOUCH_WORDS)
+			return HASH_PAGES;
+		bits = h->touched[w];
+	}
+	page = w * 64 + __builtin_ctzll(bits);
+	return page < HASH_PAGES ? page : HASH_PAGES;
+}
+
+void hash_untouch(struct_hash *h)
+{
+	memset(h->touched, 0, sizeof(h->touched));
+}
+
+/*** settle
+*		Hashes the stale pages again and rebuilds the tree if a page changed. With 64 pages the whole
+*		tree is 63 mixes, less than keeping track of the paths that changed.
+***/
+static void settle(struct_hash *h)
+{
+	int i;
+
+	if (h->any_stale)
+	{
+		for (i = 0; i < HASH_PAGES; i++)
+		{
+			if (h->stale[i])
+			{
+				h->page[i] = hash_page(h->Mem, i);
+				h->stale[i] = 0;
+			}
+		}
+		h->any_stale = 0;
+		h->dirty = 1;
+	}
+	if (h->dirty)
+	{
+		for (i = 0; i < HASH_PAGES; i++)
+			h->node[HASH_PAGES + i] = hash_mix(h->page[i] ^ (unsigned long long) i);
+		for (i = HASH_PAGES - 1; i > 0; i--)
+			h->node[i] = hash_pair(h->node[2 * i], h->node[2 * i + 1]);
+		h->dirty = 0;
+	}
+}
+
+unsigned long long hash_memory(struct_hash *h)
+{
+	settle(h);
+	return h->node[1];
+}
+
+unsigned long long hash_registers(const unsigned *Reg)
+{
+	unsigned long long hash = 0;
+	int i;
+
+	for (i = 0; i < REGSIZE + 4; i++)
+		hash = hash_pair(hash, hash_word(i, Reg[i]));
+	return hash;
+}
+
+unsigned long long hash_state(struct_hash *h, const unsigned *Reg)
+{
+	return hash_pair(hash_memory(h), hash_registers(Reg));
+}
+
+static int walk(const struct_hash *a, const struct_hash *b, int node, int *pages, int n)
+{
+	if (a->node[node] == b->node[node])
+		return n;
+	if (node >= HASH_PAGES)
+	{
+		pages[n] = node - HASH_PAGES;
+		return n + 1;
+	}
+	n = walk(a, b, 2 * node, pages, n);
+	return walk(a, b, 2 * node + 1, pages, n);
+}
+
+int hash_diff(struct_hash *a, struct_hash *b, int *pages)
+{
+	settle(a);
+	settle(b);
+	return walk(a, b, 1, pages, 0);
+}
@@ -0,0 +1,94 @@
+#include "spimcore.h"
+
+#ifndef STATEHASH
+
+/* memory is hashed in pages of this many words, the leaves of the Merkle tree */
+#define HASH_PAGE_WORDS 256
+#define HASH_PAGES (MEMSIZE / HASH_PAGE_WORDS)
+#define HASH_TOUCH_WORDS ((HASH_PAGES + 63) / 64)
+
+typedef struct
+{
+	unsigned long long page[HASH_PAGES];		// sum of hash_word() over the words of each page
+	unsigned long long node[2 * HASH_PAGES];	// the tree: node[1] is the root, page i is node[HASH_PAGES + i]
+	unsigned char stale[HASH_PAGES];		// pages written in bulk, to hash again from memory
+	int any_stale;
+	int dirty;					// page sums changed since the tree was built
+	unsigned long long touched[HASH_TOUCH_WORDS];	// pages not all zero at hash_init() or written since
+	const unsigned *Mem;
+}struct_hash;
+
+/* the hash kept up to date by rw_memory(), fast_run() and the syscalls and devices that write
+   memory; NULL when state is not hashed */
+extern struct_hash *StateHash;
+
+/* a bijective 64-bit mix */
+static inline unsigned long long hash_mix(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static inline unsigned long long hash_word(unsigned index, unsigned value)
+{
+	return hash_mix(((unsigned long long) index << 32) | value);
+}
+
+static inline void hash_mark(struct_hash *h, unsigned page)
+{
+	h->touched[page / 64] |= 1ULL << (page % 64);
+}
+
+/* 1 if the page may hold anything but zeros; the others are all zero */
+static inline int hash_touched(const struct_hash *h, unsigned page)
+{
+	return (h->touched[page / 64] >> (page % 64)) & 1;
+}
+
+/* the memory word at index changes from old to value: the page sum is updated in O(1) */
+static inline void hash_store(struct_hash *h, unsigned index, unsigned old, unsigned value)
+{
+	h->page[index / HASH_PAGE_WORDS] += hash_word(index, value) - hash_word(index, old);
+	h->dirty = 1;
+	hash_mark(h, index / HASH_PAGE_WORDS);
+}
+
+/* the memory word at index is about to be written: its page is hashed again when the hash is next
+   read, which costs less per store than hash_store() when the hash is read rarely */
+static inline void hash_touch(struct_hash *h, unsigned index)
+{
+	h->stale[index / HASH_PAGE_WORDS] = 1;
+	h->any_stale = 1;
+	hash_mark(h, index / HASH_PAGE_WORDS);
+}
+
+/* hash all of Mem, which every later write is reported for */
+void hash_init(struct_hash *h, const unsigned *Mem);
+
+/* bytes from addr were written without hash_store() */
+void hash_stale(struct_hash *h, unsigned addr, unsigned bytes);
+
+/* the first touched page from page on, or HASH_PAGES if there is none */
+unsigned hash_next_touched(const struct_hash *h, unsigned page);
+
+/* forget the touched pages: from now on they are the pages written since */
+void hash_untouch(struct_hash *h);
+
+/* root of the memory tree */
+unsigned long long hash_memory(struct_hash *h);
+
+/* hash of the registers */
+unsigned long long hash_registers(const unsigned *Reg);
+
+/* the whole architectural state: the memory root combined with the registers */
+unsigned long long hash_state(struct_hash *h, const unsigned *Reg);
+
+/* the pages whose contents differ between a and b, found by walking down the nodes that differ
+   only; returns how many were put in pages (HASH_PAGES at most) */
+int hash_diff(struct_hash *a, struct_hash *b, int *pages);
+
+#define STATEHASH
+#endif
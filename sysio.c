@@ -0,0 +1,304 @@
+/*
+ * sysio.c - Guest syscalls for the MIPS simulator, with deterministic record/replay of every
+ * nondeterministic value delivered to the guest (console input, file contents, timers).
+ * The log is a sequence of events: the instruction count since the previous event and the
+ * service number, followed by the delivered value and, for reads, the bytes. Numbers are LEB128.
+ * authors: Josiah Nethery
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "sysio.h"
+#include "statehash.h"
+
+#define LOG_MAGIC "SPIMLOG1"
+
+static int Mode = SYSIO_LIVE;
+static FILE *Log;
+static unsigned char *Data;	// the whole log (replay) or everything recorded so far
+static size_t Len, Cap;
+static struct_sysio_cursor Main;	// where the simulator is in the log
+static int Rewound;			// the run is repeating output already printed
+static __thread unsigned char Bytes[MEMBYTES];
+
+static void reserve(size_t n)
+{
+	while (Len + n > Cap)
+	{
+		Cap = Cap ? Cap * 2 : 4096;
+		Data = (unsigned char *) realloc(Data, Cap);
+	}
+}
+
+/*** put_varint
+*		Appends an unsigned LEB128 number to the in-memory log.
+***/
+static void put_varint(unsigned long long v)
+{
+	reserve(10);
+	while (v >= 0x80)
+	{
+		Data[Len++] = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+	Data[Len++] = (unsigned char) v;
+}
+
+static int get_varint(size_t *pos, unsigned long long *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (*pos < Len && shift < 64)
+	{
+		*v |= (unsigned long long) (Data[*pos] & 0x7F) << shift;
+		if ((Data[(*pos)++] & 0x80) == 0)
+			return 0;
+		shift += 7;
+	}
+	return 1;
+}
+
+/*** sysio_init
+*		Selects live, record or replay mode. A replay log is read completely into memory here,
+*		so that the replayed run does no host I/O.
+***/
+int sysio_init(int mode, FILE *log)
+{
+	char magic[sizeof(LOG_MAGIC) - 1];
+
+	Mode = mode;
+	Len = 0;
+	Rewound = 0;
+	memset(&Main, 0, sizeof(Main));
+	Main.synced = 1;
+	if (mode == SYSIO_RECORD)
+	{
+		Log = log;
+		fwrite(LOG_MAGIC, 1, sizeof(magic), Log);
+	}
+	else if (mode == SYSIO_REPLAY)
+	{
+		if (fread(magic, 1, sizeof(magic), log) != sizeof(magic) || memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0)
+			return 1;
+		while (!feof(log) && !ferror(log))
+		{
+			reserve(4096);
+			Len += fread(Data + Len, 1, Cap - Len, log);
+		}
+	}
+	return 0;
+}
+
+int sysio_live(void)
+{
+	return Mode != SYSIO_REPLAY;
+}
+
+void sysio_close(void)
+{
+	if (Log != NULL)
+		fflush(Log);
+}
+
+void sysio_mark(struct_sysio_pos *pos)
+{
+	if (Mode == SYSIO_LIVE)
+	{
+		Mode = SYSIO_RECORD;
+		Len = 0;
+	}
+	pos->offset = (Mode == SYSIO_REPLAY) ? Main.pos : Len;
+	pos->icount = Main.last;
+}
+
+void sysio_rewind(const struct_sysio_pos *pos)
+{
+	if (Log != NULL)
+		fflush(Log);
+	Log = NULL;
+	Mode = SYSIO_REPLAY;
+	Rewound = 1;
+	sysio_cursor(&Main, pos);
+}
+
+void sysio_cursor(struct_sysio_cursor *c, const struct_sysio_pos *pos)
+{
+	c->pos = pos->offset;
+	c->last = pos->icount;
+	c->skew = 0;
+	c->synced = 0;
+}
+
+/*** deliver
+*		Passes one nondeterministic value (and, for reads, its bytes) through the log.
+*		Recording appends the event, replaying overwrites *value and bytes with the logged event.
+*		Returns 1 if the replayed run diverges from the log. c is where in the log the replay is, the
+*		simulator's own or a private cursor.
+***/
+static int deliver(struct_sysio_cursor *c, int mode, unsigned long long icount, int service, unsigned long long *value,
+	unsigned char *bytes, size_t max)
+{
+	unsigned long long delta, logged, n;
+	size_t start = Len;
+
+	if (mode == SYSIO_RECORD)
+	{
+		put_varint(icount - c->skew - c->last);
+		put_varint(service);
+		put_varint(*value);
+		n = bytes ? *value : 0;
+		if ((long long) (int) n > 0)
+		{
+			reserve(n);
+			memcpy(Data + Len, bytes, n);
+			Len += n;
+		}
+		if (Log != NULL)
+			fwrite(Data + start, 1, Len - start, Log);
+		c->last = icount - c->skew;
+	}
+	else if (mode == SYSIO_REPLAY)
+	{
+		if (get_varint(&c->pos, &delta) || get_varint(&c->pos, &logged))
+		{
+			fprintf(stderr, "replay: log exhausted at instruction %llu\n", icount);
+			return 1;
+		}
+		if (!c->synced)
+		{
+			c->skew = icount - (c->last + delta);
+			c->synced = 1;
+		}
+		if (logged != (unsigned long long) service || c->last + delta != icount - c->skew)
+		{
+			fprintf(stderr, "replay: diverged at instruction %llu (log has service %llu at %llu)\n",
+				icount, logged, c->last + delta + c->skew);
+			return 1;
+		}
+		c->last += delta;
+		if (get_varint(&c->pos, value))
+			return 1;
+		n = bytes ? *value : 0;
+		if ((long long) (int) n > 0)
+		{
+			if (n > max || c->pos + n > Len)
+				return 1;
+			memcpy(bytes, Data + c->pos, n);
+			c->pos += n;
+		}
+	}
+	return 0;
+}
+
+static int read_string(unsigned *Mem, unsigned addr, char *s, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++, addr++)
+	{
+		if (addr >= MEMBYTES)
+			return 1;
+		s[i] = (char) (Mem[addr >> 2] >> ((addr & 3) * 8));
+		if (s[i] == '\0')
+			return 0;
+	}
+	return 1;
+}
+
+/*** execute
+*		Executes the service selected by $v0 with arguments in $a0-$a2 and advances nothing but the
+*		registers and memory it writes; the caller moves the PC on. Bytes are stored in guest memory
+*		little-endian within each word. Returns 1 (halt) on exit, an unknown service, a bad guest
+*		buffer or a replay divergence. quiet leaves out the output of the prints.
+***/
+static int execute(struct_sysio_cursor *c, int mode, int quiet, unsigned *Reg, unsigned *Mem, unsigned long long icount)
+{
+	unsigned long long value = 0;
+	unsigned a0 = Reg[4], a1 = Reg[5], a2 = Reg[6], i;
+	char line[BUFSIZ];
+	struct timeval tv;
+
+	switch (Reg[2])
+	{
+		case SYS_PRINT_INT:
+			if (!quiet)
+				fprintf(stdout, "%d", (int) a0);
+			return 0;
+		case SYS_PRINT_CHAR:
+			if (!quiet)
+				fputc((int) (a0 & 0xFF), stdout);
+			return 0;
+		case SYS_EXIT:
+			return 1;
+		case SYS_READ_INT:
+			if (mode != SYSIO_REPLAY)
+				value = fgets(line, sizeof(line), stdin) ? (unsigned) strtol(line, (char **) NULL, 10) : 0;
+			if (deliver(c, mode, icount, SYS_READ_INT, &value, NULL, 0))
+				return 1;
+			Reg[2] = (unsigned) value;
+			return 0;
+		case SYS_READ_CHAR:
+			if (mode != SYSIO_REPLAY)
+				value = (unsigned) fgetc(stdin);
+			if (deliver(c, mode, icount, SYS_READ_CHAR, &value, NULL, 0))
+				return 1;
+			Reg[2] = (unsigned) value;
+			return 0;
+		case SYS_TIME:
+			if (mode != SYSIO_REPLAY)
+			{
+				gettimeofday(&tv, NULL);
+				value = (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+			}
+			if (deliver(c, mode, icount, SYS_TIME, &value, NULL, 0))
+				return 1;
+			Reg[4] = (unsigned) value;
+			Reg[5] = (unsigned) (value >> 32);
+			return 0;
+		case SYS_OPEN:
+			if (read_string(Mem, a0, line, sizeof(line)))
+				return 1;
+			if (mode != SYSIO_REPLAY)
+				value = (unsigned) open(line, O_RDONLY);
+			if (deliver(c, mode, icount, SYS_OPEN, &value, NULL, 0))
+				return 1;
+			Reg[2] = (unsigned) value;
+			return 0;
+		case SYS_READ:
+			if (a1 >= MEMBYTES || a2 > MEMBYTES - a1)
+				return 1;
+			if (mode != SYSIO_REPLAY)
+				value = (unsigned) read((int) a0, Bytes, a2);
+			if (deliver(c, mode, icount, SYS_READ, &value, Bytes, a2))
+				return 1;
+			if (StateHash != NULL && (int) value > 0)
+				hash_stale(StateHash, a1, value);
+			for (i = 0; (int) i < (int) value; i++, a1++)
+				Mem[a1 >> 2] = (Mem[a1 >> 2] & ~(0xFFu << ((a1 & 3) * 8))) | ((unsigned) Bytes[i] << ((a1 & 3) * 8));
+			Reg[2] = (unsigned) value;
+			return 0;
+		case SYS_CLOSE:
+			if (mode != SYSIO_REPLAY && (int) a0 > 2)
+				close((int) a0);
+			Reg[2] = 0;
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+int syscall_exec(unsigned *Reg, unsigned *Mem, unsigned long long icount)
+{
+	return execute(&Main, Mode, Rewound, Reg, Mem, icount);
+}
+
+/*** sysio_replay
+*		Only reads the log, which no longer grows once a replay is under way, so any number of
+*		cursors can replay at once on their own threads.
+***/
+int sysio_replay(void *cursor, unsigned *Reg, unsigned *Mem, unsigned long long icount)
+{
+	return execute((struct_sysio_cursor *) cursor, SYSIO_REPLAY, 1, Reg, Mem, icount);
+}
@@ -0,0 +1,65 @@
+#include "spimcore.h"
+
+#ifndef SYSIO
+
+/* how nondeterministic guest inputs are delivered */
+#define SYSIO_LIVE 0	// read the host
+#define SYSIO_RECORD 1	// read the host and log every value
+#define SYSIO_REPLAY 2	// feed the values back from the log, no host input at all
+
+/* syscall services, numbered as in SPIM */
+#define SYS_PRINT_INT 1
+#define SYS_READ_INT 5
+#define SYS_EXIT 10
+#define SYS_PRINT_CHAR 11
+#define SYS_READ_CHAR 12
+#define SYS_OPEN 13
+#define SYS_READ 14
+#define SYS_CLOSE 16
+#define SYS_TIME 30
+
+/* position in the input log, saved together with a checkpoint */
+typedef struct
+{
+	size_t offset;
+	unsigned long long icount;
+}struct_sysio_pos;
+
+/* a reader of the log at a position of its own */
+typedef struct
+{
+	size_t pos;
+	unsigned long long last;	// logged instruction count of the previous event
+	long long skew;			// guest instruction count minus logged count while replaying
+	int synced;
+}struct_sysio_cursor;
+
+/* select the input mode; log is written (record) or read completely into memory (replay) */
+int sysio_init(int mode, FILE *log);
+
+/* 1 if syscalls read the host, 0 while the inputs are replayed */
+int sysio_live(void);
+
+/* flush the record log */
+void sysio_close(void);
+
+/* execute the syscall requested in $v0; returns 1 if the machine halts */
+int syscall_exec(unsigned *Reg, unsigned *Mem, unsigned long long icount);
+
+/* remember the current log position; a live session starts recording into memory */
+void sysio_mark(struct_sysio_pos *pos);
+
+/* go back to a marked position and replay the inputs from there; the prints of the run that goes
+   over the same ground again are left out */
+void sysio_rewind(const struct_sysio_pos *pos);
+
+/* start a private cursor at a marked position of a log that is being replayed */
+void sysio_cursor(struct_sysio_cursor *c, const struct_sysio_pos *pos);
+
+/* execute a syscall from the log at cursor (a struct_sysio_cursor) without any output or host
+   input; a fast_syscall handler, for runs that repeat part of the main one. Returns 1 if the machine
+   halts */
+int sysio_replay(void *cursor, unsigned *Reg, unsigned *Mem, unsigned long long icount);
+
+#define SYSIO
+#endif
@@ -0,0 +1,138 @@
+/*
+ * timing.c - Detailed timing model for the MIPS simulator. Executes instructions with the
+ * stage functions of project.c on a private copy of the machine and charges cycles for an
+ * in-order five stage pipeline with instruction/data caches and a bimodal branch predictor.
+ * authors: Josiah Nethery
+ */
+
+#include "timing.h"
+#include "sysio.h"
+
+/*** timing_init
+*		Invalidates both caches, sets every predictor counter to weakly not-taken and clears
+*		the cycle and event counters.
+***/
+void timing_init(struct_timing *tm)
+{
+	memset(tm, 0, sizeof(struct_timing));
+	memset(tm->bht, 1, TM_BHT_SIZE);
+}
+
+/*** cache_access
+*		Looks up the line holding addr in a direct-mapped cache and fills it on a miss.
+*		Returns 1 on a hit and 0 on a miss.
+***/
+static int cache_access(struct_cache *cache, unsigned addr)
+{
+	unsigned line = addr >> TM_LINE_SHIFT;
+	unsigned index = line & (TM_CACHE_LINES - 1);
+
+	if (cache->valid[index] && cache->tag[index] == line)
+		return 1;
+	cache->valid[index] = 1;
+	cache->tag[index] = line;
+	return 0;
+}
+
+/*** timing_step
+*		Runs one instruction through the same datapath as Step() in spimcore.c, but with local
+*		signals so that several models can run in parallel. When detailed is 0 the caches and
+*		predictor are only warmed up and no cycles or instructions are counted.
+*		The cost of an instruction is one cycle plus cache miss, load-use, branch mispredict
+*		and jump penalties. A syscall costs one cycle and its fetch.
+***/
+int timing_step(struct_timing *tm, unsigned *Mem, unsigned *Reg, int detailed, fast_syscall sys, void *arg)
+{
+	unsigned instruction, op, r1, r2, r3, funct, offset, jsec;
+	unsigned data1, data2, extended_value, ALUresult, memdata = 0;
+	unsigned pc = Reg[REGSIZE];
+	unsigned taken, counter;
+	unsigned long long cycles = 1;
+	struct_controls controls;
+	char Zero;
+
+	if (instruction_fetch(pc, Mem, &instruction))
+		return 1;
+	instruction_partition(instruction, &op, &r1, &r2, &r3, &funct, &offset, &jsec);
+	if (instruction_decode(op, &controls))
+		return 1;
+	if (op == 0 && funct == 12)
+	{
+		if (sys != NULL ? sys(arg, Reg, Mem, tm->steps) : syscall_exec(Reg, Mem, tm->steps))
+			return 1;
+		Reg[REGSIZE] += 4;
+		if (!cache_access(&tm->icache, pc))
+		{
+			cycles += TM_MISS_PENALTY;
+			tm->icache_misses += detailed;
+		}
+		tm->load_dest = 0;
+		tm->steps++;
+		if (detailed)
+		{
+			tm->cycles += cycles;
+			tm->insts++;
+		}
+		return 0;
+	}
+	read_register(r1, r2, Reg, &data1, &data2);
+	sign_extend(offset, &extended_value);
+	if (ALU_operations(data1, data2, extended_value, funct, controls.ALUOp, controls.ALUSrc, &ALUresult, &Zero))
+		return 1;
+	if (rw_memory(ALUresult, data2, controls.MemWrite, controls.MemRead, &memdata, Mem))
+		return 1;
+	write_register(r2, r3, memdata, ALUresult, controls.RegWrite, controls.RegDst, controls.MemtoReg, Reg);
+	PC_update(jsec, extended_value, controls.Branch, controls.Jump, Zero, &Reg[REGSIZE]);
+
+	if (!cache_access(&tm->icache, pc))
+	{
+		cycles += TM_MISS_PENALTY;
+		tm->icache_misses += detailed;
+	}
+
+	//r2 is only a source for r-type, beq and sw
+	if (tm->load_dest != 0 && (r1 == tm->load_dest ||
+		(r2 == tm->load_dest && (op == 0 || op == 4 || op == 43))))
+	{
+		cycles += TM_LOAD_USE_PENALTY;
+		tm->load_stalls += detailed;
+	}
+	tm->load_dest = (controls.MemRead == '1') ? r2 : 0;
+
+	if (controls.MemRead == '1' || controls.MemWrite == '1')
+	{
+		if (!cache_access(&tm->dcache, ALUresult))
+		{
+			cycles += TM_MISS_PENALTY;
+			tm->dcache_misses += detailed;
+		}
+	}
+
+	if (controls.Jump == '1')
+	{
+		cycles += TM_JUMP_PENALTY;
+	}
+	else if (controls.Branch == '1')
+	{
+		taken = Reg[REGSIZE] != pc + 4;
+		counter = tm->bht[(pc >> 2) & (TM_BHT_SIZE - 1)];
+		if ((counter >= 2) != taken)
+		{
+			cycles += TM_BRANCH_PENALTY;
+			tm->mispredicts += detailed;
+		}
+		if (taken && counter < 3)
+			counter++;
+		else if (!taken && counter > 0)
+			counter--;
+		tm->bht[(pc >> 2) & (TM_BHT_SIZE - 1)] = counter;
+	}
+
+	tm->steps++;
+	if (detailed)
+	{
+		tm->cycles += cycles;
+		tm->insts++;
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include "spimcore.h"
+#include "fast.h"
+
+#ifndef TIMING
+
+/* in-order five stage pipeline parameters (cycles) */
+#define TM_MISS_PENALTY 10
+#define TM_BRANCH_PENALTY 2
+#define TM_JUMP_PENALTY 1
+#define TM_LOAD_USE_PENALTY 1
+
+/* direct-mapped caches of TM_CACHE_LINES lines of 16 bytes each */
+#define TM_CACHE_LINES 64
+#define TM_LINE_SHIFT 4
+
+/* bimodal branch predictor of 2-bit counters */
+#define TM_BHT_SIZE 256
+
+typedef struct
+{
+	unsigned tag[TM_CACHE_LINES];
+	char valid[TM_CACHE_LINES];
+}struct_cache;
+
+typedef struct
+{
+	struct_cache icache;
+	struct_cache dcache;
+	unsigned char bht[TM_BHT_SIZE];
+	unsigned load_dest;
+	unsigned long long cycles;
+	unsigned long long insts;
+	unsigned long long steps;	// instructions run, warming included: the count seen by syscalls
+	unsigned long long icache_misses;
+	unsigned long long dcache_misses;
+	unsigned long long mispredicts;
+	unsigned long long load_stalls;
+}struct_timing;
+
+/* reset caches, predictor and counters */
+void timing_init(struct_timing *tm);
+
+/* execute one instruction on Mem/Reg and account its cycles; syscalls go to sys with arg, or to
+   syscall_exec() if sys is NULL. Returns 1 on halt */
+int timing_step(struct_timing *tm, unsigned *Mem, unsigned *Reg, int detailed, fast_syscall sys, void *arg);
+
+#define TIMING
+#endif
@@ -0,0 +1,104 @@
+/*
+ * watchdog.c - Execution budgets for runaway guest programs. A run is cut into slices of at most
+ * WATCHDOG_SLICE instructions; the instruction budget bounds the slices so that it is exact, and the
+ * clock and the written pages are only looked at between slices, which keeps the engines' inner loops
+ * free of any check. The time and memory limits may therefore be overrun by up to one slice.
+ * authors: Josiah Nethery
+ */
+
+#include <time.h>
+#include "watchdog.h"
+
+static unsigned long long now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void watchdog_start(struct_watchdog *w, const struct_budget *budget, const unsigned *Mem, unsigned long long icount)
+{
+	w->budget = *budget;
+	w->first = icount;
+	w->spent_ns = 0;
+	w->resumed_ns = 0;
+	w->pages = 0;
+	w->stop = STOP_NONE;
+	memset(w->written, 0, sizeof(w->written));
+	if (budget->max_pages)
+	{
+		if (w->image == NULL)
+			w->image = (unsigned *) malloc(MEMBYTES);
+		memcpy(w->image, Mem, MEMBYTES);
+	}
+}
+
+unsigned long long watchdog_slice(struct_watchdog *w, unsigned long long icount)
+{
+	unsigned long long n = WATCHDOG_SLICE, left;
+
+	if (w->stop != STOP_NONE)
+		return 0;
+	if (w->budget.max_insts)
+	{
+		left = w->budget.max_insts - (icount - w->first);
+		if (left == 0)
+		{
+			w->stop = STOP_INSTS;
+			return 0;
+		}
+		if (left < n)
+			n = left;
+	}
+	if (w->budget.timeout_ms)
+		w->resumed_ns = now_ns();
+	return n;
+}
+
+/*** watchdog_check
+*		Only the pages not yet known to be written are compared with the memory the run started from,
+*		so a page costs one comparison per slice until it is written, and nothing afterwards.
+***/
+int watchdog_check(struct_watchdog *w, const unsigned *Mem, unsigned long long icount)
+{
+	unsigned i;
+
+	if (w->budget.timeout_ms)
+	{
+		w->spent_ns += now_ns() - w->resumed_ns;
+		if (w->spent_ns >= w->budget.timeout_ms * 1000000ULL)
+			w->stop = STOP_TIME;
+	}
+	if (w->budget.max_pages)
+	{
+		for (i = 0; i < MEMSIZE / WATCHDOG_PAGE_WORDS; i++)
+		{
+			if (!w->written[i] && memcmp(Mem + i * WATCHDOG_PAGE_WORDS, w->image + i * WATCHDOG_PAGE_WORDS,
+				WATCHDOG_PAGE_WORDS * sizeof(unsigned)) != 0)
+			{
+				w->written[i] = 1;
+				w->pages++;
+			}
+		}
+		if (w->pages > w->budget.max_pages)
+			w->stop = STOP_PAGES;
+	}
+	if (w->stop == STOP_NONE && w->budget.max_insts && icount - w->first >= w->budget.max_insts)
+		w->stop = STOP_INSTS;
+	return w->stop;
+}
+
+const char *watchdog_reason(int stop)
+{
+	switch (stop)
+	{
+		case STOP_INSTS:
+			return "instruction budget";
+		case STOP_TIME:
+			return "timeout";
+		case STOP_PAGES:
+			return "memory-touch limit";
+	}
+	return "none";
+}
@@ -0,0 +1,49 @@
+#include "spimcore.h"
+
+#ifndef WATCHDOG
+
+/* why the watchdog stopped a run */
+#define STOP_NONE 0
+#define STOP_INSTS 1		// instruction budget used up
+#define STOP_TIME 2		// wall-clock timeout
+#define STOP_PAGES 3		// too many pages of memory written
+
+/* instructions run between two checks of the time and memory limits */
+#define WATCHDOG_SLICE 65536
+
+/* granularity of the memory-touch limit, in words */
+#define WATCHDOG_PAGE_WORDS 256
+
+typedef struct
+{
+	unsigned long long max_insts;	// instructions per run, 0 for no limit
+	unsigned long long timeout_ms;	// time spent running, 0 for no limit
+	unsigned max_pages;		// pages written, 0 for no limit
+}struct_budget;
+
+typedef struct
+{
+	struct_budget budget;
+	unsigned long long first;	// instruction count when the run started
+	unsigned long long spent_ns;	// time spent running so far
+	unsigned long long resumed_ns;	// when the current slice started
+	unsigned *image;		// memory when the run started, with max_pages
+	unsigned char written[MEMSIZE / WATCHDOG_PAGE_WORDS];
+	unsigned pages;
+	int stop;			// STOP_*
+}struct_watchdog;
+
+/* start a run on Mem with the limits of budget */
+void watchdog_start(struct_watchdog *w, const struct_budget *budget, const unsigned *Mem, unsigned long long icount);
+
+/* instructions (steps) that may run before the next watchdog_check(), 0 once the run is stopped */
+unsigned long long watchdog_slice(struct_watchdog *w, unsigned long long icount);
+
+/* after a slice: checks the limits and returns the reason the run stops, STOP_NONE to go on */
+int watchdog_check(struct_watchdog *w, const unsigned *Mem, unsigned long long icount);
+
+/* name of a STOP_* reason */
+const char *watchdog_reason(int stop);
+
+#define WATCHDOG
+#endif